@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Benchmark of IEC61850 model construction and SCL export.  Builds a
+//synthetic configuration of DO/DI/AO/AI points and prints one
+//machine-readable line per measurement:
+//  bench61850 <name> points=<n> ms=<elapsed>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "var.h"
+#include "iec61850.h"
+
+static double benchMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static void benchReport(char* name, unsigned int points, double start) {
+	printf("bench61850 %s points=%u ms=%.3f\n",name,points,benchMs()-start);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	unsigned int points = VARSMAX;
+	unsigned int i;
+	char name[16];
+	var_t* v;
+	double start;
+	static const unsigned char types[] = { PNT_DO, PNT_DI, PNT_AO, PNT_AI };
+	
+	if( argc > 1 ) {
+		points = (unsigned int)strtoul(argv[1],0,0);
+	}
+	if( points > VARSMAX ) {
+		points = VARSMAX;
+	}
+	
+	varBegin();
+	iec61850Begin();
+	
+	for( i=0; i<points; i++ ) {
+		snprintf(name,sizeof(name),"p%u",i);
+		v = make_var(name,strlen(name));
+		if( v == 0 ) {
+			fprintf(stderr,"bench61850: out of variable space at %u\n",i);
+			points = i;
+			break;
+		}
+		v->pnttype = types[i%4];
+		v->pntaddr = i/4;
+	}
+	
+	strcpy(iec61850_serv_name,"BENCH");
+	iec61850_serv_port = argc > 2 ? (uint16_t)strtoul(argv[2],0,0) : 10102;
+	iec61850_serv_threadless = 1;
+	start = benchMs();
+	iec61850Serv();
+	benchReport("build",points,start);
+	
+	start = benchMs();
+	iec61850ServReset();
+	benchReport("destroy",points,start);
+	
+	strcpy(iec61850_serv_name,"BENCH");
+	strcpy(iec61850_icd_path,"bench61850.icd");
+	start = benchMs();
+	iec61850ExportIcd();
+	benchReport("icd",points,start);
+	
+	strcpy(iec61850_scd_path,"bench61850.scd");
+	start = benchMs();
+	iec61850ExportScd();
+	benchReport("scd",points,start);
+	
+	return 0;
+}
@@ -0,0 +1,565 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Micro and macro benchmarks of the simulation core.  Generates models
+//of 100 up to the requested number of variables at several expression
+//depths and prints one machine-readable line per measurement:
+//  benchsim <name> vars=<n> [depth=<d>] [fc=<f>] [impl=<i>] [bytes=<b>] [bytes_per_row=<b>] iters=<i> ns=<per op>
+//  benchsim <name> vars=<n> [depth=<d>] iters=<i> per_sec=<rate>
+//Console and display output are discarded by running headless.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "compat.h"
+#include "var.h"
+#include "expr.h"
+#include "parse.h"
+#include "table.h"
+#include "display.h"
+#include "modbus.h"
+#include "hist.h"
+#include "record.h"
+#include "crc16.h"
+
+#ifdef MODBUSTCP
+#include "modbustcp.h"
+#endif
+
+#define BENCHMS      300     //minimum run time of each measurement
+#define BENCHSAMPLES 1024
+#define BENCHSLOTS   500
+#define BENCHEXPRMAX 512
+
+static const unsigned int sizes[] = { 100, 1000, 10000, 100000 };
+static const unsigned int depths[] = { 1, 4, 16 };
+static const unsigned char types[] = { PNT_DO, PNT_DI, PNT_AO, PNT_AI };
+
+static unsigned int nvars;
+static unsigned int depth;
+static unsigned int samples[BENCHSAMPLES];
+static char sample_names[BENCHSAMPLES][16];
+static unsigned int sample;
+static uint8_t req[16];
+static uint8_t res[1024];
+
+static double benchMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+//Run fn in doubling batches until BENCHMS has passed, returning the
+//average time of one call in ns
+static double benchRun(void (*fn)(), unsigned long* iters) {
+	unsigned long batch = 1;
+	unsigned long i;
+	double start = benchMs();
+	double elapsed;
+	*iters = 0;
+	do {
+		for( i=0; i<batch; i++ ) {
+			fn();
+		}
+		*iters += batch;
+		batch = batch*2;
+		elapsed = benchMs()-start;
+	} while( elapsed < BENCHMS );
+	return elapsed*1000000.0/(*iters);
+}
+
+static void benchReport(char* name, char* extra, unsigned long iters, double ns) {
+	printf("benchsim %s vars=%u%s iters=%lu ns=%.1f\n",name,nvars,extra,iters,ns);
+	fflush(stdout);
+}
+
+static void benchRate(char* name, char* extra, unsigned long iters, double ms) {
+	printf("benchsim %s vars=%u%s iters=%lu per_sec=%.1f\n",name,nvars,extra,iters,iters*1000.0/ms);
+	fflush(stdout);
+}
+
+//Expression of the given depth: nested operators and functions over
+//t, constants and the previous variable
+static unsigned int benchExpr(char* expr, unsigned int i, unsigned int d) {
+	char tmp[BENCHEXPRMAX];
+	unsigned int k;
+	strcpy(expr,"t");
+	for( k=1; k<=d; k++ ) {
+		strcpy(tmp,expr);
+		if( k == 1 && i > 0 ) {
+			snprintf(expr,BENCHEXPRMAX,"(%s+v%u)",tmp,i-1);
+		}
+		else if( k%4 == 0 ) {
+			snprintf(expr,BENCHEXPRMAX,"sin(%s)",tmp);
+		}
+		else if( k%4 == 1 ) {
+			snprintf(expr,BENCHEXPRMAX,"(%s+1.5)",tmp);
+		}
+		else if( k%4 == 2 ) {
+			snprintf(expr,BENCHEXPRMAX,"(%s*2)",tmp);
+		}
+		else {
+			snprintf(expr,BENCHEXPRMAX,"(%s/3)",tmp);
+		}
+	}
+	return strlen(expr);
+}
+
+static int benchModel(unsigned int n, unsigned int d) {
+	char name[16];
+	char expr[BENCHEXPRMAX];
+	unsigned int len;
+	unsigned int i;
+	var_t* v;
+	varBegin();
+	for( i=0; i<n; i++ ) {
+		snprintf(name,sizeof(name),"v%u",i);
+		v = make_var(name,strlen(name));
+		if( v == 0 ) {
+			return -1;
+		}
+		len = benchExpr(expr,i,d);
+		if( ! set_expr(v,expr,len) ) {
+			return -1;
+		}
+		v->pnttype = types[i%4];
+		v->pntaddr = i/4;
+	}
+	//Spread the lookups over the whole table
+	srandom(1);
+	for( i=0; i<BENCHSAMPLES; i++ ) {
+		samples[i] = random()%n;
+		snprintf(sample_names[i],sizeof(sample_names[i]),"v%u",samples[i]);
+	}
+	return 0;
+}
+
+static void benchExprEval() {
+	val_t a;
+	txtpos = vars[samples[sample++%BENCHSAMPLES]].expr;
+	expr_eval(&a);
+}
+
+static void benchTableScan() {
+	char* name = sample_names[sample++%BENCHSAMPLES];
+	table_scan(names,name,strlen(name));
+}
+
+static void benchGetVar() {
+	char* name = sample_names[sample++%BENCHSAMPLES];
+	get_var(name,strlen(name));
+}
+
+static uint8_t crc_msg[256];
+static uint16_t crc_len;
+static uint16_t crc_sum;
+
+static void benchCrcTable() {
+	crc_sum ^= crc16Table(0xFFFF,crc_msg,crc_len);
+}
+
+static void benchCrcSlice8() {
+	crc_sum ^= crc16Slice8(0xFFFF,crc_msg,crc_len);
+}
+
+static void benchCrcClmul() {
+	crc_sum ^= crc16Clmul(0xFFFF,crc_msg,crc_len);
+}
+
+static void benchModbus() {
+	uint16_t res_len;
+	modbusProcessRequest(req,res,&res_len);
+}
+
+static void benchDisplayFull() {
+	displayInvalidate();
+	displayRefresh();
+}
+
+//Change a tenth of the first n values
+static void benchChange(unsigned int n) {
+	unsigned int i;
+	var_t* v;
+	for( i=0; i<n/10; i++ ) {
+		v = &vars[(sample++*7)%n];
+		if( v->value.type == VAL_INT ) {
+			v->value.i++;
+		}
+		else {
+			v->value.f += 1.0;
+		}
+	}
+}
+
+//A tenth of the shown values change between frames
+static void benchDisplayDiff() {
+	benchChange(nvars < BENCHSLOTS ? nvars : BENCHSLOTS);
+	displayRefresh();
+}
+
+//Tick side of the historian with a tenth of the values changing every
+//tick: only recordTick() is timed, and the writer is left to drain after
+//every block so that no rows are dropped
+static void benchRecordTick(char* path) {
+	unsigned long iters = 0;
+	double elapsed = 0;
+	double wall = benchMs();
+	double start;
+	if( ! recordStart(path) ) {
+		return;
+	}
+	do {
+		benchChange(nvars);
+		ticks++;
+		start = benchMs();
+		recordTick();
+		elapsed += benchMs()-start;
+		iters++;
+		while( record_blocks < record_rows/HISTBLOCKTICKS ) {
+			usleep(100);
+		}
+	} while( benchMs()-wall < BENCHMS );
+	recordStop();
+	unlink(path);
+	benchReport("record_tick","",iters,elapsed*1000000.0/iters);
+}
+
+//Writer side: compressing a block of consecutive ticks
+static val_t* histrows;
+static uint8_t* histblock;
+static unsigned int histsize;
+static uint32_t histinc[HISTBLOCKTICKS];
+
+static void benchHistEncode() {
+	histsize = histEncodeBlock(histblock,0,0,histinc,histinc,histrows,nvars,HISTBLOCKTICKS);
+}
+
+static void benchRequest(uint8_t* msg, uint8_t fc, unsigned int addr, unsigned int count) {
+	msg[0] = 1;
+	msg[1] = fc;
+	msg[2] = addr>>8;
+	msg[3] = addr&0xFF;
+	msg[4] = count>>8;
+	msg[5] = count&0xFF;
+}
+
+static uint16_t benchCrc(uint8_t* msg, unsigned int len) {
+	uint16_t crc = 0xFFFF;
+	unsigned int i;
+	unsigned int b;
+	for( i=0; i<len; i++ ) {
+		crc ^= msg[i];
+		for( b=0; b<8; b++ ) {
+			crc = (crc&1) ? (crc>>1)^0xA001 : crc>>1;
+		}
+	}
+	return crc;
+}
+
+static int benchConnect(uint16_t port, int type) {
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET,type,0);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if( fd < 0 || connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 ) {
+		return -1;
+	}
+	return fd;
+}
+
+//Serve requests over the loopback until BENCHMS has passed, one
+//outstanding request at a time.  tcp selects Modbus/TCP, otherwise
+//RTU framing over the serial-over-TCP channel.
+static void benchTransport(char* name, int fd, int tcp) {
+	uint8_t msg[16];
+	unsigned int msglen;
+	unsigned int reslen = tcp ? 9+20 : 5+20;
+	unsigned int got;
+	unsigned long iters = 0;
+	uint16_t crc;
+	ssize_t len;
+	double start;
+	if( tcp ) {
+		memset(msg,0,6);
+		msg[5] = 6;
+		benchRequest(msg+6,4,0,10);
+		msglen = 12;
+	}
+	else {
+		benchRequest(msg,4,0,10);
+		crc = benchCrc(msg,6);
+		msg[6] = crc&0xFF;
+		msg[7] = crc>>8;
+		msglen = 8;
+	}
+	start = benchMs();
+	while( benchMs()-start < BENCHMS ) {
+		if( send(fd,msg,msglen,0) != (ssize_t)msglen ) {
+			break;
+		}
+		got = 0;
+		while( got < reslen && benchMs()-start < BENCHMS*10 ) {
+			#ifdef MODBUSTCP
+			if( tcp ) {
+				modbusTcpProcess();
+			}
+			#endif
+			if( ! tcp ) {
+				modbusProcess();
+			}
+			len = recv(fd,res+got,sizeof(res)-got,MSG_DONTWAIT);
+			if( len > 0 ) {
+				got += len;
+			}
+		}
+		iters++;
+	}
+	benchRate(name,"",iters,benchMs()-start);
+}
+
+#ifdef MODBUSTCP
+//Modbus/UDP with burst requests queued before each pass of the server,
+//the way a replay tool or a polling master with many units drives it
+static void benchUdp(int fd, unsigned int burst) {
+	uint8_t msg[12];
+	char extra[32];
+	unsigned int i;
+	unsigned int got;
+	unsigned long iters = 0;
+	double start;
+	memset(msg,0,6);
+	msg[5] = 6;
+	benchRequest(msg+6,4,0,10);
+	start = benchMs();
+	while( benchMs()-start < BENCHMS ) {
+		for( i=0; i<burst; i++ ) {
+			msg[1] = i;
+			send(fd,msg,sizeof(msg),0);
+		}
+		got = 0;
+		while( got < burst && benchMs()-start < BENCHMS*10 ) {
+			modbusUdpProcess();
+			while( recv(fd,res,sizeof(res),MSG_DONTWAIT) > 0 ) {
+				got++;
+			}
+		}
+		iters += got;
+	}
+	snprintf(extra,sizeof(extra)," burst=%u",burst);
+	benchRate("modbus_udp",extra,iters,benchMs()-start);
+}
+#endif
+
+int main(int argc, char** argv) {
+	unsigned int maxvars = VARSMAX;
+	uint16_t port = 15020;
+	unsigned long iters;
+	double ns;
+	double start;
+	char extra[32];
+	char sock[64];
+	char gfx[64];
+	char hist[64];
+	char portstr[8];
+	char* args[8];
+	unsigned int s;
+	unsigned int d;
+	unsigned int i;
+	unsigned int k;
+	int fd;
+	FILE* fp;
+	static const uint8_t fcs[] = { 1, 2, 3, 4, 5, 6, 23 };
+	
+	if( argc > 1 ) {
+		maxvars = (unsigned int)strtoul(argv[1],0,0);
+	}
+	if( maxvars > VARSMAX ) {
+		maxvars = VARSMAX;
+	}
+	if( argc > 2 ) {
+		port = (uint16_t)strtoul(argv[2],0,0);
+	}
+	
+	//Headless, with the console log thrown away and the SCADA channel
+	//on a local TCP port
+	snprintf(sock,sizeof(sock),"/tmp/benchsim.%d.sock",(int)getpid());
+	snprintf(portstr,sizeof(portstr),"%u",port);
+	args[0] = argv[0];
+	args[1] = "-d";
+	args[2] = sock;
+	args[3] = "-l";
+	args[4] = "/dev/null";
+	args[5] = "-t";
+	args[6] = portstr;
+	args[7] = 0;
+	compatBegin(7,args);
+	displayBegin();
+	modbusBegin();
+	modbus_address = 1;
+	#ifdef MODBUSTCP
+	modbusTcpBegin();
+	#endif
+	
+	for( s=0; s<sizeof(sizes)/sizeof(sizes[0]) && sizes[s] <= maxvars; s++ ) {
+		for( d=0; d<sizeof(depths)/sizeof(depths[0]); d++ ) {
+			nvars = sizes[s];
+			depth = depths[d];
+			snprintf(extra,sizeof(extra)," depth=%u",depth);
+			start = benchMs();
+			if( benchModel(nvars,depth) < 0 ) {
+				fprintf(stderr,"benchsim: out of table space at %u variables\n",nvars);
+				compatExit();
+			}
+			benchRate("load",extra,nvars,benchMs()-start);
+			varTick();
+			
+			ns = benchRun(benchExprEval,&iters);
+			benchReport("expr_eval",extra,iters,ns);
+			
+			//Whole ticks, at least one even for the largest models
+			start = benchMs();
+			iters = 0;
+			do {
+				varTick();
+				iters++;
+			} while( benchMs()-start < BENCHMS );
+			benchRate("ticks",extra,iters,benchMs()-start);
+		}
+		
+		//The remaining measurements do not depend on expression depth
+		ns = benchRun(benchTableScan,&iters);
+		benchReport("table_scan","",iters,ns);
+		ns = benchRun(benchGetVar,&iters);
+		benchReport("get_var","",iters,ns);
+		
+		snprintf(hist,sizeof(hist),"/tmp/benchsim.%d.hist",(int)getpid());
+		benchRecordTick(hist);
+		histrows = malloc((size_t)HISTBLOCKTICKS*nvars*sizeof(val_t));
+		histblock = malloc(histBlockMax(nvars,HISTBLOCKTICKS));
+		for( i=0; i<HISTBLOCKTICKS; i++ ) {
+			benchChange(nvars);
+			for( k=0; k<nvars; k++ ) {
+				histrows[(size_t)i*nvars+k] = vars[k].value;
+			}
+			histinc[i] = 1;
+		}
+		ns = benchRun(benchHistEncode,&iters);
+		snprintf(extra,sizeof(extra)," bytes_per_row=%.1f",(double)histsize/HISTBLOCKTICKS);
+		benchReport("hist_encode_row",extra,iters*HISTBLOCKTICKS,ns/HISTBLOCKTICKS);
+		free(histrows);
+		free(histblock);
+		
+		//Single requests are timed without the response cache
+		modbus_cache = 0;
+		for( i=0; i<sizeof(fcs); i++ ) {
+			benchRequest(req,fcs[i],nvars/8,fcs[i] == 5 ? 0xFF00 : fcs[i] == 6 ? 1 : 10);
+			if( fcs[i] == 23 ) {
+				//Write the first register, read all ten
+				memcpy(req+6,req+2,2);
+				memcpy(req+8,"\x00\x01\x02\x00\x01",5);
+			}
+			ns = benchRun(benchModbus,&iters);
+			snprintf(extra,sizeof(extra)," fc=%u",fcs[i]);
+			benchReport("modbus",extra,iters,ns);
+		}
+		
+		//A block polled again and again within a tick, without and with
+		//the response cache
+		k = nvars/4 < 100 ? nvars/4 : 100;
+		benchRequest(req,3,0,k);
+		for( i=0; i<2; i++ ) {
+			modbus_cache = i;
+			ns = benchRun(benchModbus,&iters);
+			snprintf(extra,sizeof(extra)," count=%u cache=%s",k,i ? "on" : "off");
+			benchReport("modbus_block",extra,iters,ns);
+		}
+		
+		snprintf(gfx,sizeof(gfx),"/tmp/benchsim.%d.gfx",(int)getpid());
+		fp = fopen(gfx,"w");
+		for( i=0; i<BENCHSLOTS && i<nvars; i++ ) {
+			fprintf(fp,"v%u:          %s",i,(i%5) == 4 ? "\n" : " ");
+		}
+		fclose(fp);
+		displayLoad(gfx);
+		unlink(gfx);
+		displayRun();
+		ns = benchRun(benchDisplayFull,&iters);
+		benchReport("display_full","",iters,ns);
+		ns = benchRun(benchDisplayDiff,&iters);
+		benchReport("display_diff","",iters,ns);
+		displayStop();
+	}
+	
+	//CRC16 variants over typical RTU frame sizes
+	for( i=0; i<sizeof(crc_msg); i++ ) {
+		crc_msg[i] = random();
+	}
+	crc16(crc_msg,0);
+	for( crc_len=8; crc_len<=256; crc_len=crc_len*4 ) {
+		snprintf(extra,sizeof(extra)," impl=table bytes=%u",crc_len);
+		ns = benchRun(benchCrcTable,&iters);
+		benchReport("crc16",extra,iters,ns);
+		snprintf(extra,sizeof(extra)," impl=slice8 bytes=%u",crc_len);
+		ns = benchRun(benchCrcSlice8,&iters);
+		benchReport("crc16",extra,iters,ns);
+		if( crc16ClmulSupported() ) {
+			snprintf(extra,sizeof(extra)," impl=clmul bytes=%u",crc_len);
+			ns = benchRun(benchCrcClmul,&iters);
+			benchReport("crc16",extra,iters,ns);
+		}
+	}
+	
+	//End to end request rates over the loopback on the last model
+	fd = benchConnect(port,SOCK_STREAM);
+	if( fd >= 0 ) {
+		benchTransport("modbus_rtu",fd,0);
+		close(fd);
+	}
+	#ifdef MODBUSTCP
+	modbustcp_port = port+1;
+	if( modbusTcpServ() == 0 && (fd = benchConnect(port+1,SOCK_STREAM)) >= 0 ) {
+		benchTransport("modbus_tcp",fd,1);
+		close(fd);
+	}
+	modbusudp_port = port+2;
+	if( modbusUdpServ() == 0 && (fd = benchConnect(port+2,SOCK_DGRAM)) >= 0 ) {
+		benchUdp(fd,1);
+		benchUdp(fd,32);
+		close(fd);
+	}
+	#endif
+	
+	compatExit();
+	return 0;
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __CDC_C__
+#include "cdc.h"
+#include "var.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LINUX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#endif //LINUX
+
+#define CDCLINEMAX 256
+#define CDCIOVMAX  16
+
+//Every client has a ring of queued frames.  The tick only appends to it;
+//the main loop writes it out without blocking.  When a client falls
+//behind the oldest frames that have not started going out are dropped,
+//and its next frame resends every matched value so nothing stays stale.
+
+char cdc_addr[256];
+unsigned int cdc_clients;
+unsigned long cdc_frames;
+unsigned long cdc_dropped;
+
+#ifdef LINUX
+typedef struct {
+	int fd;
+	uint8_t json;
+	uint8_t rematch;
+	uint8_t snapshot;
+	char patterns[CDCPATTERNSMAX];  //NUL separated
+	unsigned int patlen;
+	char line[CDCLINEMAX];
+	unsigned int linelen;
+	uint8_t* match;                 //per variable
+	char* frames[CDCFRAMESMAX];
+	unsigned int flen[CDCFRAMESMAX];
+	unsigned int first;
+	unsigned int count;
+	unsigned int sent;              //bytes of the first frame written
+	unsigned long queued;
+	unsigned long dropped;          //frames lost since connecting
+} cdcclient_t;
+
+static int cdcfd = -1;
+static char* cdcpath;
+static cdcclient_t clients[CDCCLIENTSMAX];
+static val_t last[VARSMAX];
+static unsigned int changed[VARSMAX];
+static unsigned int cdcversion;
+static char* frame;
+static unsigned int framemax;
+static unsigned int framelen;
+
+static void cdcClose(cdcclient_t* c) {
+	close(c->fd);
+	c->fd = -1;
+	while( c->count ) {
+		free(c->frames[c->first]);
+		c->first = (c->first+1)%CDCFRAMESMAX;
+		c->count--;
+	}
+	free(c->match);
+	c->match = 0;
+	cdc_clients--;
+}
+
+static int cdcGlob(const char* pat, const char* name) {
+	char p;
+	char n;
+	while( *pat ) {
+		if( *pat == '*' ) {
+			while( *pat == '*' ) {
+				pat++;
+			}
+			if( *pat == 0 ) {
+				return 1;
+			}
+			for( ; *name; name++ ) {
+				if( cdcGlob(pat,name) ) {
+					return 1;
+				}
+			}
+			return 0;
+		}
+		if( *name == 0 ) {
+			return 0;
+		}
+		p = *pat >= 'A' && *pat <= 'Z' ? *pat+32 : *pat;
+		n = *name >= 'A' && *name <= 'Z' ? *name+32 : *name;
+		if( p != '?' && p != n ) {
+			return 0;
+		}
+		pat++;
+		name++;
+	}
+	return *name == 0;
+}
+
+static void cdcMatch(cdcclient_t* c) {
+	char name[256];
+	char* pat;
+	unsigned int i;
+	unsigned int k;
+	for( i=0; i<VARSMAX && vars[i].value.type != VAL_NONE; i++ ) {
+		for( k=0; k < sizeof(name)-1 && (vars[i].name[k]&0x80) == 0; k++ ) {
+			name[k] = vars[i].name[k];
+		}
+		name[k] = vars[i].name[k]&0x7F;
+		name[k+1] = 0;
+		c->match[i] = 0;
+		for( pat=c->patterns; pat < c->patterns+c->patlen; pat += strlen(pat)+1 ) {
+			if( cdcGlob(pat,name) ) {
+				c->match[i] = 1;
+				break;
+			}
+		}
+	}
+	c->rematch = 0;
+}
+
+static int framePut(const void* src, unsigned int len) {
+	char* grown;
+	if( framelen+len > framemax ) {
+		grown = realloc(frame,framemax*2+len);
+		if( grown == 0 ) {
+			return 0;
+		}
+		frame = grown;
+		framemax = framemax*2+len;
+	}
+	memcpy(frame+framelen,src,len);
+	framelen += len;
+	return 1;
+}
+
+static void putLE(uint8_t* p, uint64_t v, unsigned int n) {
+	unsigned int i;
+	for( i=0; i<n; i++ ) {
+		p[i] = (uint8_t)(v>>(8*i));
+	}
+}
+
+static void frameEntry(cdcclient_t* c, var_t* v, unsigned int nth) {
+	char buf[320];
+	uint8_t* p = (uint8_t*)buf;
+	unsigned int n;
+	uint32_t bits;
+	int len;
+	for( n=0; (v->name[n]&0x80) == 0 && n < 254; n++ );
+	n++;
+	if( c->json ) {
+		len = snprintf(buf,sizeof(buf),"%s\"%.*s%c\":",nth ? "," : "",n-1,v->name,v->name[n-1]&0x7F);
+		if( IS_INT(v->value) ) {
+			len += snprintf(buf+len,sizeof(buf)-len,"%d",v->value.i);
+		}
+		else if( v->value.f == v->value.f && v->value.f-v->value.f == 0 ) {
+			len += snprintf(buf+len,sizeof(buf)-len,"%.9g",v->value.f);
+		}
+		else {
+			len += snprintf(buf+len,sizeof(buf)-len,"null");
+		}
+		framePut(buf,len);
+		return;
+	}
+	p[0] = (uint8_t)n;
+	memcpy(p+1,v->name,n);
+	p[n] &= 0x7F;
+	p[n+1] = v->value.type;
+	memcpy(&bits,&v->value.f,4);
+	putLE(p+n+2,IS_INT(v->value) ? (uint32_t)v->value.i : bits,4);
+	framePut(buf,n+6);
+}
+
+static void cdcDrop(cdcclient_t* c) {
+	c->dropped++;
+	c->snapshot = 1;
+	cdc_dropped++;
+}
+
+static void cdcPush(cdcclient_t* c) {
+	unsigned int victim;
+	char* copy;
+	if( framelen > CDCQUEUEMAX ) {
+		cdcDrop(c);
+		return;
+	}
+	while( c->count == CDCFRAMESMAX || c->queued+framelen > CDCQUEUEMAX ) {
+		//A frame that is partly written has to go out whole
+		if( c->sent && c->count == 1 ) {
+			cdcDrop(c);
+			return;
+		}
+		victim = c->sent ? (c->first+1)%CDCFRAMESMAX : c->first;
+		free(c->frames[victim]);
+		c->queued -= c->flen[victim];
+		if( c->sent ) {
+			c->frames[victim] = c->frames[c->first];
+			c->flen[victim] = c->flen[c->first];
+		}
+		c->first = (c->first+1)%CDCFRAMESMAX;
+		c->count--;
+		cdcDrop(c);
+	}
+	copy = malloc(framelen);
+	if( copy == 0 ) {
+		cdcDrop(c);
+		return;
+	}
+	memcpy(copy,frame,framelen);
+	victim = (c->first+c->count)%CDCFRAMESMAX;
+	c->frames[victim] = copy;
+	c->flen[victim] = framelen;
+	c->count++;
+	c->queued += framelen;
+}
+
+static void cdcFrame(cdcclient_t* c, unsigned int nchanged, uint64_t now) {
+	uint8_t head[24];
+	char json[128];
+	unsigned int n = 0;
+	unsigned int i;
+	unsigned int idx;
+	unsigned int total = c->snapshot ? VARSMAX : nchanged;
+	framelen = 0;
+	if( c->json ) {
+		framePut(json,snprintf(json,sizeof(json),"{\"tick\":%u,\"time\":%llu,\"dropped\":%lu,\"values\":{",
+			ticks,(unsigned long long)now,c->dropped));
+	}
+	else {
+		framePut(head,sizeof(head));
+	}
+	for( i=0; i<total; i++ ) {
+		idx = c->snapshot ? i : changed[i];
+		if( vars[idx].value.type == VAL_NONE ) {
+			break;
+		}
+		if( c->match[idx] ) {
+			frameEntry(c,&vars[idx],n++);
+		}
+	}
+	c->snapshot = 0;
+	if( n == 0 ) {
+		return;
+	}
+	if( c->json ) {
+		framePut("}}\n",3);
+	}
+	else {
+		putLE((uint8_t*)frame,framelen,4);
+		putLE((uint8_t*)frame+4,ticks,4);
+		putLE((uint8_t*)frame+8,now,8);
+		putLE((uint8_t*)frame+16,n,4);
+		putLE((uint8_t*)frame+20,c->dropped,4);
+	}
+	cdcPush(c);
+}
+
+static void cdcCommand(cdcclient_t* c) {
+	char* arg = c->line;
+	while( *arg == ' ' || *arg == '\t' ) {
+		arg++;
+	}
+	if( strncmp(arg,"sub ",4) == 0 ) {
+		arg += 4;
+		while( *arg == ' ' || *arg == '\t' ) {
+			arg++;
+		}
+		if( *arg && c->patlen+strlen(arg)+1 <= CDCPATTERNSMAX ) {
+			strcpy(c->patterns+c->patlen,arg);
+			c->patlen += strlen(arg)+1;
+			c->rematch = 1;
+			c->snapshot = 1;
+		}
+	}
+	else if( strcmp(arg,"unsub") == 0 ) {
+		c->patlen = 0;
+		c->rematch = 1;
+	}
+	else if( strcmp(arg,"json") == 0 ) {
+		c->json = 1;
+	}
+	else if( strcmp(arg,"binary") == 0 ) {
+		c->json = 0;
+	}
+}
+
+static void cdcRead(cdcclient_t* c) {
+	char buf[CDCLINEMAX];
+	ssize_t len;
+	ssize_t i;
+	len = recv(c->fd,buf,sizeof(buf),0);
+	if( len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ) {
+		cdcClose(c);
+		return;
+	}
+	for( i=0; i<len; i++ ) {
+		if( buf[i] == '\n' || buf[i] == '\r' ) {
+			c->line[c->linelen] = 0;
+			cdcCommand(c);
+			c->linelen = 0;
+		}
+		else if( c->linelen < CDCLINEMAX-1 ) {
+			c->line[c->linelen++] = buf[i];
+		}
+	}
+}
+
+static void cdcWrite(cdcclient_t* c) {
+	struct iovec iov[CDCIOVMAX];
+	struct msghdr msg;
+	unsigned int n;
+	unsigned int k;
+	ssize_t len;
+	while( c->count ) {
+		for( n=0; n<c->count && n<CDCIOVMAX; n++ ) {
+			k = (c->first+n)%CDCFRAMESMAX;
+			iov[n].iov_base = c->frames[k]+(n ? 0 : c->sent);
+			iov[n].iov_len = c->flen[k]-(n ? 0 : c->sent);
+		}
+		memset(&msg,0,sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		len = sendmsg(c->fd,&msg,MSG_DONTWAIT|MSG_NOSIGNAL);
+		if( len < 0 ) {
+			if( errno != EAGAIN && errno != EWOULDBLOCK ) {
+				cdcClose(c);
+			}
+			return;
+		}
+		while( len > 0 ) {
+			k = c->first;
+			if( (size_t)len < c->flen[k]-c->sent ) {
+				c->sent += len;
+				return;
+			}
+			len -= c->flen[k]-c->sent;
+			c->queued -= c->flen[k];
+			free(c->frames[k]);
+			c->first = (c->first+1)%CDCFRAMESMAX;
+			c->count--;
+			c->sent = 0;
+			cdc_frames++;
+		}
+	}
+}
+#endif //LINUX
+
+void cdcReset() {
+	#ifdef LINUX
+	struct stat st;
+	unsigned int i;
+	for( i=0; i<CDCCLIENTSMAX; i++ ) {
+		if( clients[i].fd > 0 ) {
+			cdcClose(&clients[i]);
+		}
+		clients[i].fd = -1;
+	}
+	if( cdcfd != -1 ) {
+		close(cdcfd);
+		cdcfd = -1;
+	}
+	if( cdcpath ) {
+		if( lstat(cdcpath,&st) == 0 && S_ISSOCK(st.st_mode) ) {
+			unlink(cdcpath);
+		}
+		cdcpath = 0;
+	}
+	#endif //LINUX
+	cdc_addr[0] = 0;
+	cdc_clients = 0;
+	cdc_frames = 0;
+	cdc_dropped = 0;
+}
+
+//cdc_addr holds a TCP port number or a Unix socket path
+int cdcServ() {
+	#ifdef LINUX
+	struct sockaddr_in in;
+	struct sockaddr_un un;
+	struct stat st;
+	char* end;
+	unsigned long port = strtoul(cdc_addr,&end,10);
+	unsigned int i;
+	int on = 1;
+	for( i=0; i<CDCCLIENTSMAX; i++ ) {
+		clients[i].fd = -1;
+	}
+	if( *end == 0 && port > 0 && port <= 0xFFFF ) {
+		cdcfd = socket(AF_INET,SOCK_STREAM,0);
+		if( cdcfd < 0 ) {
+			return -1;
+		}
+		setsockopt(cdcfd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+		memset(&in,0,sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_addr.s_addr = INADDR_ANY;
+		in.sin_port = htons((uint16_t)port);
+		if( bind(cdcfd,(struct sockaddr*)&in,sizeof(in)) < 0 ) {
+			close(cdcfd);
+			cdcfd = -1;
+			return -1;
+		}
+	}
+	else {
+		if( strlen(cdc_addr) >= sizeof(un.sun_path) ) {
+			return -1;
+		}
+		//Only a stale socket from an earlier run may be replaced
+		if( lstat(cdc_addr,&st) == 0 && (! S_ISSOCK(st.st_mode) || unlink(cdc_addr) != 0) ) {
+			return -1;
+		}
+		cdcfd = socket(AF_UNIX,SOCK_STREAM,0);
+		if( cdcfd < 0 ) {
+			return -1;
+		}
+		memset(&un,0,sizeof(un));
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path,cdc_addr);
+		if( bind(cdcfd,(struct sockaddr*)&un,sizeof(un)) < 0 ) {
+			close(cdcfd);
+			cdcfd = -1;
+			return -1;
+		}
+		cdcpath = cdc_addr;
+	}
+	if( listen(cdcfd,CDCCLIENTSMAX) < 0 ) {
+		cdcReset();
+		return -1;
+	}
+	fcntl(cdcfd,F_SETFL,O_NONBLOCK);
+	cdcversion = varsVersion-1;
+	return 0;
+	#else
+	return -1;
+	#endif //LINUX
+}
+
+//Queue this tick's changes for every client
+void cdcTick() {
+	#ifdef LINUX
+	struct timeval tv;
+	uint64_t now;
+	unsigned int nchanged = 0;
+	unsigned int i;
+	uint8_t moved;
+	if( cdc_clients == 0 ) {
+		return;
+	}
+	moved = cdcversion != varsVersion;
+	for( i=0; i<VARSMAX && vars[i].value.type != VAL_NONE; i++ ) {
+		if( moved || vars[i].value.type != last[i].type || vars[i].value.i != last[i].i ) {
+			last[i] = vars[i].value;
+			changed[nchanged++] = i;
+		}
+	}
+	cdcversion = varsVersion;
+	if( nchanged == 0 ) {
+		for( i=0; i<CDCCLIENTSMAX && ! (clients[i].fd != -1 && clients[i].snapshot); i++ );
+		if( i == CDCCLIENTSMAX ) {
+			return;
+		}
+	}
+	gettimeofday(&tv,0);
+	now = (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+	for( i=0; i<CDCCLIENTSMAX; i++ ) {
+		if( clients[i].fd == -1 ) {
+			continue;
+		}
+		if( moved || clients[i].rematch ) {
+			cdcMatch(&clients[i]);
+		}
+		cdcFrame(&clients[i],nchanged,now);
+	}
+	#endif //LINUX
+}
+
+void cdcProcess() {
+	#ifdef LINUX
+	cdcclient_t* c;
+	unsigned int i;
+	int fd;
+	if( cdcfd == -1 ) {
+		return;
+	}
+	while( (fd = accept(cdcfd,0,0)) >= 0 ) {
+		for( i=0; i<CDCCLIENTSMAX && clients[i].fd != -1; i++ );
+		if( i == CDCCLIENTSMAX ) {
+			close(fd);
+			continue;
+		}
+		c = &clients[i];
+		memset(c,0,sizeof(cdcclient_t));
+		c->match = calloc(VARSMAX,1);
+		if( c->match == 0 ) {
+			close(fd);
+			c->fd = -1;
+			continue;
+		}
+		fcntl(fd,F_SETFL,O_NONBLOCK);
+		c->fd = fd;
+		cdc_clients++;
+	}
+	for( i=0; i<CDCCLIENTSMAX; i++ ) {
+		c = &clients[i];
+		if( c->fd != -1 ) {
+			cdcRead(c);
+		}
+		if( c->fd != -1 && c->count ) {
+			cdcWrite(c);
+		}
+	}
+	#endif //LINUX
+}
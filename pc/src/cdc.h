@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CDC_H__
+#define __CDC_H__
+
+#include <stdint.h>
+
+//Change data capture: clients of the cdc socket send text lines
+//  sub pattern   add a name pattern (* and ? wildcards)
+//  unsub         drop all patterns
+//  json|binary   choose the frame format (binary by default)
+//and get one frame per tick holding the subscribed variables that
+//changed during it (all of them after a sub, and after frames were
+//dropped for a slow client).  Binary frames are little endian:
+//  uint32_t length     whole frame
+//  uint32_t tick
+//  uint64_t time       ms since the epoch
+//  uint32_t count
+//  uint32_t dropped    frames this client lost since connecting
+//  count times: uint8_t namelen, name, uint8_t type (1 float, 2 int),
+//               4 byte value
+//JSON frames are one line each:
+//  {"tick":12,"time":1700000000000,"dropped":0,"values":{"flow":12.5,"pump":1}}
+
+#define CDCCLIENTSMAX  8
+#define CDCFRAMESMAX   256        //frames queued per client
+#define CDCQUEUEMAX    (1<<20)    //bytes queued per client
+#define CDCPATTERNSMAX 512
+
+#ifndef __CDC_C__
+extern char cdc_addr[256];        //TCP port or Unix socket path
+extern unsigned int cdc_clients;
+extern unsigned long cdc_frames;
+extern unsigned long cdc_dropped;
+#endif //__CDC_C__
+
+int cdcServ();
+void cdcReset();
+void cdcTick();
+void cdcProcess();
+
+#endif //__CDC_H__
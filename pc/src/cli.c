@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cli.h"
@@ -32,17 +33,27 @@
 #include "table.h"
 #include "compat.h"
 #include "display.h"
+#include "prof.h"
+#include "record.h"
+#include "play.h"
+#include "cdc.h"
+#include "metrics.h"
 
 #ifdef MODBUS
 #include "modbus.h"
 #endif 
 
+#if defined(MODBUS) && defined(LINUX)
+#include "rtu.h"
+#endif
+
 #ifdef MODBUSTCP
 #include "modbustcp.h"
 #endif
 
 #ifdef IEC61850
 #include "iec61850.h"
+#include "iec61850sv.h"
 #endif
 
 static char line[LINEMAX];
@@ -52,8 +63,15 @@ static char output[LINEMAX];
 static unsigned int outlen;
 
 #ifndef ARDUINO
-static FILE* loadfp = 0;
 static FILE* savefp = 0;
+//Set while writing to savefp/savebuf without echoing to the console
+static char quiet = 0;
+static char* savebuf = 0;
+static unsigned int savebuflen;
+static unsigned int savebufmax;
+//Scripts are not read through cli_readline(); the path is held here
+//until the command loop loads the whole file in one pass
+static char loadpath[256];
 #endif
 
 #define append_printf(...) outlen = outlen + snprintf(output+outlen,LINEMAX-outlen,__VA_ARGS__)
@@ -82,6 +100,13 @@ void append_val(val_t v) {
 		append_printf("?");
 }
 
+static const char* pntenc_names[] = {
+	"","int32 ","uint32 ","float32 ","int64 ","float64 "
+};
+static const char* pntorder_names[] = {
+	""," cdab"," badc"," dcba"
+};
+
 void  append_varline(const var_t* var) {
 	if( var == 0 || var->name == 0 )
 		return;
@@ -99,13 +124,17 @@ void  append_varline(const var_t* var) {
 		else if( var->pnttype == PNT_DI )
 			append_printf(" :di %d",var->pntaddr);
 		else if( var->pnttype == PNT_AO )
-			append_printf(" :ao %d",var->pntaddr);
+			append_printf(" :ao %s%d%s",pntenc_names[var->pntenc&PNTENC_TYPE],var->pntaddr,
+				pntorder_names[var->pntenc>>4]);
 		else if( var->pnttype == PNT_AO_SCALED )
 			append_printf(" :ao scaled %d %f %f",var->pntaddr,var->pntmin,var->pntmax);
 		else if( var->pnttype == PNT_AI )
-			append_printf(" :ai %d",var->pntaddr);
+			append_printf(" :ai %s%d%s",pntenc_names[var->pntenc&PNTENC_TYPE],var->pntaddr,
+				pntorder_names[var->pntenc>>4]);
 		else if( var->pnttype == PNT_AI_SCALED )
 			append_printf(" :ai scaled %d %f %f",var->pntaddr,var->pntmin,var->pntmax);
+		if( var->pntunit )
+			append_printf(" unit %d",var->pntunit);
 	}
 	append_printf("\n");
 }
@@ -118,29 +147,20 @@ void cli_init() {
 char* cli_readline() {
 	int c;
 	while( linelen < LINEMAX ) {
-#ifndef ARDUINO
-		if( loadfp ) {
-			c = 0;
-			if( ! fread(&c,1,1,loadfp) ) {
-				fclose(loadfp);
-				loadfp = 0;
-				c = -1;
-			}
-		}
-		else
-#endif 
 		c = consoleIn();
 		if( c < 0 ) {
+			consoleFlush();
 			return 0;
 		}
+		displayInvalidate();
 		if( c == 0x7F || c == 0x08 ) {
-			consoleOut((char)c);
+			consoleEcho((char)c);
 			if( linelen ) {
 				linelen--;
 			}
 		} else if( c == '\n' || c == '\r' ) {
 			if( linelen ) {
-				consoleOut((char)c);
+				consoleEcho((char)c);
 				line[linelen] = 0;
 				do {
 					linelen--;
@@ -148,14 +168,16 @@ char* cli_readline() {
 						line[linelen] = 0;
 					}
 				} while( linelen > 0 );
+				consoleFlush();
 				return line;
 			}
 		} else {
-			consoleOut((char)c);
+			consoleEcho((char)c);
 			line[linelen++] = (char)c;
 		}
 	}
 	linelen = 0;
+	consoleFlush();
 	return 0;
 }
 
@@ -165,16 +187,29 @@ void cli_printline() {
 	if( savefp ) {
 		fwrite(output,1,outlen,savefp);
 	}
+	if( savebuf && savebuflen+outlen < savebufmax ) {
+		memcpy(savebuf+savebuflen,output,outlen);
+		savebuflen += outlen;
+		savebuf[savebuflen] = 0;
+	}
+	if( quiet ) {
+		outlen = 0;
+		return;
+	}
 	#endif
 	while( *c ) {
 		consoleOut(*c);
 		c++;
 	}
+	consoleFlush();
 	outlen = 0;
+	//Console output may land on top of the display
+	displayInvalidate();
 }
 
 void cli_print_prompt() {
 	consoleOut('>');
+	consoleFlush();
 }
 
 void cli_print_interp_error(int error) {
@@ -211,17 +246,87 @@ void cli_print_list() {
 		cli_printline();
 		v++;
 	}
+	cli_print_config();
+}
+
+#ifdef MODBUS
+static const char* modbusid_names[MODBUSIDOBJS] = {
+	"vendor","product","revision","url","name","model","app"
+};
+
+void cli_print_modbusid() {
+	uint8_t id;
+	for( id=0; id<MODBUSIDOBJS; id++ ) {
+		append_printf("modbusid %s %s\n",modbusid_names[id],modbusDevId(id));
+		cli_printline();
+	}
+}
+
+void cli_print_cache() {
+	append_printf("cache %s hits:%llu misses:%llu\n",modbus_cache ? "on" : "off",
+		metrics_modbus_cache_hits,metrics_modbus_cache_misses);
+	cli_printline();
+}
+#endif
+
+#ifndef ARDUINO
+//Release setting followed by the variables currently overridden
+void cli_print_override() {
+	var_t* v;
+	if( override_ms == OVERRIDE_HOLD ) {
+		append_printf("override hold\n");
+	}
+	else if( override_ms == 0 ) {
+		append_printf("override tick\n");
+	}
+	else {
+		append_printf("override %u\n",override_ms);
+	}
+	cli_printline();
+	for( v=vars; v<vars+VARSMAX && v->value.type != VAL_NONE; v++ ) {
+		if( v->override ) {
+			append_table_entry(v->name);
+			append_printf(":");
+			append_val(v->value);
+			append_printf("\n");
+			cli_printline();
+		}
+	}
+}
+#endif
+
+//Protocol and display settings, as the commands that set them
+void cli_print_config() {
 	#ifdef MODBUS
-		append_printf("modbus %d\n",modbus_address);
+		append_printf("modbus %d",modbus_address);
+		if( scada_baud != 9600 || scada_parity != 'N' || scada_stopbits != 1 || scada_rs485 ) {
+			append_printf(" %lu 8%c%u%s",scada_baud,scada_parity,scada_stopbits,scada_rs485 ? " rs485" : "");
+		}
+		append_printf("\n");
+		if( ! modbus_cache ) {
+			append_printf("cache off\n");
+		}
+	#endif
+	#ifndef ARDUINO
+		if( override_ms == 0 ) {
+			append_printf("override tick\n");
+		}
+		else if( override_ms != OVERRIDE_HOLD ) {
+			append_printf("override %u\n",override_ms);
+		}
 	#endif
 	#ifdef MODBUSTCP
 		if( modbustcp_port != 0 ) {
 			append_printf("modbustcp %d\n",modbustcp_port);
 		}
+		if( modbusudp_port != 0 ) {
+			append_printf("modbusudp %d%s\n",modbusudp_port,modbusudp_shared ? " shared" : "");
+		}
 	#endif
 	#ifdef IEC61850
 		if( iec61850_serv_name[0] ) {
-			append_printf("iec61850 %s %d\n",iec61850_serv_name,iec61850_serv_port);
+			append_printf("iec61850 %s %d %d%s\n",iec61850_serv_name,iec61850_serv_port,
+				iec61850_serv_maxconn,iec61850_serv_threadless ? " threadless" : "");
 		}
 		if( iec61850_goose_digital_eth[0] ) {
 			append_printf("gsed %s %d %02x:%02x:%02x:%02x:%02x:%02x\n",iec61850_goose_digital_eth,iec61850_goose_digital_appid,
@@ -235,9 +340,72 @@ void cli_print_list() {
 		}
 		if( iec61850_icd_path[0] ) {
 			append_printf("icd %s\n",iec61850_icd_path);
-		}			
+		}
+		if( iec61850_sv_eth[0] ) {
+			char* entry;
+			unsigned int i;
+			append_printf("sv %s %d %02x:%02x:%02x:%02x:%02x:%02x %s %d",iec61850_sv_eth,iec61850_sv_appid,
+				iec61850_sv_dst[0]&0xFF,iec61850_sv_dst[1]&0xFF,iec61850_sv_dst[2]&0xFF,
+				iec61850_sv_dst[3]&0xFF,iec61850_sv_dst[4]&0xFF,iec61850_sv_dst[5]&0xFF,
+				iec61850_sv_id,iec61850_sv_rate);
+			for( i=0; (entry = iec61850SvBinding(i)) != 0; i++ ) {
+				append_printf(" ");
+				append_table_entry(entry);
+			}
+			append_printf("\n");
+		}
 	#endif
 	cli_printline();
+	#ifdef MODBUS
+	{
+		uint8_t id;
+		for( id=0; id<MODBUSIDOBJS; id++ ) {
+			if( modbus_devid[id][0] ) {
+				append_printf("modbusid %s %s\n",modbusid_names[id],modbus_devid[id]);
+				cli_printline();
+			}
+		}
+	}
+	#endif
+	#if defined(MODBUS) && defined(LINUX)
+	{
+		unsigned int i;
+		rtu_t* r;
+		for( i=0; i<rtu_count; i++ ) {
+			r = &rtu_ports[i];
+			append_printf("rtu %s%s %u %lu 8%c%u%s",r->pty ? "pty " : "",r->path,r->port.address,
+				r->port.baud,r->parity,r->stopbits,r->rs485 ? " rs485" : "");
+			if( r->port.count ) {
+				append_printf(" points %u-%u",r->port.base,r->port.base+r->port.count-1);
+			}
+			append_printf("\n");
+			cli_printline();
+		}
+	}
+	#endif
+	#ifndef ARDUINO
+	if( play_path[0] ) {
+		char* entry;
+		char* col;
+		unsigned int i;
+		append_printf("play %s%s%s%s",play_path,play_linear ? " linear" : "",
+			play_loop ? " loop" : "",play_time ? " time" : "");
+		for( i=0; (entry = playBinding(i,&col)) != 0; i++ ) {
+			append_printf(" ");
+			append_table_entry(entry);
+			if( col ) {
+				append_printf("=");
+				append_table_entry(col);
+			}
+		}
+		append_printf("\n");
+		cli_printline();
+	}
+	if( cdc_addr[0] ) {
+		append_printf("cdc %s\n",cdc_addr);
+		cli_printline();
+	}
+	#endif //ARDUINO
 	if( strlen(gfxpath) ) {
 		append_printf("gfx %s\n",gfxpath);
 		cli_printline();
@@ -266,6 +434,140 @@ void cli_print_val(val_t v) {
 	cli_printline();
 }
 
+#ifndef ARDUINO
+static const char* prof_section_names[PROFSECTIONS] = {
+	"tick","display","console","modbus","modbustcp","iec61850"
+};
+
+static int cli_cmp_u32(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+void cli_print_prof(unsigned int top) {
+	static uint32_t sorted[PROFTICKS];
+	static uint8_t shown[VARSMAX];
+	unsigned long long elapsed;
+	unsigned int n;
+	unsigned int i;
+	unsigned int j;
+	int best;
+	int len;
+	
+	if( ! prof_enabled ) {
+		append_printf("profiling off\n");
+		cli_printline();
+		return;
+	}
+	elapsed = compatNanos()-prof_start;
+	if( elapsed == 0 ) {
+		elapsed = 1;
+	}
+	append_printf("%0.1f s, %0.0f loops/s, %0.1f ticks/s\n",elapsed/1e9,
+		prof_loops*1e9/elapsed,prof_section_calls[PROF_TICK]*1e9/elapsed);
+	cli_printline();
+	
+	n = prof_nticks < PROFTICKS ? prof_nticks : PROFTICKS;
+	if( n ) {
+		memcpy(sorted,prof_ticks,n*sizeof(sorted[0]));
+		qsort(sorted,n,sizeof(sorted[0]),cli_cmp_u32);
+		append_printf("tick us p50:%lu p90:%lu p99:%lu max:%lu (last %u)\n",
+			(unsigned long)sorted[n/2],(unsigned long)sorted[n*9/10],
+			(unsigned long)sorted[n*99/100],(unsigned long)sorted[n-1],n);
+		cli_printline();
+	}
+	
+	append_printf("%-10s %10s %10s %9s %9s\n","section","calls","ms","avg us","max us");
+	cli_printline();
+	for( i=0; i<PROFSECTIONS; i++ ) {
+		if( prof_section_calls[i] == 0 ) {
+			continue;
+		}
+		append_printf("%-10s %10lu %10.1f %9.2f %9.1f\n",prof_section_names[i],prof_section_calls[i],
+			prof_section_ns[i]/1e6,prof_section_ns[i]/1e3/prof_section_calls[i],prof_section_max[i]/1e3);
+		cli_printline();
+	}
+	
+	append_printf("%-20s %10s %10s %9s\n","variable","calls","ms","avg us");
+	cli_printline();
+	memset(shown,0,sizeof(shown));
+	for( i=0; i<top; i++ ) {
+		best = -1;
+		for( j=0; j<VARSMAX && vars[j].value.type != VAL_NONE; j++ ) {
+			if( ! shown[j] && prof_var_calls[j] && (best < 0 || prof_var_ns[j] > prof_var_ns[best]) ) {
+				best = j;
+			}
+		}
+		if( best < 0 ) {
+			break;
+		}
+		shown[best] = 1;
+		len = append_table_entry(vars[best].name);
+		append_printf("%*s %10lu %10.1f %9.2f\n",len < 20 ? 20-len : 0,"",prof_var_calls[best],
+			prof_var_ns[best]/1e6,prof_var_ns[best]/1e3/prof_var_calls[best]);
+		cli_printline();
+	}
+}
+
+void cli_print_record() {
+	if( ! record_active ) {
+		append_printf("recording off\n");
+		cli_printline();
+		return;
+	}
+	append_printf("%s vars:%u rows:%lu blocks:%lu bytes:%llu (%0.1f/row) dropped:%lu%s\n",
+		record_path,record_nvars,record_rows,record_blocks,record_bytes,
+		record_rows ? (double)record_bytes/record_rows : 0.0,record_dropped,
+		record_error ? " write error" : "");
+	cli_printline();
+}
+
+void cli_print_play() {
+	if( ! play_active ) {
+		append_printf("playback off\n");
+		cli_printline();
+		return;
+	}
+	append_printf("%s rows:%lu loops:%lu%s\n",play_path,play_rows,play_loops,play_done ? " done" : "");
+	cli_printline();
+}
+
+void cli_print_cdc() {
+	if( ! cdc_addr[0] ) {
+		append_printf("cdc off\n");
+		cli_printline();
+		return;
+	}
+	append_printf("%s clients:%u frames:%lu dropped:%lu\n",cdc_addr,cdc_clients,cdc_frames,cdc_dropped);
+	cli_printline();
+}
+#endif //ARDUINO
+
+#if defined(MODBUS) && defined(LINUX)
+static void cli_print_port(const char* name, modbusport_t* p) {
+	append_printf("%s address:%u frames:%llu requests:%llu crc:%llu overrun:%llu timeout:%llu gap:%llu\n",
+		name,p->address,p->frames,p->requests,p->crc_errors,p->overruns,p->timeouts,p->gaps);
+	cli_printline();
+}
+
+void cli_print_rtu() {
+	unsigned int i;
+	cli_print_port("scada",&modbus_port);
+	for( i=0; i<rtu_count; i++ ) {
+		cli_print_port(rtu_ports[i].path,&rtu_ports[i].port);
+	}
+}
+#endif
+
+#ifdef IEC61850
+void cli_print_sv() {
+	append_printf("sent:%lu lost:%lu late:%lu maxlate:%luus\n",
+		iec61850_sv_sent,iec61850_sv_lost,iec61850_sv_late,iec61850_sv_maxlate);
+	cli_printline();
+}
+#endif //IEC61850
+
 #ifndef ARDUINO
 void cli_start_save(char* path) {
 	savefp = fopen(path,"wb");
@@ -274,7 +576,80 @@ void cli_start_save(char* path) {
 	savefp = 0;
 }
 
+void cli_write_config(FILE* fp) {
+	savefp = fp;
+	quiet = 1;
+	cli_print_config();
+	quiet = 0;
+	savefp = 0;
+}
+
+unsigned int cli_copy_config(char* buf, unsigned int max) {
+	savebuf = buf;
+	savebuflen = 0;
+	savebufmax = max;
+	buf[0] = 0;
+	quiet = 1;
+	cli_print_config();
+	quiet = 0;
+	savebuf = 0;
+	return savebuflen;
+}
+
 void cli_start_load(char* path) {
-	loadfp = fopen(path,"rb");
+	strncpy(loadpath,path,sizeof(loadpath)-1);
+	loadpath[sizeof(loadpath)-1] = 0;
+}
+
+int cli_load_pending() {
+	return loadpath[0] != 0;
+}
+
+int cli_take_load(char* path) {
+	if( ! loadpath[0] ) {
+		return 0;
+	}
+	strcpy(path,loadpath);
+	loadpath[0] = 0;
+	return 1;
+}
+
+void cli_print_load_error(unsigned int lineno, char* line, int error) {
+	int len = snprintf(output+outlen,LINEMAX-outlen,"%u: ",lineno);
+	outlen = outlen + len;
+	append_printf("%s\n",line);
+	cli_printline();
+	cli_print_interp_error(error < 0 ? error : error+len);
+}
+
+void cli_print_load(char* path, int loaded, unsigned int lines, unsigned int errors, unsigned int ms) {
+	if( ! loaded ) {
+		append_printf("Failed to load %s\n",path);
+	}
+	else {
+		append_printf("Loaded %s: %u lines, %u errors, %u ms\n",path,lines,errors,ms);
+	}
+	cli_printline();
+}
+
+void cli_print_reload(char* path, int reloaded, unsigned int added, unsigned int changed, unsigned int removed, unsigned int reconfigured, unsigned int errors, unsigned int ms) {
+	if( ! reloaded ) {
+		append_printf("Failed to reload %s, %u errors, nothing changed\n",path,errors);
+	}
+	else {
+		append_printf("Reloaded %s: %u added, %u changed, %u removed, %u reconfigured, %u errors, %u ms\n",
+			path,added,changed,removed,reconfigured,errors,ms);
+	}
+	cli_printline();
+}
+
+void cli_print_restore(char* path, int restored, unsigned int count, unsigned int errors, unsigned int ms) {
+	if( ! restored ) {
+		append_printf("Failed to restore %s\n",path);
+	}
+	else {
+		append_printf("Restored %s: %u variables, %u errors, %u ms\n",path,count,errors,ms);
+	}
+	cli_printline();
 }
 #endif //ARDUINO
\ No newline at end of file
@@ -30,18 +30,43 @@
 
 #include "var.h"
 
+#ifndef ARDUINO
+#include <stdio.h>
+#endif
+
 void cli_init();
 char* cli_readline();
 void cli_print_prompt();
 void cli_print_interp_error(int error);
 void cli_print_eval_error(var_t *v, int error);
 void cli_print_list();
+void cli_print_config();
 void cli_print_state();
 void cli_print_val();
 
+#ifdef IEC61850
+void cli_print_sv();
+#endif //IEC61850
+
 #ifndef ARDUINO
 void cli_start_save(char* path);
 void cli_start_load(char* path);
+int cli_load_pending();
+int cli_take_load(char* path);
+void cli_print_load_error(unsigned int lineno, char* line, int error);
+void cli_print_load(char* path, int loaded, unsigned int lines, unsigned int errors, unsigned int ms);
+void cli_write_config(FILE* fp);
+unsigned int cli_copy_config(char* buf, unsigned int max);
+void cli_print_reload(char* path, int reloaded, unsigned int added, unsigned int changed, unsigned int removed, unsigned int reconfigured, unsigned int errors, unsigned int ms);
+void cli_print_prof(unsigned int top);
+void cli_print_record();
+void cli_print_play();
+void cli_print_cdc();
+void cli_print_rtu();
+void cli_print_modbusid();
+void cli_print_cache();
+void cli_print_override();
+void cli_print_restore(char* path, int restored, unsigned int count, unsigned int errors, unsigned int ms);
 #endif //ARDUINO
 
 #endif //CLI_H
\ No newline at end of file
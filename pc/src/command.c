@@ -24,6 +24,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "command.h"
 
@@ -39,16 +41,29 @@
 #include "compat.h"
 #include "display.h"
 
+#ifndef ARDUINO
+#include "snapshot.h"
+#include "prof.h"
+#include "record.h"
+#include "play.h"
+#include "cdc.h"
+#endif
+
 #ifdef MODBUS
 #include "modbus.h"
 #endif
 
+#if defined(MODBUS) && defined(LINUX)
+#include "rtu.h"
+#endif
+
 #ifdef MODBUSTCP
 #include "modbustcp.h"
 #endif
 
 #ifdef IEC61850
 #include "iec61850.h"
+#include "iec61850sv.h"
 #endif
 
 #define PNTTYPE_DO 0
@@ -68,6 +83,100 @@ const char scaled_table[] = {
 	0x00
 };
 
+//Register encodings in PNTENC_* order, after int16
+const char pntenc_table[] = {
+	'i','n','t','3','2'|0x80,
+	'u','i','n','t','3','2'|0x80,
+	'f','l','o','a','t','3','2'|0x80,
+	'i','n','t','6','4'|0x80,
+	'f','l','o','a','t','6','4'|0x80,
+	0x00
+};
+
+//Register orders, the index shifted up is the PNTENC_ order flags
+const char pntorder_table[] = {
+	'a','b','c','d'|0x80,
+	'c','d','a','b'|0x80,
+	'b','a','d','c'|0x80,
+	'd','c','b','a'|0x80,
+	0x00
+};
+
+const char unit_table[] = {
+	'u','n','i','t'|0x80,
+	0x00
+};
+
+#define RTU_RS485  0
+#define RTU_PTY    1
+#define RTU_POINTS 2
+const char rtu_table[] = {
+	'r','s','4','8','5'|0x80,
+	'p','t','y'|0x80,
+	'p','o','i','n','t','s'|0x80,
+	0x00
+};
+
+//Device identification objects in object id order
+const char devid_table[] = {
+	'v','e','n','d','o','r'|0x80,
+	'p','r','o','d','u','c','t'|0x80,
+	'r','e','v','i','s','i','o','n'|0x80,
+	'u','r','l'|0x80,
+	'n','a','m','e'|0x80,
+	'm','o','d','e','l'|0x80,
+	'a','p','p'|0x80,
+	0x00
+};
+
+#ifndef ARDUINO
+#define PROF_ON    0
+#define PROF_OFF   1
+#define PROF_RESET 2
+const char prof_table[] = {
+	'o','n'|0x80,
+	'o','f','f'|0x80,
+	'r','e','s','e','t'|0x80,
+	0x00
+};
+
+#define OVERRIDE_HOLDS 0
+#define OVERRIDE_TICK  1
+const char override_table[] = {
+	'h','o','l','d'|0x80,
+	't','i','c','k'|0x80,
+	0x00
+};
+
+#define PLAY_LINEAR 0
+#define PLAY_STEP   1
+#define PLAY_LOOP   2
+#define PLAY_TIME   3
+#define PLAY_TICK   4
+const char play_table[] = {
+	'l','i','n','e','a','r'|0x80,
+	's','t','e','p'|0x80,
+	'l','o','o','p'|0x80,
+	't','i','m','e'|0x80,
+	't','i','c','k'|0x80,
+	0x00
+};
+#endif //ARDUINO
+
+#ifdef MODBUSTCP
+const char shared_table[] = {
+	's','h','a','r','e','d'|0x80,
+	0x00
+};
+#endif //MODBUSTCP
+
+#ifdef IEC61850
+const char threadless_table[] = {
+	't','h','r','e','a','d','l','e','s','s'|0x80,
+	0x00
+};
+#endif //IEC61850
+
 #define CMD_NEW    0
 #define CMD_LIST   1
 #define CMD_UNDEF  2
@@ -87,6 +196,21 @@ const char scaled_table[] = {
 #define CMD_GOOSE_ANALOG  14
 #define CMD_ICD       15
 #define CMD_SCD       16
+#define CMD_SV        17
+#define CMD_SNAPSHOT  18
+#define CMD_RESTORE   19
+#define CMD_RELOAD    20
+#define CMD_PROF      21
+#define CMD_RECORD    22
+#define CMD_PLAY      23
+#define CMD_CDC       24
+#define CMD_RTU       25
+#define CMD_MODBUSID  26
+#define CMD_CACHE     27
+#define CMD_MODBUSUDP 28
+#define CMD_OVERRIDE  29
+#define CMD_RELEASE   30
+#define CMD_COUNT     31  //one past the last id, sizes per command arrays
 #endif //not ARDUINO
 
 #ifdef MINI
@@ -112,6 +236,20 @@ const char cmd_table[]	= {
 	'g','s','e','a'|0x80,
 	'i','c','d'|0x80,
 	's','c','d'|0x80,
+	's','v'|0x80,
+	's','n','a','p','s','h','o','t'|0x80,
+	'r','e','s','t','o','r','e'|0x80,
+	'r','e','l','o','a','d'|0x80,
+	'p','r','o','f'|0x80,
+	'r','e','c','o','r','d'|0x80,
+	'p','l','a','y'|0x80,
+	'c','d','c'|0x80,
+	'r','t','u'|0x80,
+	'm','o','d','b','u','s','i','d'|0x80,
+	'c','a','c','h','e'|0x80,
+	'm','o','d','b','u','s','u','d','p'|0x80,
+	'o','v','e','r','r','i','d','e'|0x80,
+	'r','e','l','e','a','s','e'|0x80,
 #endif //not ARDUINO
 #ifdef MINI
 	'l','e','d'|0x80,
@@ -119,6 +257,10 @@ const char cmd_table[]	= {
 	0x00
 };
 
+#ifndef ARDUINO
+static void commandRestore(char* path);
+static void commandReload(char* path);
+#endif
 
 static var_t* parse_assignment(var_t* var) {
 	char* expr;
@@ -141,8 +283,26 @@ static var_t* parse_assignment(var_t* var) {
 	return var;
 }
 
+//Optional register encoding of an ao/ai point, txtpos is at the name
+//parse_name() found
+static uint8_t parse_pntenc() {
+	int table_idx;
+	if( next == txtpos ) {
+		return PNTENC_INT16;
+	}
+	table_idx = table_scan(pntenc_table,txtpos,next-txtpos);
+	if( table_idx < 0 ) {
+		return PNTENC_INT16;
+	}
+	txtpos = next;
+	ignore_blanks();
+	return table_idx+1;
+}
+
 static var_t* parse_pointvar(var_t *var) {
 	uint8_t pnttype = 0;
+	uint8_t pntenc = 0;
+	unsigned int pntunit = 0;
 	unsigned int pntaddr = 0;
 	float pntmin = 0;
 	float pntmax = 0;
@@ -187,6 +347,7 @@ static var_t* parse_pointvar(var_t *var) {
 		}
 		else {
 		pnttype = PNT_AO;
+		pntenc = parse_pntenc();
 		pntaddr = parse_unsigned_int();
 		}
 		break;
@@ -206,6 +367,7 @@ static var_t* parse_pointvar(var_t *var) {
 		}
 		else {
 		pnttype = PNT_AI;
+		pntenc = parse_pntenc();
 		pntaddr = parse_unsigned_int();
 		}
 		break;
@@ -215,14 +377,76 @@ static var_t* parse_pointvar(var_t *var) {
 	
 	if( parse_error )
 		return 0;
+	
+	//Optional register order of 32 and 64 bit encodings
+	ignore_blanks();
+	if( pntenc ) {
+		parse_name();
+		if( next != txtpos && (table_idx = table_scan(pntorder_table,txtpos,next-txtpos)) >= 0 ) {
+			pntenc |= table_idx<<4;
+			txtpos = next;
+			ignore_blanks();
+		}
+	}
+	
+	//Optional Modbus unit id
+	ignore_blanks();
+	parse_name();
+	if( next != txtpos && table_scan(unit_table,txtpos,next-txtpos) == 0 ) {
+		txtpos = next;
+		ignore_blanks();
+		pntunit = parse_unsigned_int();
+		if( parse_error || pntunit == 0 || pntunit > 247 ) {
+			parse_error = 1;
+			return 0;
+		}
+	}
 
 	var->pnttype = pnttype;
+	var->pntunit = pntunit;
+	var->pntenc = pntenc;
 	var->pntaddr = pntaddr;
 	var->pntmin = pntmin;
 	var->pntmax = pntmax;
+	varsVersion++;
 	return var;
 }
 
+#ifdef IEC61850
+//Parses a MAC address of the form xx:xx:xx:xx:xx:xx
+static void parse_mac(char* mac) {
+	int i, j;
+	unsigned char b;
+	for( i=0; i<6; i++ ) {
+		for( b=0, j=0; j<2; txtpos++, j++ ) {
+			b = b << 4;
+			if( *txtpos >= 'A' && *txtpos <= 'F' ) {
+				b =  b | (*txtpos-'A'+10);
+			}
+			else if( *txtpos >= 'a' && *txtpos <= 'f' ) {
+				b = b | (*txtpos-'a'+10);
+			}
+			else if( *txtpos >= '0' && *txtpos <= '9' ) {
+				b = b | (*txtpos-'0');
+			}
+			else {
+				parse_error = 1;
+				return;
+			}
+		}
+		if( i < 5 ) {
+			if( *txtpos != ':' ) {
+				parse_error = 1;
+				return;
+			} else {
+				txtpos++;
+			}
+		}
+		mac[i] = b;
+	}
+}
+#endif //IEC61850
+
 static int parse_command(char* cmd, unsigned cmdlen) {
 	int table_idx;
 	val_t val;
@@ -246,7 +470,36 @@ static int parse_command(char* cmd, unsigned cmdlen) {
 			break;
 		case CMD_MODBUS:
 			#ifdef MODBUS
+			{
+				unsigned long baud;
+				char parity = 'N';
+				uint8_t stopbits = 1;
+				uint8_t rs485 = 0;
+				char* linepos;
 				modbus_address = (uint8_t)parse_unsigned_int();
+				ignore_blanks();
+				if( parse_error || *txtpos == 0 ) {
+					break;
+				}
+				//Serial line: baud [format] [rs485]
+				linepos = txtpos;
+				baud = parse_unsigned_int();
+				ignore_blanks();
+				if( scadaFormat(txtpos,&parity,&stopbits) ) {
+					txtpos += 3;
+					ignore_blanks();
+				}
+				parse_name();
+				if( next != txtpos && table_scan(rtu_table,txtpos,next-txtpos) == RTU_RS485 ) {
+					rs485 = 1;
+					txtpos = next;
+					ignore_blanks();
+				}
+				if( parse_error || *txtpos != 0 || scadaSerial(baud,parity,stopbits,rs485) != 0 ) {
+					txtpos = linepos;
+					parse_error = 1;
+				}
+			}
 			#else
 				while( *txtpos != 0 ) { txtpos++; }
 			#endif
@@ -270,200 +523,585 @@ static int parse_command(char* cmd, unsigned cmdlen) {
 			ignore_blanks();
 			cli_start_load(txtpos);
 			break;
-		case CMD_GFX:
+		case CMD_SNAPSHOT:
 			ignore_blanks();
-			displayLoad(txtpos);
-			if( gfxpath[0] == 0 ) {
+			if( ! snapshotSave(txtpos) ) {
 				parse_error = 1;
 			}
 			break;
-		case CMD_RUN:
-			displayRun();
+		case CMD_RESTORE:
+			ignore_blanks();
+			commandRestore(txtpos);
 			break;
-		case CMD_STOP:
-			displayStop();
+		case CMD_RELOAD:
+			ignore_blanks();
+			commandReload(txtpos);
 			break;
-		case CMD_MODBUSTCP:
-			#ifdef MODBUSTCP
-			{
-				char* portpos = txtpos;
-				modbustcp_port = (uint16_t)parse_unsigned_int();
-				if( modbusTcpServ() ) {
-					txtpos = portpos;
-					parse_error = 1;
-					break;
+		case CMD_PROF:
+			ignore_blanks();
+			if( *txtpos == 0 ) {
+				cli_print_prof(PROFTOP);
+			}
+			else if( *txtpos >= '0' && *txtpos <= '9' ) {
+				cli_print_prof(parse_unsigned_int());
+			}
+			else {
+				parse_name();
+				switch( table_scan(prof_table,txtpos,next-txtpos) ) {
+					case PROF_ON:    profEnable(1); break;
+					case PROF_OFF:   profEnable(0); break;
+					case PROF_RESET: profReset(); break;
+					default: parse_error = 1;
 				}
+				txtpos = next;
 			}
-			#else
-				while( *txtpos != 0 ) { txtpos++; }
-			#endif
 			break;
-		case CMD_IEC61850:
-			#ifdef IEC61850
-			{
-				int i;
-				iec61850ServReset();
+		case CMD_RECORD:
+			ignore_blanks();
+			if( *txtpos == 0 ) {
+				cli_print_record();
+				break;
+			}
+			recordStop();
+			parse_name();
+			if( (*next == 0 || *next == ' ' || *next == '\t') && table_scan(prof_table,txtpos,next-txtpos) == PROF_OFF ) {
 				txtpos = next;
-				ignore_blanks();
-				parse_name();
-				if( txtpos == next ) { parse_error=1; break; }
-				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
-					iec61850_serv_name[i] = *txtpos;
+				break;
+			}
+			{
+				char path[sizeof(record_path)];
+				char* pathpos = txtpos;
+				unsigned int i;
+				for( i=0; i < sizeof(path)-1 && *txtpos != ' ' && *txtpos != '\t' && *txtpos != 0; i++, txtpos++ ) {
+					path[i] = *txtpos;
 				}
-				iec61850_serv_name[i] = 0;
+				path[i] = 0;
 				
+				//Variables to record, all of them if none are given
 				ignore_blanks();
-				iec61850_serv_port = (uint16_t)parse_unsigned_int();
-				if( parse_error ) { iec61850ServReset(); break; }
+				while( *txtpos != 0 ) {
+					parse_name();
+					if( next == txtpos || get_var(txtpos,next-txtpos) == 0 || ! recordBind(txtpos,next-txtpos) ) {
+						parse_error = 1;
+						break;
+					}
+					txtpos = next;
+					ignore_blanks();
+				}
+				if( parse_error ) {
+					recordStop();
+					break;
+				}
 				
-				iec61850Serv();
+				if( ! recordStart(path) ) {
+					txtpos = pathpos;
+					parse_error = 1;
+				}
 			}
-			#else
-				while( *txtpos != 0 ) { txtpos++; }
-			#endif //IEC61850
 			break;
-		case CMD_GOOSE_DIGITAL:
-			#ifdef IEC61850
+		case CMD_PLAY:
+			ignore_blanks();
+			if( *txtpos == 0 ) {
+				cli_print_play();
+				break;
+			}
+			playReset();
+			parse_name();
+			if( (*next == 0 || *next == ' ' || *next == '\t') && table_scan(prof_table,txtpos,next-txtpos) == PROF_OFF ) {
+				txtpos = next;
+				break;
+			}
 			{
-				int i, j;
-				unsigned char b;
-				char* ethpos;
-				if( ! iec61850_serv_name[0] ) {
-					parse_error = 1;
-					break;
+				char path[sizeof(play_path)];
+				char* pathpos = txtpos;
+				char* name;
+				unsigned int i;
+				int opt;
+				for( i=0; i < sizeof(path)-1 && *txtpos != ' ' && *txtpos != '\t' && *txtpos != 0; i++, txtpos++ ) {
+					path[i] = *txtpos;
 				}
+				path[i] = 0;
 				
-				iec61850GooseDigitalReset();
-				txtpos = next;
-				
+				//Options, then the variables with an optional column name
 				ignore_blanks();
-				parse_name();
-				if( txtpos == next ) { parse_error=1; break; }
-				ethpos = txtpos;
-				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
-					iec61850_goose_digital_eth[i] = *txtpos;
+				while( *txtpos != 0 ) {
+					parse_name();
+					opt = table_scan(play_table,txtpos,next-txtpos);
+					if( opt < 0 ) {
+						break;
+					}
+					switch( opt ) {
+						case PLAY_LINEAR: play_linear = 1; break;
+						case PLAY_STEP:   play_linear = 0; break;
+						case PLAY_LOOP:   play_loop = 1; break;
+						case PLAY_TIME:   play_time = 1; break;
+						case PLAY_TICK:   play_time = 0; break;
+					}
+					txtpos = next;
+					ignore_blanks();
 				}
-				iec61850_goose_digital_eth[i] = 0;
-				txtpos = next;
-				
-				ignore_blanks();
-				iec61850_goose_digital_appid = (uint16_t)parse_unsigned_int();
-				if( parse_error ) { break; }
-				
-				ignore_blanks();
-				for( i=0; i<6; i++ ) {
-					for( b=0, j=0; j<2; txtpos++, j++ ) {
-						b = b << 4;
-						if( *txtpos >= 'A' && *txtpos <= 'F' ) {
-							b =  b | (*txtpos-'A'+10);
-						}
-						else if( *txtpos >= 'a' && *txtpos <= 'f' ) {
-							b = b | (*txtpos-'a'+10);
-						}
-						else if( *txtpos >= '0' && *txtpos <= '9' ) {
-							b = b | (*txtpos-'0');
-						}
-						else {
-							parse_error = 1;
-							break;
-						}
+				while( *txtpos != 0 ) {
+					parse_name();
+					name = txtpos;
+					i = next-txtpos;
+					if( i == 0 || get_var(name,i) == 0 ) {
+						parse_error = 1;
+						break;
 					}
-					if( parse_error ) { break; }
-					if( i < 5 ) {
-						if( *txtpos != ':' ) {
+					txtpos = next;
+					if( *txtpos == '=' ) {
+						txtpos++;
+						parse_name();
+						if( next == txtpos ) {
 							parse_error = 1;
 							break;
-						} else {
-							txtpos++;
 						}
 					}
-					iec61850_goose_digital_dst[i] = b;
+					else {
+						txtpos = name;
+					}
+					if( ! playBind(name,i,txtpos,next-txtpos) ) {
+						parse_error = 1;
+						break;
+					}
+					txtpos = next;
+					ignore_blanks();
+				}
+				if( parse_error ) {
+					playReset();
+					break;
 				}
-				if( parse_error ) { iec61850GooseDigitalReset(); break; }
 				
-				iec61850GooseDigital();
-				if( ! iec61850_goose_digital_eth[0] ) {
-					txtpos = ethpos;
+				if( ! play(path) ) {
+					txtpos = pathpos;
 					parse_error = 1;
+				}
+			}
+			break;
+		case CMD_CDC:
+			#ifdef LINUX
+			{
+				char* addrpos;
+				unsigned int i;
+				ignore_blanks();
+				if( *txtpos == 0 ) {
+					cli_print_cdc();
+					break;
+				}
+				cdcReset();
+				parse_name();
+				if( (*next == 0 || *next == ' ' || *next == '\t') && table_scan(prof_table,txtpos,next-txtpos) == PROF_OFF ) {
+					txtpos = next;
 					break;
 				}
+				addrpos = txtpos;
+				for( i=0; i < sizeof(cdc_addr)-1 && *txtpos != ' ' && *txtpos != '\t' && *txtpos != 0; i++, txtpos++ ) {
+					cdc_addr[i] = *txtpos;
+				}
+				cdc_addr[i] = 0;
+				if( cdcServ() ) {
+					cdcReset();
+					txtpos = addrpos;
+					parse_error = 1;
+				}
 			}
 			#else
 				while( *txtpos != 0 ) { txtpos++; }
-			#endif //IEC61850
+			#endif //LINUX
 			break;
-		case CMD_GOOSE_ANALOG:
-			#ifdef IEC61850
+		case CMD_RTU:
+			#if defined(MODBUS) && defined(LINUX)
 			{
-				int i, j;
-				unsigned char b;
-				char* ethpos;
-				if( ! iec61850_serv_name[0] ) {
-					parse_error = 1;
+				char path[RTUPATHMAX];
+				uint8_t pty = 0;
+				unsigned int address;
+				unsigned long baud = 9600;
+				char parity = 'N';
+				uint8_t stopbits = 1;
+				uint8_t rs485 = 0;
+				unsigned int first = 0;
+				unsigned int last = 0;
+				uint16_t count = 0;
+				char* linepos;
+				unsigned int i;
+				int kw;
+				ignore_blanks();
+				if( *txtpos == 0 ) {
+					cli_print_rtu();
 					break;
 				}
-				
-				iec61850GooseAnalogReset();
-				txtpos = next;
-				
-				ignore_blanks();
 				parse_name();
-				if( txtpos == next ) { parse_error=1; break; }
-				ethpos = txtpos;
-				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
-					iec61850_goose_analog_eth[i] = *txtpos;
+				if( (*next == 0 || *next == ' ' || *next == '\t') && table_scan(prof_table,txtpos,next-txtpos) == PROF_OFF ) {
+					rtuReset();
+					txtpos = next;
+					break;
 				}
-				iec61850_goose_analog_eth[i] = 0;
-				txtpos = next;
-				
+				if( (*next == ' ' || *next == '\t') && table_scan(rtu_table,txtpos,next-txtpos) == RTU_PTY ) {
+					pty = 1;
+					txtpos = next;
+					ignore_blanks();
+				}
+				//rtu [pty] path address [baud [format]] [rs485] [points first-last]
+				linepos = txtpos;
+				for( i=0; i < RTUPATHMAX-1 && *txtpos != ' ' && *txtpos != '\t' && *txtpos != 0; i++, txtpos++ ) {
+					path[i] = *txtpos;
+				}
+				path[i] = 0;
 				ignore_blanks();
-				iec61850_goose_analog_appid = (uint16_t)parse_unsigned_int();
-				if( parse_error ) { break; }
-				
+				if( i == 0 || i == RTUPATHMAX-1 ) {
+					txtpos = linepos;
+					parse_error = 1;
+					break;
+				}
+				address = parse_unsigned_int();
 				ignore_blanks();
-				for( i=0; i<6; i++ ) {
-					for( b=0, j=0; j<2; txtpos++, j++ ) {
-						b = b << 4;
-						if( *txtpos >= 'A' && *txtpos <= 'F' ) {
-							b =  b | (*txtpos-'A'+10);
-						}
-						else if( *txtpos >= 'a' && *txtpos <= 'f' ) {
-							b = b | (*txtpos-'a'+10);
-						}
-						else if( *txtpos >= '0' && *txtpos <= '9' ) {
-							b = b | (*txtpos-'0');
+				if( !parse_error && *txtpos >= '0' && *txtpos <= '9' ) {
+					baud = parse_unsigned_int();
+					ignore_blanks();
+					if( scadaFormat(txtpos,&parity,&stopbits) ) {
+						txtpos += 3;
+						ignore_blanks();
+					}
+				}
+				while( !parse_error && *txtpos != 0 ) {
+					parse_name();
+					kw = next != txtpos ? table_scan(rtu_table,txtpos,next-txtpos) : -1;
+					if( kw == RTU_RS485 ) {
+						rs485 = 1;
+						txtpos = next;
+					}
+					else if( kw == RTU_POINTS ) {
+						txtpos = next;
+						ignore_blanks();
+						first = parse_unsigned_int();
+						if( !parse_error && *txtpos == '-' ) {
+							txtpos++;
+							last = parse_unsigned_int();
 						}
 						else {
 							parse_error = 1;
-							break;
 						}
-					}
-					if( parse_error ) { break; }
-					if( i < 5 ) {
-						if( *txtpos != ':' ) {
+						if( !parse_error && (last < first || last > 0xFFFF) ) {
 							parse_error = 1;
-							break;
-						} else {
-							txtpos++;
 						}
+						count = last-first+1;
+					}
+					else {
+						parse_error = 1;
 					}
-					iec61850_goose_analog_dst[i] = b;
+					ignore_blanks();
 				}
-				if( parse_error ) { iec61850GooseAnalogReset(); break; }
-				
-				iec61850GooseAnalog();
-				if( ! iec61850_goose_analog_eth[0] ) {
-					txtpos = ethpos;
-					parse_error = 1;
+				if( parse_error ) {
 					break;
 				}
+				if( address > 247 || rtuOpen(path,pty,(uint8_t)address,baud,parity,stopbits,rs485,
+						(uint16_t)first,count) != 0 ) {
+					txtpos = linepos;
+					parse_error = 1;
+				}
 			}
 			#else
 				while( *txtpos != 0 ) { txtpos++; }
-			#endif //IEC61850
+			#endif
 			break;
-		case CMD_ICD:
-			#ifdef IEC61850
+		case CMD_MODBUSID:
+			#ifdef MODBUS
+			{
+				int id;
+				unsigned int i;
+				ignore_blanks();
+				if( *txtpos == 0 ) {
+					cli_print_modbusid();
+					break;
+				}
+				//modbusid object text, the rest of the line is the text
+				parse_name();
+				id = next != txtpos ? table_scan(devid_table,txtpos,next-txtpos) : -1;
+				if( id < 0 || (*next != 0 && *next != ' ' && *next != '\t') ) {
+					parse_error = 1;
+					break;
+				}
+				txtpos = next;
+				ignore_blanks();
+				for( i=0; i < MODBUSIDLEN-1 && *txtpos != 0; i++, txtpos++ ) {
+					modbus_devid[id][i] = *txtpos;
+				}
+				while( i > 0 && (modbus_devid[id][i-1] == ' ' || modbus_devid[id][i-1] == '\t') ) {
+					i--;
+				}
+				modbus_devid[id][i] = 0;
+				if( *txtpos != 0 ) {
+					parse_error = 1;
+				}
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif
+			break;
+		case CMD_CACHE:
+			#ifdef MODBUS
+			ignore_blanks();
+			if( *txtpos == 0 ) {
+				cli_print_cache();
+				break;
+			}
+			parse_name();
+			switch( table_scan(prof_table,txtpos,next-txtpos) ) {
+				case PROF_ON:
+					modbus_cache = 1;
+					break;
+				case PROF_OFF:
+					modbus_cache = 0;
+					break;
+				default:
+					parse_error = 1;
+					break;
+			}
+			if( ! parse_error ) {
+				txtpos = next;
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif
+			break;
+		case CMD_OVERRIDE:
+			ignore_blanks();
+			if( *txtpos == 0 ) {
+				cli_print_override();
+			}
+			else if( *txtpos >= '0' && *txtpos <= '9' ) {
+				var_t* v;
+				unsigned int now = compatMillis();
+				override_ms = parse_unsigned_int();
+				if( override_ms == OVERRIDE_HOLD ) {
+					parse_error = 1;
+					break;
+				}
+				//Points already overridden time out from now
+				for( v=vars; v<vars+VARSMAX; v++ ) {
+					v->override_at = now;
+				}
+			}
+			else {
+				parse_name();
+				switch( table_scan(override_table,txtpos,next-txtpos) ) {
+					case OVERRIDE_HOLDS: override_ms = OVERRIDE_HOLD; break;
+					case OVERRIDE_TICK:  override_ms = 0; break;
+					default: parse_error = 1;
+				}
+				if( ! parse_error ) {
+					txtpos = next;
+				}
+			}
+			break;
+		case CMD_RELEASE:
+			//Named variables, all of them if none are given
+			{
+				var_t* v;
+				ignore_blanks();
+				if( *txtpos == 0 ) {
+					for( v=vars; v<vars+VARSMAX; v++ ) {
+						v->override = 0;
+					}
+					break;
+				}
+				while( *txtpos != 0 ) {
+					parse_name();
+					if( next == txtpos || (v = get_var(txtpos,next-txtpos)) == 0 ) {
+						parse_error = 1;
+						break;
+					}
+					v->override = 0;
+					txtpos = next;
+					ignore_blanks();
+				}
+			}
+			break;
+		case CMD_GFX:
+			ignore_blanks();
+			if( displayLoad(txtpos) ) {
+				parse_error = 1;
+			}
+			break;
+		case CMD_RUN:
+			ignore_blanks();
+			if( *txtpos >= '0' && *txtpos <= '9' ) {
+				display_delay = parse_unsigned_int();
+			}
+			displayRun();
+			break;
+		case CMD_STOP:
+			displayStop();
+			break;
+		case CMD_MODBUSTCP:
+			#ifdef MODBUSTCP
+			{
+				char* portpos = txtpos;
+				modbustcp_port = (uint16_t)parse_unsigned_int();
+				if( modbusTcpServ() ) {
+					txtpos = portpos;
+					parse_error = 1;
+					break;
+				}
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif
+			break;
+		case CMD_MODBUSUDP:
+			#ifdef MODBUSTCP
+			{
+				char* portpos = txtpos;
+				modbusudp_port = (uint16_t)parse_unsigned_int();
+				modbusudp_shared = 0;
+				ignore_blanks();
+				//Optional port sharing with other simulator processes
+				if( *txtpos != 0 ) {
+					parse_name();
+					if( next == txtpos || table_scan(shared_table,txtpos,next-txtpos) != 0 ) {
+						parse_error = 1;
+						break;
+					}
+					modbusudp_shared = 1;
+					txtpos = next;
+				}
+				if( modbusUdpServ() ) {
+					modbusudp_port = 0;
+					txtpos = portpos;
+					parse_error = 1;
+					break;
+				}
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif
+			break;
+		case CMD_IEC61850:
+			#ifdef IEC61850
+			{
+				int i;
+				iec61850ServReset();
+				txtpos = next;
+				ignore_blanks();
+				parse_name();
+				if( txtpos == next ) { parse_error=1; break; }
+				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
+					iec61850_serv_name[i] = *txtpos;
+				}
+				iec61850_serv_name[i] = 0;
+				
+				ignore_blanks();
+				iec61850_serv_port = (uint16_t)parse_unsigned_int();
+				if( parse_error ) { iec61850ServReset(); break; }
+				
+				//Optional maximum number of MMS connections
+				ignore_blanks();
+				if( *txtpos >= '0' && *txtpos <= '9' ) {
+					iec61850_serv_maxconn = (uint16_t)parse_unsigned_int();
+					if( parse_error || iec61850_serv_maxconn == 0 ) { parse_error=1; iec61850ServReset(); break; }
+					ignore_blanks();
+				}
+				
+				//Optional threadless mode (serviced from the main loop)
+				if( *txtpos != 0 ) {
+					parse_name();
+					if( next == txtpos || table_scan(threadless_table,txtpos,next-txtpos) != 0 ) { parse_error=1; iec61850ServReset(); break; }
+					iec61850_serv_threadless = 1;
+					txtpos = next;
+				}
+				
+				iec61850Serv();
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif //IEC61850
+			break;
+		case CMD_GOOSE_DIGITAL:
+			#ifdef IEC61850
+			{
+				int i;
+				char* ethpos;
+				if( ! iec61850_serv_name[0] ) {
+					parse_error = 1;
+					break;
+				}
+				
+				iec61850GooseDigitalReset();
+				txtpos = next;
+				
+				ignore_blanks();
+				parse_name();
+				if( txtpos == next ) { parse_error=1; break; }
+				ethpos = txtpos;
+				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
+					iec61850_goose_digital_eth[i] = *txtpos;
+				}
+				iec61850_goose_digital_eth[i] = 0;
+				txtpos = next;
+				
+				ignore_blanks();
+				iec61850_goose_digital_appid = (uint16_t)parse_unsigned_int();
+				if( parse_error ) { break; }
+				
+				ignore_blanks();
+				parse_mac(iec61850_goose_digital_dst);
+				if( parse_error ) { iec61850GooseDigitalReset(); break; }
+				
+				iec61850GooseDigital();
+				if( ! iec61850_goose_digital_eth[0] ) {
+					txtpos = ethpos;
+					parse_error = 1;
+					break;
+				}
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif //IEC61850
+			break;
+		case CMD_GOOSE_ANALOG:
+			#ifdef IEC61850
+			{
+				int i;
+				char* ethpos;
+				if( ! iec61850_serv_name[0] ) {
+					parse_error = 1;
+					break;
+				}
+				
+				iec61850GooseAnalogReset();
+				txtpos = next;
+				
+				ignore_blanks();
+				parse_name();
+				if( txtpos == next ) { parse_error=1; break; }
+				ethpos = txtpos;
+				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
+					iec61850_goose_analog_eth[i] = *txtpos;
+				}
+				iec61850_goose_analog_eth[i] = 0;
+				txtpos = next;
+				
+				ignore_blanks();
+				iec61850_goose_analog_appid = (uint16_t)parse_unsigned_int();
+				if( parse_error ) { break; }
+				
+				ignore_blanks();
+				parse_mac(iec61850_goose_analog_dst);
+				if( parse_error ) { iec61850GooseAnalogReset(); break; }
+				
+				iec61850GooseAnalog();
+				if( ! iec61850_goose_analog_eth[0] ) {
+					txtpos = ethpos;
+					parse_error = 1;
+					break;
+				}
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif //IEC61850
+			break;
+		case CMD_ICD:
+			#ifdef IEC61850
 			{
 				int i;
 				txtpos = next;
@@ -498,6 +1136,76 @@ static int parse_command(char* cmd, unsigned cmdlen) {
 				while( *txtpos != 0 ) { txtpos++; }
 			#endif //IEC61850
 			break;
+		case CMD_SV:
+			#ifdef IEC61850
+			{
+				int i;
+				char* ethpos;
+				var_t* v;
+				
+				//Without arguments report the publisher statistics
+				if( *txtpos == 0 ) {
+					cli_print_sv();
+					break;
+				}
+				
+				iec61850SvReset();
+				
+				parse_name();
+				if( txtpos == next ) { parse_error=1; break; }
+				ethpos = txtpos;
+				for( i=0; txtpos != next && i < 255; i++, txtpos++ ) {
+					iec61850_sv_eth[i] = *txtpos;
+				}
+				iec61850_sv_eth[i] = 0;
+				txtpos = next;
+				
+				ignore_blanks();
+				iec61850_sv_appid = (uint16_t)parse_unsigned_int();
+				if( parse_error ) { iec61850SvReset(); break; }
+				
+				ignore_blanks();
+				parse_mac(iec61850_sv_dst);
+				if( parse_error ) { iec61850SvReset(); break; }
+				
+				ignore_blanks();
+				for( i=0; i < SVIDMAX && *txtpos != ' ' && *txtpos != '\t' && *txtpos != 0; i++, txtpos++ ) {
+					iec61850_sv_id[i] = *txtpos;
+				}
+				iec61850_sv_id[i] = 0;
+				if( i == 0 ) { parse_error=1; iec61850SvReset(); break; }
+				
+				ignore_blanks();
+				iec61850_sv_rate = parse_unsigned_int();
+				if( parse_error || iec61850_sv_rate == 0 || iec61850_sv_rate > 0xFFFF ) {
+					parse_error=1; iec61850SvReset(); break;
+				}
+				
+				//Variables that make up the seqData, in order
+				ignore_blanks();
+				while( *txtpos != 0 ) {
+					parse_name();
+					v = get_var(txtpos,next-txtpos);
+					if( next == txtpos || v == 0 || ! iec61850SvBind(txtpos,next-txtpos) ) {
+						parse_error = 1;
+						break;
+					}
+					txtpos = next;
+					ignore_blanks();
+				}
+				if( parse_error ) { iec61850SvReset(); break; }
+				
+				iec61850Sv();
+				if( ! iec61850_sv_eth[0] ) {
+					txtpos = ethpos;
+					parse_error = 1;
+					break;
+				}
+			}
+			#else
+				while( *txtpos != 0 ) { txtpos++; }
+			#endif //IEC61850
+			break;
 #endif //not ARDUINO
 #ifdef MINI
 		case CMD_LED:
@@ -559,6 +1267,14 @@ static int parse_command(char* cmd, unsigned cmdlen) {
 }
 
 void commandBegin() {
+	#ifndef ARDUINO
+	recordStop();
+	playReset();
+	cdcReset();
+	#endif
+	#if defined(MODBUS) && defined(LINUX)
+	rtuReset();
+	#endif
 	varBegin();
 	#ifdef MINI
 			indicatorsReset();
@@ -568,6 +1284,7 @@ void commandBegin() {
 	#endif
 	#ifdef MODBUSTCP
 			modbusTcpBegin();
+			modbusUdpBegin();
 	#endif
 	#ifdef IEC61850
 			iec61850Reset();
@@ -577,24 +1294,22 @@ void commandBegin() {
 }
 
 
-void commandProcess() {
-	int error;
+//Execute one console/script line.  Returns 0 on success, otherwise the
+//1-based column of the error (or a negative internal error).
+static int commandExecute(char* line) {
 	var_t *var = 0;
 	char* name;
 	unsigned int namelen;
-	char* line = cli_readline();
-	
-	if( line == 0 )
-		return;
 	
 	txtpos = line;
 	parse_error = 0;
+	valuesVersion++;
 	
 	ignore_blanks();
 	
 	//What this just a blank line
 	if( *txtpos == 0 )
-		goto command_done;
+		return 0;
 	
 	//Parse Simple expression evaluations
 	if( *txtpos == '?' ) {
@@ -603,7 +1318,7 @@ void commandProcess() {
 		if( ! expr_eval(&a) )
 			goto interp_error;
 		cli_print_val(a);
-		goto command_done;
+		return 0;
 	}
 	
 	//Parse a name (could be a command)
@@ -619,7 +1334,7 @@ void commandProcess() {
 	if( parse_command(name,namelen) ) {
 		if( parse_error )
 			goto interp_error;
-		goto command_done;
+		return 0;
 	}
 	
 	//This is variable with no assignment or point spec
@@ -651,12 +1366,701 @@ void commandProcess() {
 		}
 		ignore_blanks();
 	}
-	goto command_done;
+	return 0;
 	
 	interp_error:
-		cli_print_interp_error(txtpos-line+1);
-	command_done:
-		cli_print_prompt();
+		return txtpos-line+1;
+}
+
+#ifndef ARDUINO
+//Scripts are read in large blocks and every line is executed in a
+//single pass without echo; only errors and a summary are printed.
+#define LOADBLOCK 65536
+static char loadblock[LOADBLOCK+1];
+
+static void commandLoad(char* path) {
+	FILE* fp;
+	char line[LINEMAX];
+	unsigned int linelen = 0;
+	unsigned int lineno = 0;
+	unsigned int lines = 0;
+	unsigned int errors = 0;
+	unsigned int start = compatMillis();
+	size_t len;
+	char* c;
+	char* end;
+	char* comment;
+	int error;
+	int overflow = 0;
+	int eof = 0;
+	
+	fp = fopen(path,"rb");
+	if( fp == 0 ) {
+		cli_print_load(path,0,0,0,0);
+		return;
+	}
+	
+	while( ! eof && ! cli_load_pending() ) {
+		len = fread(loadblock,1,LOADBLOCK,fp);
+		end = loadblock+len;
+		//Treat the end of the file as the end of the last line
+		if( len < LOADBLOCK ) {
+			*end++ = '\n';
+			eof = 1;
+		}
+		for( c=loadblock; c<end; c++ ) {
+			if( *c != '\n' && *c != '\r' ) {
+				if( linelen < LINEMAX-1 ) {
+					line[linelen++] = *c;
+				}
+				else {
+					overflow = 1;
+				}
+				continue;
+			}
+			if( *c == '\n' ) {
+				lineno++;
+			}
+			if( linelen == 0 ) {
+				continue;
+			}
+			line[linelen] = 0;
+			linelen = 0;
+			comment = strchr(line,'#');
+			if( comment ) {
+				*comment = 0;
+			}
+			lines++;
+			error = overflow ? -1 : commandExecute(line);
+			overflow = 0;
+			if( error ) {
+				errors++;
+				cli_print_load_error(lineno+(*c=='\r'),line,error);
+			}
+			//A load from within the script replaces the rest of it
+			if( cli_load_pending() ) {
+				break;
+			}
+		}
+	}
+	fclose(fp);
+	cli_print_load(path,1,lines,errors,compatMillis()-start);
+}
+
+//The snapshot holds the variable tables as they are in memory, so only
+//the few configuration commands (servers, GOOSE, SV, gfx) are executed.
+#define RESTORECONFIG 4096
+static void commandRestore(char* path) {
+	static char config[RESTORECONFIG];
+	unsigned int start = compatMillis();
+	unsigned int count = 0;
+	unsigned int errors = 0;
+	unsigned int lineno = 0;
+	char* line;
+	char* c;
+	int error;
+	int len;
+	
+	if( ! snapshotOpen(path) ) {
+		cli_print_restore(path,0,0,0,0);
 		return;
+	}
+	commandBegin();
+	len = snapshotRestore(config,RESTORECONFIG);
+	snapshotClose();
+	if( len < 0 ) {
+		cli_print_restore(path,0,0,0,0);
+		return;
+	}
+	
+	while( count < VARSMAX && vars[count].value.type != VAL_NONE ) {
+		count++;
+	}
+	
+	line = config;
+	for( c=config; c<config+len; c++ ) {
+		if( *c != '\n' ) {
+			continue;
+		}
+		*c = 0;
+		lineno++;
+		error = commandExecute(line);
+		if( error ) {
+			errors++;
+			cli_print_load_error(lineno,line,error);
+		}
+		line = c+1;
+	}
+	parse_error = 0;
+	cli_print_restore(path,1,count,errors,compatMillis()-start);
+}
+
+//A reload stages the whole script before touching anything: variable
+//lines are split into name, expression text and point spec, commands are
+//kept as lines.  The staged variables are then applied in one pass between
+//ticks (rolled back if any expression fails), and only the protocol
+//commands whose line differs from the live configuration are executed.
+#define RELOADCMDSMAX 64
+#define RELOADCONFIG  4096
+
+#define STAGE_SEEN    0x01
+#define STAGE_EXPR    0x02
+#define STAGE_PNT     0x04
+#define STAGE_ADDED   0x08
+#define STAGE_CHANGED 0x10
+#define STAGE_REF     0x20   //named in a live expression
+
+typedef struct {
+	char* line;
+	unsigned int lineno;
+	char* name;
+	unsigned int namelen;
+	char* expr;
+	unsigned int exprlen;
+	var_t pnt;
+	uint8_t haspnt;
+} stage_t;
+
+typedef struct {
+	char* line;
+	unsigned int lineno;
+	int cmd;
+	uint8_t keep;
+} stagecmd_t;
+
+//Collapse blanks so lines typed by hand compare equal to list output
+static void reloadNormalize(char* line) {
+	char* src = line;
+	char* dst = line;
+	while( *src == ' ' || *src == '\t' ) src++;
+	while( *src ) {
+		if( *src == ' ' || *src == '\t' ) {
+			while( *src == ' ' || *src == '\t' ) src++;
+			if( *src ) *dst++ = ' ';
+			continue;
+		}
+		*dst++ = *src++;
+	}
+	*dst = 0;
+}
+
+//Compare script expression text with an exprs table entry, ignoring the
+//white space that table_add() drops
+static int reloadExprDiffers(char* entry, char* expr, unsigned int len) {
+	unsigned char* e = (unsigned char*)entry;
+	char* c;
+	for( c=expr; c<expr+len; c++ ) {
+		if( *c == ' ' || *c == '\t' || *c == '\n' ) {
+			continue;
+		}
+		if( *e == 0x80 || *e != (*c & 0x7F) ) {
+			return 1;
+		}
+		e++;
+	}
+	return *e != 0x80;
+}
+
+static int reloadIsConfig(int cmd) {
+	switch( cmd ) {
+		case CMD_MODBUS:
+		case CMD_MODBUSTCP:
+		case CMD_IEC61850:
+		case CMD_GOOSE_DIGITAL:
+		case CMD_GOOSE_ANALOG:
+		case CMD_ICD:
+		case CMD_SCD:
+		case CMD_SV:
+		case CMD_PLAY:
+		case CMD_CDC:
+		case CMD_RTU:
+		case CMD_MODBUSID:
+		case CMD_CACHE:
+		case CMD_MODBUSUDP:
+		case CMD_OVERRIDE:
+		case CMD_GFX:
+		case CMD_RUN:
+		case CMD_STOP:
+			return 1;
+	}
+	return 0;
+}
+
+//Commands built from the point layout, re-run when it changes
+static int reloadIsModel(int cmd) {
+	return cmd == CMD_IEC61850 || cmd == CMD_GOOSE_DIGITAL || cmd == CMD_GOOSE_ANALOG ||
+		cmd == CMD_ICD || cmd == CMD_SCD;
 }
 
+//Flag the variables named in the expressions of the script's variables.
+//Names in expressions are created on first use, so such a variable may
+//exist without a line of its own.
+static void reloadReferences(uint8_t* flags) {
+	unsigned int i;
+	char* e;
+	char* name;
+	uint8_t last;
+	var_t* v;
+	for( i=0; i<VARSMAX && vars[i].value.type != VAL_NONE; i++ ) {
+		if( ! (flags[i] & STAGE_SEEN) || vars[i].expr == 0 ) {
+			continue;
+		}
+		e = vars[i].expr;
+		last = 0;
+		while( ! last ) {
+			name = e;
+			while( ((*e&0x7F) >= 'a' && (*e&0x7F) <= 'z') || ((*e&0x7F) >= 'A' && (*e&0x7F) <= 'Z') ||
+			       ((*e&0x7F) >= '0' && (*e&0x7F) <= '9') || (*e&0x7F) == '_' ) {
+				last = *e++ & 0x80;
+				if( last ) {
+					break;
+				}
+			}
+			if( e == name ) {
+				last = *e++ & 0x80;
+				continue;
+			}
+			//Numbers are not names
+			if( (*name&0x7F) >= '0' && (*name&0x7F) <= '9' ) {
+				continue;
+			}
+			v = get_var(name,e-name);
+			if( v ) {
+				flags[v-vars] |= STAGE_REF;
+			}
+		}
+	}
+}
+
+//Stop whatever an old configuration line started.  Returns 1 if there
+//was anything to stop.
+static int reloadTeardown(int cmd) {
+	switch( cmd ) {
+		#ifdef MODBUSTCP
+		case CMD_MODBUSTCP:
+			modbusTcpBegin();
+			return 1;
+		case CMD_MODBUSUDP:
+			modbusUdpBegin();
+			return 1;
+		#endif
+		#ifdef IEC61850
+		case CMD_IEC61850:
+			iec61850Reset();
+			return 1;
+		case CMD_GOOSE_DIGITAL:
+			iec61850GooseDigitalReset();
+			return 1;
+		case CMD_GOOSE_ANALOG:
+			iec61850GooseAnalogReset();
+			return 1;
+		case CMD_ICD:
+			iec61850_icd_path[0] = 0;
+			return 1;
+		case CMD_SV:
+			iec61850SvReset();
+			return 1;
+		#endif
+		case CMD_PLAY:
+			playReset();
+			return 1;
+		case CMD_CDC:
+			cdcReset();
+			return 1;
+		#if defined(MODBUS) && defined(LINUX)
+		case CMD_RTU:
+			rtuReset();
+			return 1;
+		#endif
+		case CMD_GFX:
+			displayBegin();
+			return 1;
+	}
+	return 0;
+}
+
+static int reloadCommand(char* line) {
+	txtpos = line;
+	ignore_blanks();
+	parse_name();
+	if( next == txtpos ) {
+		return -1;
+	}
+	return table_scan(cmd_table,txtpos,next-txtpos);
+}
+
+//Split a variable line into its parts without evaluating anything.
+//Returns 0 or the error column.
+static int reloadStage(stage_t* st) {
+	char* end;
+	st->expr = 0;
+	st->haspnt = 0;
+	txtpos = st->line;
+	parse_error = 0;
+	ignore_blanks();
+	parse_name();
+	st->name = txtpos;
+	st->namelen = next-txtpos;
+	txtpos = next;
+	ignore_blanks();
+	if( st->namelen == 0 || *txtpos == 0 ) {
+		return txtpos-st->line+1;
+	}
+	while( *txtpos != 0 ) {
+		if( *txtpos == '=' ) {
+			txtpos++;
+			ignore_blanks();
+			st->expr = txtpos;
+			while( *txtpos != 0 && *txtpos != ':' ) {
+				txtpos++;
+			}
+			end = txtpos;
+			while( end > st->expr && (*(end-1) == ' ' || *(end-1) == '\t') ) {
+				end--;
+			}
+			st->exprlen = end-st->expr;
+		} else if( *txtpos == ':' ) {
+			if( ! parse_pointvar(&st->pnt) ) {
+				return txtpos-st->line+1;
+			}
+			st->haspnt = 1;
+		} else {
+			return txtpos-st->line+1;
+		}
+		ignore_blanks();
+	}
+	return 0;
+}
+
+//Bring one live variable in line with a staged line.  Returns 0 or the
+//error column.
+static int reloadApply(stage_t* st, uint8_t* flags, uint8_t* layout) {
+	var_t* v;
+	val_t a;
+	v = get_var(st->name,st->namelen);
+	if( ! v ) {
+		v = make_var(st->name,st->namelen);
+		if( ! v ) {
+			return st->name-st->line+1;
+		}
+		flags[v-vars] = STAGE_ADDED;
+	}
+	flags[v-vars] |= STAGE_SEEN;
+	if( st->expr ) {
+		flags[v-vars] |= STAGE_EXPR;
+		if( v->expr == 0 || reloadExprDiffers(v->expr,st->expr,st->exprlen) ) {
+			txtpos = st->expr;
+			parse_error = 0;
+			if( ! expr_eval(&a) ) {
+				return txtpos-st->line+1;
+			}
+			ignore_blanks();
+			if( *txtpos != 0 && *txtpos != ':' ) {
+				return txtpos-st->line+1;
+			}
+			if( ! set_expr(v,st->expr,st->exprlen) ) {
+				return st->expr-st->line+1;
+			}
+			v->value = a;
+			flags[v-vars] |= STAGE_CHANGED;
+		}
+	}
+	if( st->haspnt ) {
+		flags[v-vars] |= STAGE_PNT;
+		if( v->pnttype != st->pnt.pnttype || v->pntaddr != st->pnt.pntaddr ||
+		    v->pntunit != st->pnt.pntunit || v->pntenc != st->pnt.pntenc ||
+		    v->pntmin != st->pnt.pntmin || v->pntmax != st->pnt.pntmax ) {
+			v->pnttype = st->pnt.pnttype;
+			v->pntunit = st->pnt.pntunit;
+			v->pntenc = st->pnt.pntenc;
+			v->pntaddr = st->pnt.pntaddr;
+			v->pntmin = st->pnt.pntmin;
+			v->pntmax = st->pnt.pntmax;
+			flags[v-vars] |= STAGE_CHANGED;
+			*layout = 1;
+		}
+	}
+	return 0;
+}
+
+static void commandReload(char* path) {
+	static char config[RELOADCONFIG];
+	static stagecmd_t cmds[RELOADCMDSMAX];
+	char* old[RELOADCMDSMAX];
+	uint8_t oldkeep[RELOADCMDSMAX];
+	unsigned int nold = 0;
+	unsigned int ncmds = 0;
+	unsigned int nstage = 0;
+	unsigned int count = 0;
+	unsigned int added = 0;
+	unsigned int changed = 0;
+	unsigned int removed = 0;
+	unsigned int reconfigured = 0;
+	unsigned int errors = 0;
+	unsigned int lineno = 0;
+	unsigned int start = compatMillis();
+	unsigned int i;
+	unsigned int j;
+	uint8_t layout = 0;
+	uint8_t executed[CMD_COUNT];
+	FILE* fp;
+	long len;
+	char* data = 0;
+	char* line;
+	char* c;
+	char* comment;
+	stage_t* stage = 0;
+	uint8_t* flags = 0;
+	var_t* backvars = 0;
+	char* backnames = 0;
+	char* backexprs = 0;
+	int error;
+	int cmd;
+	
+	//Read the whole script
+	fp = fopen(path,"rb");
+	if( fp == 0 ) {
+		cli_print_load(path,0,0,0,0);
+		return;
+	}
+	fseek(fp,0,SEEK_END);
+	len = ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	data = malloc(len+2);
+	if( data == 0 || fread(data,1,len,fp) != (size_t)len ) {
+		fclose(fp);
+		free(data);
+		cli_print_load(path,0,0,0,0);
+		return;
+	}
+	fclose(fp);
+	data[len] = '\n';
+	data[len+1] = 0;
+	//Lines end in \n, \r or both; the staging loop splits on either
+	for( c=data, i=0; *c; c++ ) {
+		if( *c == '\n' || *c == '\r' ) i++;
+	}
+	stage = malloc(i*sizeof(stage_t));
+	flags = malloc(VARSMAX);
+	backvars = malloc(sizeof(vars));
+	backnames = malloc(NAMESMAX);
+	backexprs = malloc(EXPRSMAX);
+	if( ! stage || ! flags || ! backvars || ! backnames || ! backexprs ) {
+		errors++;
+		goto done;
+	}
+	
+	//Stage
+	line = data;
+	for( c=data; *c; c++ ) {
+		if( *c != '\n' && *c != '\r' ) {
+			continue;
+		}
+		if( *c == '\n' ) {
+			lineno++;
+		}
+		*c = 0;
+		comment = strchr(line,'#');
+		if( comment ) {
+			*comment = 0;
+		}
+		txtpos = line;
+		ignore_blanks();
+		if( *txtpos != 0 && *txtpos != '?' ) {
+			cmd = reloadCommand(line);
+			if( cmd >= 0 ) {
+				if( reloadIsConfig(cmd) ) {
+					if( ncmds == RELOADCMDSMAX ) {
+						errors++;
+						cli_print_load_error(lineno,line,-1);
+					}
+					else {
+						reloadNormalize(line);
+						cmds[ncmds].line = line;
+						cmds[ncmds].lineno = lineno;
+						cmds[ncmds].cmd = cmd;
+						cmds[ncmds].keep = 0;
+						ncmds++;
+					}
+				}
+			}
+			else {
+				stage[nstage].line = line;
+				stage[nstage].lineno = lineno;
+				error = reloadStage(&stage[nstage]);
+				if( error ) {
+					errors++;
+					cli_print_load_error(lineno,line,error);
+				}
+				nstage++;
+			}
+		}
+		line = c+1;
+	}
+	if( errors ) {
+		goto done;
+	}
+	
+	//Apply the variables, keeping a copy to fall back to
+	while( count < VARSMAX && vars[count].value.type != VAL_NONE ) {
+		count++;
+	}
+	memcpy(backvars,vars,sizeof(vars));
+	memcpy(backnames,names,NAMESMAX);
+	memcpy(backexprs,exprs,EXPRSMAX);
+	memset(flags,0,VARSMAX);
+	for( i=0; i<nstage; i++ ) {
+		error = reloadApply(&stage[i],flags,&layout);
+		if( error ) {
+			errors++;
+			cli_print_load_error(stage[i].lineno,stage[i].line,error);
+		}
+	}
+	if( errors ) {
+		memcpy(vars,backvars,sizeof(vars));
+		memcpy(names,backnames,NAMESMAX);
+		memcpy(exprs,backexprs,EXPRSMAX);
+		varsVersion++;
+		goto done;
+	}
+	for( i=0; i<VARSMAX && vars[i].value.type != VAL_NONE; i++ ) {
+		if( ! (flags[i] & STAGE_SEEN) ) {
+			continue;
+		}
+		if( ! (flags[i] & STAGE_EXPR) && vars[i].expr ) {
+			set_expr(vars+i,0,0);
+			flags[i] |= STAGE_CHANGED;
+		}
+		if( ! (flags[i] & STAGE_PNT) && vars[i].pnttype != PNT_NONE ) {
+			vars[i].pnttype = PNT_NONE;
+			vars[i].pntunit = 0;
+			vars[i].pntenc = 0;
+			varsVersion++;
+			flags[i] |= STAGE_CHANGED;
+			layout = 1;
+		}
+		if( flags[i] & STAGE_ADDED ) {
+			added++;
+			if( vars[i].pnttype != PNT_NONE ) {
+				layout = 1;
+			}
+		}
+		else if( flags[i] & STAGE_CHANGED ) {
+			changed++;
+		}
+	}
+	//Variables without a line are removed unless an expression still
+	//names them; those stay as plain variables keeping their value.
+	//Removing a variable moves the ones after it.
+	reloadReferences(flags);
+	for( i=count; i>0; i-- ) {
+		if( flags[i-1] & STAGE_SEEN ) {
+			continue;
+		}
+		if( flags[i-1] & STAGE_REF ) {
+			if( vars[i-1].expr || vars[i-1].pnttype != PNT_NONE ) {
+				set_expr(vars+i-1,0,0);
+				if( vars[i-1].pnttype != PNT_NONE ) {
+					vars[i-1].pnttype = PNT_NONE;
+					vars[i-1].pntunit = 0;
+					vars[i-1].pntenc = 0;
+					varsVersion++;
+					layout = 1;
+				}
+				changed++;
+			}
+			continue;
+		}
+		del_var(vars+i-1);
+		removed++;
+		layout = 1;
+	}
+	
+	//Protocols: only lines that differ from the live configuration run.
+	//The IEC 61850 model and GOOSE data sets are built from the points,
+	//so they are rebuilt when the point layout moved.
+	cli_copy_config(config,RELOADCONFIG);
+	line = config;
+	for( c=config; *c && nold < RELOADCMDSMAX; c++ ) {
+		if( *c == '\n' ) {
+			*c = 0;
+			reloadNormalize(line);
+			if( *line ) {
+				oldkeep[nold] = 0;
+				old[nold++] = line;
+			}
+			line = c+1;
+		}
+	}
+	memset(executed,0,sizeof(executed));
+	for( i=0; i<ncmds; i++ ) {
+		for( j=0; j<nold; j++ ) {
+			if( ! oldkeep[j] && strcmp(old[j],cmds[i].line) == 0 ) {
+				oldkeep[j] = 1;
+				cmds[i].keep = ! (layout && reloadIsModel(cmds[i].cmd));
+				break;
+			}
+		}
+		if( ! cmds[i].keep ) {
+			executed[cmds[i].cmd] = 1;
+		}
+	}
+	for( j=0; j<nold; j++ ) {
+		cmd = reloadCommand(old[j]);
+		if( ! oldkeep[j] && cmd >= 0 && ! executed[cmd] ) {
+			reconfigured += reloadTeardown(cmd);
+		}
+	}
+	for( i=0; i<ncmds; i++ ) {
+		if( cmds[i].keep ) {
+			continue;
+		}
+		error = commandExecute(cmds[i].line);
+		if( error ) {
+			errors++;
+			cli_print_load_error(cmds[i].lineno,cmds[i].line,error);
+		}
+		if( cmds[i].cmd != CMD_RUN && cmds[i].cmd != CMD_STOP ) {
+			reconfigured++;
+		}
+	}
+	parse_error = 0;
+	cli_print_reload(path,1,added,changed,removed,reconfigured,errors,compatMillis()-start);
+	errors = 0;
+	
+	done:
+	if( errors ) {
+		parse_error = 0;
+		cli_print_reload(path,0,0,0,0,0,errors,0);
+	}
+	free(data);
+	free(stage);
+	free(flags);
+	free(backvars);
+	free(backnames);
+	free(backexprs);
+}
+#endif //ARDUINO
+
+void commandProcess() {
+	int error;
+	char* line;
+	#ifndef ARDUINO
+	char path[256];
+	if( cli_take_load(path) ) {
+		commandLoad(path);
+		cli_print_prompt();
+		return;
+	}
+	#endif //ARDUINO
+	
+	line = cli_readline();
+	if( line == 0 )
+		return;
+	
+	error = commandExecute(line);
+	if( error ) {
+		cli_print_interp_error(error);
+	}
+	cli_print_prompt();
+}
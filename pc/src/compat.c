@@ -42,6 +42,8 @@ unsigned char commode;
 #include <stdio.h>
 #include <ncurses.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -50,29 +52,199 @@ unsigned char commode;
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
 #include "cli.h"
 WINDOW* console;
 int comfd;
 int servfd;
-unsigned char readByte;
-unsigned char readByteValid;
+#define SCADAFRAMEMAX 1026
+
+//Headless mode: no curses, console commands come from clients of a Unix
+//domain socket (one command per line) and console output goes to the
+//client whose command produced it and to a buffered log.
+#define CTRLCLIENTSMAX 64
+#define CTRLLINEMAX    1024
+#define CONBUFSIZE     4096
+#define LOGFLUSHDELAY  1000
+static uint8_t headless;
+static char* ctrlpath;
+static int ctrlfd;
+static int ctrlclients[CTRLCLIENTSMAX];
+static char ctrlbuf[CTRLCLIENTSMAX][CTRLLINEMAX];
+static unsigned int ctrllen[CTRLCLIENTSMAX];
+static int ctrlcurrent;
+static unsigned int ctrlpos;
+static unsigned int ctrlend;
+static unsigned int ctrlnext;
+static char conbuf[CONBUFSIZE];
+static unsigned int conlen;
+static FILE* logfp;
+static unsigned int lastlogflush;
+static volatile sig_atomic_t stopping;
 #endif //LINUX
 
 #include "compat.h"
+#include "metrics.h"
+#include "record.h"
+#if defined(MODBUS) && defined(LINUX)
+#include "rtu.h"
+#endif
+
+unsigned long scada_baud = 9600;
+char scada_parity = 'N';
+uint8_t scada_stopbits = 1;
+uint8_t scada_rs485 = 0;
 
 static void linuxUsage(char* cmd) {
 	printf("Usage:\n");
-	printf("%s [-h] [[-s serial_device] | [-t tcp_port]] [-f script]\n",cmd);
+	printf("%s [-h] [[-s serial_device [-b baud] [-p format] [-r]] | [-t tcp_port]] [-f script] [-d socket [-l logfile]] [-m metrics_port]\n",cmd);
 	printf("\n");
 	printf("-s: Optionally specify serial port for SCADA communications\n");
+	printf("-b: Serial baud rate, up to 921600 (default 9600)\n");
+	printf("-p: Serial format 8N1, 8E1, 8O1, 8N2, 8E2 or 8O2 (default 8N1)\n");
+	printf("-r: Enable RS-485 direction control on the serial port\n");
 	printf("-t: Optionally specify TCP server port to use for SCADA communications\n");
 	printf("-f: Optionally specify script to run\n");
+	printf("-d: Run headless, reading console commands from this Unix socket\n");
+	printf("-l: Headless console log file (default stdout)\n");
+	printf("-m: Serve Prometheus metrics over HTTP on this TCP port\n");
 	printf("\n");
 	exit(1);
 }
 
+#ifdef LINUX
+static void linuxStop(int sig) {
+	stopping = 1;
+}
+
+static void ctrlBegin(char* path, char* cmd) {
+	struct sockaddr_un addr;
+	struct stat st;
+	unsigned int i;
+	if( strlen(path) >= sizeof(addr.sun_path) ) {
+		linuxUsage(cmd);
+	}
+	ctrlfd = socket(AF_UNIX,SOCK_STREAM,0);
+	if( ctrlfd < 0 ) {
+		printf("Failed to create control socket.\n");
+		exit(1);
+	}
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,path);
+	//Only a stale socket from an earlier run may be replaced
+	if( lstat(path,&st) == 0 && (! S_ISSOCK(st.st_mode) || unlink(path) != 0) ) {
+		printf("Control socket path is in use: %s\n",path);
+		exit(1);
+	}
+	if( bind(ctrlfd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(ctrlfd,CTRLCLIENTSMAX) < 0 ) {
+		printf("Failed to bind control socket: %s\n",path);
+		exit(1);
+	}
+	fcntl(ctrlfd,F_SETFL,O_NONBLOCK);
+	ctrlpath = path;
+	for( i=0; i<CTRLCLIENTSMAX; i++ ) {
+		ctrlclients[i] = -1;
+	}
+	ctrlcurrent = -1;
+	ctrlnext = 0;
+	signal(SIGPIPE,SIG_IGN);
+	signal(SIGTERM,linuxStop);
+	signal(SIGINT,linuxStop);
+}
+
+static void ctrlClose(unsigned int i) {
+	close(ctrlclients[i]);
+	ctrlclients[i] = -1;
+	ctrllen[i] = 0;
+	if( ctrlcurrent == (int)i ) {
+		ctrlcurrent = -1;
+	}
+}
+
+//Accept new clients and read whatever they have sent
+static void ctrlPoll() {
+	struct pollfd fds[CTRLCLIENTSMAX+1];
+	unsigned int idx[CTRLCLIENTSMAX+1];
+	unsigned int n = 0;
+	unsigned int i;
+	int fd;
+	ssize_t len;
+	
+	fds[n].fd = ctrlfd;
+	fds[n].events = POLLIN;
+	n++;
+	for( i=0; i<CTRLCLIENTSMAX; i++ ) {
+		if( ctrlclients[i] != -1 ) {
+			fds[n].fd = ctrlclients[i];
+			fds[n].events = POLLIN;
+			idx[n] = i;
+			n++;
+		}
+	}
+	if( poll(fds,n,0) <= 0 ) {
+		return;
+	}
+	for( i=1; i<n; i++ ) {
+		unsigned int c = idx[i];
+		if( ! fds[i].revents ) {
+			continue;
+		}
+		//A line that does not fit is thrown away
+		if( ctrllen[c] == CTRLLINEMAX ) {
+			ctrllen[c] = 0;
+		}
+		len = recv(ctrlclients[c],ctrlbuf[c]+ctrllen[c],CTRLLINEMAX-ctrllen[c],MSG_DONTWAIT);
+		if( len <= 0 ) {
+			if( len == 0 || (errno != EAGAIN && errno != EINTR) ) {
+				ctrlClose(c);
+			}
+			continue;
+		}
+		ctrllen[c] += len;
+	}
+	if( fds[0].revents ) {
+		while( (fd = accept(ctrlfd,0,0)) >= 0 ) {
+			for( i=0; i<CTRLCLIENTSMAX && ctrlclients[i] != -1; i++ );
+			if( i == CTRLCLIENTSMAX ) {
+				close(fd);
+				continue;
+			}
+			fcntl(fd,F_SETFL,O_NONBLOCK);
+			ctrlclients[i] = fd;
+			ctrllen[i] = 0;
+		}
+	}
+}
+
+//Pick the next client, round robin, that has a whole line waiting
+static int ctrlNextLine() {
+	unsigned int i;
+	unsigned int c;
+	char* nl;
+	for( i=0; i<CTRLCLIENTSMAX; i++ ) {
+		c = (ctrlnext+i)%CTRLCLIENTSMAX;
+		if( ctrlclients[c] == -1 || ctrllen[c] == 0 ) {
+			continue;
+		}
+		nl = memchr(ctrlbuf[c],'\n',ctrllen[c]);
+		if( nl ) {
+			ctrlcurrent = c;
+			ctrlpos = 0;
+			ctrlend = nl-ctrlbuf[c]+1;
+			ctrlnext = c+1;
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif //LINUX
+
 static void dosUsage(char* cmd) {
 	printf("Usage:\n");
 	printf("%s [-h] [-s 0|1|2] [-f script]\n",cmd);
@@ -115,27 +287,21 @@ void compatBegin(int argc, char** argv) {
 				printf("Failed to open serial device: %s\n",argv[1]);
 				exit(1);
 			}
-			//Configure as 9600 8,N,1 no flow control or special chars
-			cfsetispeed(&tty,B9600);
-			cfsetospeed(&tty,B9600);
-			tty.c_cflag &= ~CSIZE;
-			tty.c_cflag |= CS8;      //8 bits per byte
-			tty.c_cflag &= ~PARENB;  //No parity
-			tty.c_cflag &= ~CSTOPB;  //1 stop bit
-			tty.c_cflag &= ~CRTSCTS; //no flow control
-			tty.c_cflag |= CREAD|CLOCAL;
-			tty.c_lflag &= ~ICANON;
-			tty.c_lflag &= ~ECHO;
-			tty.c_lflag &= ~ISIG;
-			tty.c_iflag &= ~(IXON | IXOFF | IXANY);
-			tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL);
-			tty.c_oflag &= ~OPOST;
-			tty.c_oflag &= ~ONLCR;
-			if( tcsetattr(comfd,TCSANOW, &tty) != 0 ) {
-				printf("Failed to configure serial device: %s\n",argv[1]);
-				exit(1);
+		}
+		else if( strcmp(argv[i],"-b") == 0 ) {
+			if( i >= argc-1 ) {
+				linuxUsage(argv[0]);
+			}
+			scada_baud = strtoul(argv[++i],0,10);
+		}
+		else if( strcmp(argv[i],"-p") == 0 ) {
+			if( i >= argc-1 || scadaFormat(argv[++i],&scada_parity,&scada_stopbits) != 3 ) {
+				linuxUsage(argv[0]);
 			}
 		}
+		else if( strcmp(argv[i],"-r") == 0 ) {
+			scada_rs485 = 1;
+		}
 		else if( strcmp(argv[i],"-t") == 0 ) {
 			struct sockaddr_in addr;
 			if( i > argc-1 || servfd != -1 || comfd != -1 ) {
@@ -157,6 +323,7 @@ void compatBegin(int argc, char** argv) {
 				printf("Failed to listen to TCP server.\n");
 				exit(1);
 			}
+			fcntl(servfd,F_SETFL,O_NONBLOCK);
 		}
 		else if( strcmp(argv[i],"-f") ==0 ) {
 			if( i > argc-1 ) {
@@ -164,18 +331,61 @@ void compatBegin(int argc, char** argv) {
 			}
 			cli_start_load(argv[++i]);
 		}
+		else if( strcmp(argv[i],"-m") == 0 ) {
+			if( i >= argc-1 || metrics_port ) {
+				linuxUsage(argv[0]);
+			}
+			metrics_port = atoi(argv[++i]);
+			if( metrics_port == 0 || metricsServ() < 0 ) {
+				printf("Failed to bind metrics server to port: %s\n",argv[i]);
+				exit(1);
+			}
+		}
+		else if( strcmp(argv[i],"-d") == 0 ) {
+			if( i >= argc-1 || headless ) {
+				linuxUsage(argv[0]);
+			}
+			headless = 1;
+			ctrlBegin(argv[++i],argv[0]);
+		}
+		else if( strcmp(argv[i],"-l") == 0 ) {
+			if( i >= argc-1 || logfp ) {
+				linuxUsage(argv[0]);
+			}
+			logfp = fopen(argv[++i],"a");
+			if( logfp == 0 ) {
+				printf("Failed to open log file: %s\n",argv[i]);
+				exit(1);
+			}
+		}
 		else {
 			linuxUsage(argv[0]);
 		}
 		i++;
 	}
-	readByteValid = 0;
-	initscr();
-	cbreak();
-	noecho();
-	console = newwin(getmaxy(stdscr),getmaxx(stdscr),0,0);
-	nodelay(console,TRUE);
-	scrollok(console,TRUE);
+	if( servfd == -1 && comfd != -1 && scadaSerial(scada_baud,scada_parity,scada_stopbits,scada_rs485) != 0 ) {
+		printf("Failed to set serial device to %lu 8%c%u%s\n",scada_baud,
+			scada_parity,scada_stopbits,scada_rs485 ? " rs485" : "");
+		exit(1);
+	}
+	if( headless ) {
+		if( logfp == 0 ) {
+			logfp = stdout;
+		}
+		setvbuf(logfp,0,_IOFBF,65536);
+		lastlogflush = compatMillis();
+	}
+	else {
+		if( logfp ) {
+			linuxUsage(argv[0]);
+		}
+		initscr();
+		cbreak();
+		noecho();
+		console = newwin(getmaxy(stdscr),getmaxx(stdscr),0,0);
+		nodelay(console,TRUE);
+		scrollok(console,TRUE);
+	}
 	#endif //LINUX
 
 	#ifdef __DJGPP__
@@ -241,6 +451,25 @@ unsigned int compatMillis() {
 #endif
 }
 
+//Monotonic time for profiling
+unsigned long long compatNanos() {
+#ifdef ARDUINO
+	return (unsigned long long)micros()*1000;
+#endif //ARDUINO
+
+#ifdef LINUX
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC,&tv);
+	return (unsigned long long)tv.tv_sec*1000000000+tv.tv_nsec;
+#endif //LINUX
+
+#ifdef __DJGPP__
+	uclock_t t = uclock();
+	return (unsigned long long)(t/UCLOCKS_PER_SEC)*1000000000 +
+		(unsigned long long)(t%UCLOCKS_PER_SEC)*1000000000/UCLOCKS_PER_SEC;
+#endif
+}
+
 int compatRandom(int s, int e) {
 #ifdef ARDUINO
 	return random(s,e);
@@ -250,9 +479,27 @@ int compatRandom(int s, int e) {
 }
 
 void compatExit() {
+	recordStop();
+	#if defined(MODBUS) && defined(LINUX)
+	rtuReset();
+	#endif
 	#ifdef LINUX
-	delwin(console);
-	endwin();
+	if( headless ) {
+		unsigned int i;
+		consoleFlush();
+		for( i=0; i<CTRLCLIENTSMAX; i++ ) {
+			if( ctrlclients[i] != -1 ) {
+				ctrlClose(i);
+			}
+		}
+		close(ctrlfd);
+		unlink(ctrlpath);
+		fflush(logfp);
+	}
+	else {
+		delwin(console);
+		endwin();
+	}
 	if( comfd != -1 ) {
 		close(comfd);
 	}
@@ -266,118 +513,206 @@ void compatExit() {
 	exit(0);
 }
 
-int scadaAvailable() {
-	#ifdef ARDUINO
-		#ifdef MINI
-		return Serial.available();
-		#else
-		return Serial2.available();
-		#endif //MINI
-	#endif //ARDUINO
-	
+//Baud rate of the SCADA serial line, 0 when the channel is not a serial
+//line (Modbus RTU over TCP) and so has no character timing
+unsigned long scadaBaud() {
 	#ifdef LINUX
-	fd_set rfds;
-	struct timeval timeout;
 	if( servfd != -1 ) {
-		//TCP SCADA channel
-		if( comfd == -1 ) {
-			//SCADA channel is not yet connected, try 
-			//to accept a connection
-			FD_ZERO(&rfds);
-			FD_SET(servfd,&rfds);
-			timeout.tv_sec = 0;
-			timeout.tv_usec = 0;
-			if( select( servfd+1, &rfds, 0, 0, &timeout ) ) {
-				comfd = accept(servfd,0,0);
-			}
-		}
-		if( comfd != -1 ) {
-			//SCADA channel is connected
-			FD_ZERO(&rfds);
-			FD_SET(comfd,&rfds);
-			timeout.tv_sec = 0;
-			timeout.tv_usec = 0;
-			if( select(comfd+1, &rfds, 0, 0, &timeout ) ) {
-				return 1;
-			} else {
-				return 0;
-			}
+		return 0;
+	}
+	#endif //LINUX
+	return scada_baud;
+}
+
+//Parse a serial format such as 8N1 (Modbus RTU is always 8 data bits),
+//returns the number of characters used or 0 if it is not one
+int scadaFormat(const char* s, char* parity, uint8_t* stopbits) {
+	char p = s[1];
+	if( p >= 'a' && p <= 'z' ) {
+		p = p-'a'+'A';
+	}
+	if( s[0] != '8' || (p != 'N' && p != 'E' && p != 'O') || (s[2] != '1' && s[2] != '2') ) {
+		return 0;
+	}
+	*parity = p;
+	*stopbits = s[2]-'0';
+	return 3;
+}
+
+#ifdef LINUX
+static speed_t linuxSpeed(unsigned long baud) {
+	switch( baud ) {
+		case 1200:   return B1200;
+		case 2400:   return B2400;
+		case 4800:   return B4800;
+		case 9600:   return B9600;
+		case 19200:  return B19200;
+		case 38400:  return B38400;
+		case 57600:  return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 576000: return B576000;
+		case 921600: return B921600;
+	}
+	return B0;
+}
+
+//Raw 8 bit mode with the given speed and framing on a serial line (or
+//pty), returns 0 on success
+int compatSerial(int fd, unsigned long baud, char parity, uint8_t stopbits, uint8_t rs485) {
+	struct termios tty;
+	struct serial_rs485 rs;
+	speed_t speed = linuxSpeed(baud);
+	if( speed == B0 || tcgetattr(fd,&tty) != 0 ) {
+		return -1;
+	}
+	//No flow control or special chars
+	tty.c_cflag &= ~CRTSCTS;
+	tty.c_cflag |= CREAD|CLOCAL;
+	tty.c_lflag &= ~(ICANON|ECHO|ISIG);
+	tty.c_iflag &= ~(IXON|IXOFF|IXANY);
+	tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL);
+	tty.c_oflag &= ~(OPOST|ONLCR);
+	cfsetispeed(&tty,speed);
+	cfsetospeed(&tty,speed);
+	tty.c_cflag &= ~(CSIZE|PARENB|PARODD|CSTOPB);
+	tty.c_cflag |= CS8;
+	if( parity != 'N' ) {
+		tty.c_cflag |= PARENB;
+	}
+	if( parity == 'O' ) {
+		tty.c_cflag |= PARODD;
+	}
+	if( stopbits == 2 ) {
+		tty.c_cflag |= CSTOPB;
+	}
+	if( tcsetattr(fd,TCSANOW,&tty) != 0 ) {
+		return -1;
+	}
+	//RTS drives the transceiver's driver enable while sending
+	if( ioctl(fd,TIOCGRS485,&rs) == 0 ) {
+		if( rs485 ) {
+			rs.flags |= SER_RS485_ENABLED|SER_RS485_RTS_ON_SEND;
+			rs.flags &= ~SER_RS485_RTS_AFTER_SEND;
 		} else {
-			return 0;
+			rs.flags &= ~SER_RS485_ENABLED;
 		}
-	} else if( comfd != 1 ) {
-		//COM SCADA channel
-		if( readByteValid ) {
-			return 1;
-		} else if( 1 == read(comfd,&readByte,1) ) {
-			readByteValid = 1;
-			return 1;
-		} else {
-			return 0;
+		if( ioctl(fd,TIOCSRS485,&rs) != 0 ) {
+			return -1;
 		}
+	}
+	else if( rs485 ) {
+		return -1;
+	}
+	return 0;
+}
+#endif //LINUX
+
+//Set the speed and framing of the SCADA serial line, returns 0 on success.
+//Without a serial line (Modbus RTU over TCP) the settings are only kept.
+int scadaSerial(unsigned long baud, char parity, uint8_t stopbits, uint8_t rs485) {
+	#ifdef ARDUINO
+	unsigned int config;
+	if( rs485 ) {
+		return -1;
+	}
+	if( parity == 'E' ) {
+		config = stopbits == 2 ? SERIAL_8E2 : SERIAL_8E1;
+	} else if( parity == 'O' ) {
+		config = stopbits == 2 ? SERIAL_8O2 : SERIAL_8O1;
 	} else {
-		//No SCADA channel
-		return 0;
+		config = stopbits == 2 ? SERIAL_8N2 : SERIAL_8N1;
+	}
+	#ifdef MINI
+	Serial.end();
+	Serial.begin(baud,config);
+	#else
+	Serial2.end();
+	Serial2.begin(baud,config);
+	#endif //MINI
+	#endif //ARDUINO
+	
+	#ifdef LINUX
+	if( linuxSpeed(baud) == B0 ) {
+		return -1;
+	}
+	if( servfd == -1 && comfd != -1 && compatSerial(comfd,baud,parity,stopbits,rs485) != 0 ) {
+		return -1;
 	}
 	#endif //LINUX
 	
 	#ifdef __DJGPP__
-		if( commode == COMMODE_DUAL )
-			return serial_get_rx_buffered(COM_2);
-		else if( commode == COMMODE_SINGLE )
-			return serial_get_rx_buffered(COM_1);
-		else
-			return 0;
+	if( rs485 || baud > 115200 ) {
+		return -1;
+	}
+	if( commode != COMMODE_NONE ) {
+		serial_close(commode == COMMODE_DUAL ? COM_2 : COM_1);
+		serial_open(commode == COMMODE_DUAL ? COM_2 : COM_1,baud,8,parity-'A'+'a',stopbits,SER_HANDSHAKING_NONE);
+	}
 	#endif //__DJGPP__
+	
+	scada_baud = baud;
+	scada_parity = parity;
+	scada_stopbits = stopbits;
+	scada_rs485 = rs485;
+	return 0;
 }
 
-int scadaReadByte() {
+//Read whatever the SCADA channel has buffered (up to max bytes) without
+//blocking, returns the number of bytes read
+int scadaRead(uint8_t* buf, unsigned int max) {
 	#ifdef ARDUINO
+	unsigned int n = 0;
 	#ifdef MINI
-		return Serial.read();
+	while( n < max && Serial.available() ) {
+		buf[n++] = Serial.read();
+	}
 	#else
-		return Serial2.read();
+	while( n < max && Serial2.available() ) {
+		buf[n++] = Serial2.read();
+	}
 	#endif //MINI
+	return n;
 	#endif //ARDUINO
 	
 	#ifdef LINUX
-	if( servfd != -1 ) {
-		//TCP SCADA channel
-		if( scadaAvailable() ) {
-			if( 1 == recv( comfd, &readByte, 1, 0 ) ) {
-				readByteValid = 1;
-			}
-		}
-	} else if( comfd != -1 ) {
-		//COM SCADA channel
-		if( ! readByteValid ) {
-			if( 1 == read(comfd,&readByte,1) ) {
-				readByteValid = 1;
-			}
+	int n;
+	int one = 1;
+	if( servfd != -1 && comfd == -1 ) {
+		//TCP SCADA channel is not yet connected, try to accept a connection
+		comfd = accept(servfd,0,0);
+		if( comfd == -1 ) {
+			return 0;
 		}
-	} else {
+		fcntl(comfd,F_SETFL,O_NONBLOCK);
+		setsockopt(comfd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+	}
+	if( comfd == -1 ) {
 		//No SCADA channel
-		readByteValid = 0;
+		return 0;
 	}
-
-	//Return a valid byte if not exists
-	if( readByteValid ) {
-		readByteValid = 0;
-		return readByte;
-	} else {
-		return -1;
+	n = read(comfd,buf,max);
+	if( n > 0 ) {
+		return n;
 	}
+	if( n == 0 && servfd != -1 ) {
+		//TCP client went away, wait for the next one
+		close(comfd);
+		comfd = -1;
+	}
+	return 0;
 	#endif //LINUX
-
+	
 	#ifdef __DJGPP__
-	char tmp;
-	if( commode == COMMODE_DUAL  && serial_read(COM_2,&tmp,1) ) {
-		return (int)tmp;
-	} else if( commode == COMMODE_SINGLE && serial_read(COM_1,&tmp,1) ) {
-		return (int)tmp;
-	} else {
-		return -1;
+	int n = 0;
+	if( commode == COMMODE_DUAL ) {
+		n = serial_read(COM_2,(char*)buf,max);
+	} else if( commode == COMMODE_SINGLE ) {
+		n = serial_read(COM_1,(char*)buf,max);
 	}
+	return n > 0 ? n : 0;
 	#endif //__DJGPP__
 }
 
@@ -398,8 +733,25 @@ int scadaWriteMsgWithCRC(uint8_t *msg, uint16_t msg_len, uint16_t crc) {
 		//#if __BYTE_ORDER == __BIG_ENDIAN
 		//crc = ((crc&0x00FF)<<8) | ((crc&0xFF00)>>8)
 		//#endif
-	while( (-1 == write(comfd,msg,msg_len)) && (errno == EAGAIN) );
-	while( (-1 == write(comfd,&crc,2)) && (errno == EAGAIN) );
+	//One write per frame, so a serial line sees no gap before the CRC and
+	//TCP sends the frame in a single segment
+	uint8_t frame[SCADAFRAMEMAX];
+	unsigned int sent = 0;
+	int n;
+	if( comfd == -1 || msg_len+2 > SCADAFRAMEMAX ) {
+		return 0;
+	}
+	memcpy(frame,msg,msg_len);
+	frame[msg_len] = crc&0xFF;
+	frame[msg_len+1] = (crc>>8)&0xFF;
+	while( sent < msg_len+2u ) {
+		n = write(comfd,frame+sent,msg_len+2-sent);
+		if( n > 0 ) {
+			sent += n;
+		} else if( n == -1 && errno != EAGAIN ) {
+			break;
+		}
+	}
 	#endif //LINUX
 	
 	#ifdef __DJGPP__
@@ -418,7 +770,13 @@ int scadaWriteMsgWithCRC(uint8_t *msg, uint16_t msg_len, uint16_t crc) {
 
 void consoleOut(char c) {
 	#ifdef LINUX
-	if( c == 0x7F ) {
+	if( headless ) {
+		conbuf[conlen++] = c;
+		if( conlen == CONBUFSIZE ) {
+			consoleFlush();
+		}
+	}
+	else if( c == 0x7F ) {
 		if( getcurx(console) != 1 ) {
 			wmove(console,getcury(console),getcurx(console)-1);
 			wdelch(console);
@@ -427,7 +785,6 @@ void consoleOut(char c) {
 	else {
 		waddch(console,c);
 	}
-	wrefresh(console);
 	#endif //LINUX
 	
 	#ifdef __DJGPP__
@@ -456,8 +813,67 @@ void consoleOut(char c) {
 	#endif //__DJGPP__
 }
 
+//Typed characters echoed back by the line editor.  Control socket
+//clients already have their own line, so it only goes to the log.
+void consoleEcho(char c) {
+	#ifdef LINUX
+	if( headless ) {
+		if( c != 0x7F ) {
+			putc(c == '\r' ? '\n' : c,logfp);
+		}
+		return;
+	}
+	#endif //LINUX
+	consoleOut(c);
+}
+
+//Console output is only pushed to the terminal once per line/prompt
+void consoleFlush() {
+	#ifdef LINUX
+	if( headless ) {
+		unsigned int millis;
+		if( conlen ) {
+			fwrite(conbuf,1,conlen,logfp);
+			//A client that is not reading loses output rather than
+			//stalling the simulation
+			if( ctrlcurrent != -1 ) {
+				send(ctrlclients[ctrlcurrent],conbuf,conlen,MSG_DONTWAIT|MSG_NOSIGNAL);
+			}
+			conlen = 0;
+		}
+		millis = compatMillis();
+		if( millis-lastlogflush >= LOGFLUSHDELAY ) {
+			fflush(logfp);
+			lastlogflush = millis;
+		}
+		return;
+	}
+	wrefresh(console);
+	#endif //LINUX
+}
+
 int consoleIn() {
 	#ifdef LINUX
+	if( headless ) {
+		if( stopping ) {
+			compatExit();
+		}
+		if( ctrlcurrent != -1 ) {
+			if( ctrlpos < ctrlend ) {
+				return ctrlbuf[ctrlcurrent][ctrlpos++];
+			}
+			//The previous line has been executed
+			memmove(ctrlbuf[ctrlcurrent],ctrlbuf[ctrlcurrent]+ctrlend,ctrllen[ctrlcurrent]-ctrlend);
+			ctrllen[ctrlcurrent] -= ctrlend;
+			ctrlcurrent = -1;
+		}
+		ctrlPoll();
+		if( ctrlNextLine() ) {
+			return ctrlbuf[ctrlcurrent][ctrlpos++];
+		}
+		consoleFlush();
+		return -1;
+	}
 	return wgetch(console);
 	#endif //LINUX
 	
@@ -475,20 +891,36 @@ int consoleIn() {
 	#endif //__DJGPP
 }
 
-void displayOut(char c) {
+void displayWrite(const char* data, unsigned int len) {
 	#ifdef LINUX
-	int outc;
-	if( c == '\n') {
-		outc = 0x0d0a;
-		fwrite(&outc,1,2,stdout);
-	} else {
-		fwrite(&c,1,1,stdout);
+	unsigned int i;
+	unsigned int start = 0;
+	int outc = 0x0d0a;
+	if( headless ) {
+		return;
+	}
+	for( i=0; i<len; i++ ) {
+		if( data[i] == '\n' ) {
+			fwrite(data+start,1,i-start,stdout);
+			fwrite(&outc,1,2,stdout);
+			start = i+1;
+		}
 	}
+	fwrite(data+start,1,len-start,stdout);
+	#endif //LINUX
+
+	#ifdef __DJGPP__
+	fwrite(data,1,len,stdout);
+	#endif //__DJGPP__
+}
+
+//The display is pushed out once per frame
+void displayFlush() {
+	#ifdef LINUX
 	fflush(stdout);
-	//waddch(console,c);
 	#endif //LINUX
 
 	#ifdef __DJGPP__
-	putchar(c);
+	fflush(stdout);
 	#endif //__DJGPP__
 }
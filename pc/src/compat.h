@@ -31,15 +31,29 @@
 
 void compatBegin(int argc, char** argv);
 unsigned int compatMillis();
+unsigned long long compatNanos();
 int compatRandom();
 void compatExit();
 
-int scadaAvailable();
-int scadaReadByte();
+extern unsigned long scada_baud;
+extern char scada_parity;
+extern uint8_t scada_stopbits;
+extern uint8_t scada_rs485;
+
+unsigned long scadaBaud();
+int scadaFormat(const char* s, char* parity, uint8_t* stopbits);
+int scadaSerial(unsigned long baud, char parity, uint8_t stopbits, uint8_t rs485);
+#ifdef LINUX
+int compatSerial(int fd, unsigned long baud, char parity, uint8_t stopbits, uint8_t rs485);
+#endif //LINUX
+int scadaRead(uint8_t* buf, unsigned int max);
 int scadaWriteMsgWithCRC(uint8_t *msg, uint16_t msg_len, uint16_t crc);
 
 void consoleOut(char c);
+void consoleEcho(char c);
+void consoleFlush();
 int consoleAvailable();
 int consoleIn();
 
-void displayOut(char c);
+void displayWrite(const char* data, unsigned int len);
+void displayFlush();
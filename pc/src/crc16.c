@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "crc16.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC16CLMUL
+#include <immintrin.h>
+#endif
+
+static const uint16_t CRC16TABLE[256] = {
+	0x0000,0xC0C1,0xC181,0x0140,0xC301,0x03C0,0x0280,0xC241,
+	0xC601,0x06C0,0x0780,0xC741,0x0500,0xC5C1,0xC481,0x0440,
+	0xCC01,0x0CC0,0x0D80,0xCD41,0x0F00,0xCFC1,0xCE81,0x0E40,
+	0x0A00,0xCAC1,0xCB81,0x0B40,0xC901,0x09C0,0x0880,0xC841,
+	0xD801,0x18C0,0x1980,0xD941,0x1B00,0xDBC1,0xDA81,0x1A40,
+	0x1E00,0xDEC1,0xDF81,0x1F40,0xDD01,0x1DC0,0x1C80,0xDC41,
+	0x1400,0xD4C1,0xD581,0x1540,0xD701,0x17C0,0x1680,0xD641,
+	0xD201,0x12C0,0x1380,0xD341,0x1100,0xD1C1,0xD081,0x1040,
+	0xF001,0x30C0,0x3180,0xF141,0x3300,0xF3C1,0xF281,0x3240,
+	0x3600,0xF6C1,0xF781,0x3740,0xF501,0x35C0,0x3480,0xF441,
+	0x3C00,0xFCC1,0xFD81,0x3D40,0xFF01,0x3FC0,0x3E80,0xFE41,
+	0xFA01,0x3AC0,0x3B80,0xFB41,0x3900,0xF9C1,0xF881,0x3840,
+	0x2800,0xE8C1,0xE981,0x2940,0xEB01,0x2BC0,0x2A80,0xEA41,
+	0xEE01,0x2EC0,0x2F80,0xEF41,0x2D00,0xEDC1,0xEC81,0x2C40,
+	0xE401,0x24C0,0x2580,0xE541,0x2700,0xE7C1,0xE681,0x2640,
+	0x2200,0xE2C1,0xE381,0x2340,0xE101,0x21C0,0x2080,0xE041,
+	0xA001,0x60C0,0x6180,0xA141,0x6300,0xA3C1,0xA281,0x6240,
+	0x6600,0xA6C1,0xA781,0x6740,0xA501,0x65C0,0x6480,0xA441,
+	0x6C00,0xACC1,0xAD81,0x6D40,0xAF01,0x6FC0,0x6E80,0xAE41,
+	0xAA01,0x6AC0,0x6B80,0xAB41,0x6900,0xA9C1,0xA881,0x6840,
+	0x7800,0xB8C1,0xB981,0x7940,0xBB01,0x7BC0,0x7A80,0xBA41,
+	0xBE01,0x7EC0,0x7F80,0xBF41,0x7D00,0xBDC1,0xBC81,0x7C40,
+	0xB401,0x74C0,0x7580,0xB541,0x7700,0xB7C1,0xB681,0x7640,
+	0x7200,0xB2C1,0xB381,0x7340,0xB101,0x71C0,0x7080,0xB041,
+	0x5000,0x90C1,0x9181,0x5140,0x9301,0x53C0,0x5280,0x9241,
+	0x9601,0x56C0,0x5780,0x9741,0x5500,0x95C1,0x9481,0x5440,
+	0x9C01,0x5CC0,0x5D80,0x9D41,0x5F00,0x9FC1,0x9E81,0x5E40,
+	0x5A00,0x9AC1,0x9B81,0x5B40,0x9901,0x59C0,0x5880,0x9841,
+	0x8801,0x48C0,0x4980,0x8941,0x4B00,0x8BC1,0x8A81,0x4A40,
+	0x4E00,0x8EC1,0x8F81,0x4F40,0x8D01,0x4DC0,0x4C80,0x8C41,
+	0x4400,0x84C1,0x8581,0x4540,0x8701,0x47C0,0x4680,0x8641,
+	0x8201,0x42C0,0x4380,0x8341,0x4100,0x81C1,0x8081,0x4040,
+};
+
+//crc16Slice8 tables: slices[k][i] is the CRC of byte i followed by k zero
+//bytes, slices[0] being CRC16TABLE
+static uint16_t slices[8][256];
+static uint8_t slices_built;
+
+static uint16_t crc16Select(uint16_t crc, const uint8_t* msg, unsigned int len);
+static uint16_t (*crc16_impl)(uint16_t crc, const uint8_t* msg, unsigned int len) = crc16Select;
+
+uint16_t crc16Table(uint16_t crc, const uint8_t* msg, unsigned int len) {
+	unsigned int i;
+	for( i=0; i<len; i++ ) {
+		crc = (crc>>8) ^ CRC16TABLE[(crc^msg[i]) & 0xFF];
+	}
+	return crc;
+}
+
+static void crc16Slices() {
+	unsigned int i;
+	unsigned int k;
+	for( i=0; i<256; i++ ) {
+		slices[0][i] = CRC16TABLE[i];
+	}
+	for( k=1; k<8; k++ ) {
+		for( i=0; i<256; i++ ) {
+			slices[k][i] = (slices[k-1][i]>>8) ^ CRC16TABLE[slices[k-1][i] & 0xFF];
+		}
+	}
+	slices_built = 1;
+}
+
+//Eight bytes per step: the CRC is folded into the first two and each
+//byte is looked up in the table for the number of bytes that follow it
+uint16_t crc16Slice8(uint16_t crc, const uint8_t* msg, unsigned int len) {
+	if( !slices_built ) {
+		crc16Slices();
+	}
+	while( len >= 8 ) {
+		crc ^= msg[0] | (msg[1]<<8);
+		crc = slices[7][crc&0xFF] ^ slices[6][crc>>8] ^
+			slices[5][msg[2]] ^ slices[4][msg[3]] ^
+			slices[3][msg[4]] ^ slices[2][msg[5]] ^
+			slices[1][msg[6]] ^ slices[0][msg[7]];
+		msg += 8;
+		len -= 8;
+	}
+	return crc16Table(crc,msg,len);
+}
+
+#ifdef CRC16CLMUL
+//Carry-less multiply folding in the reflected domain, where 16 message
+//bytes loaded little endian are the bit reversed polynomial and a
+//product of two reversed 64 bit halves comes out reversed and shifted
+//by one, hence the x^(n-1) constants:
+//  fold 16 bytes:  lo*rev(x^191 mod P) ^ hi*rev(x^127 mod P) ^ next
+//  128 to 64 bits: twice lo*rev(x^63 mod P) ^ hi
+//  64 to 16 bits:  Barrett, q = r ^ (r*rev(x^80/P - x^64)) << 1 and
+//                  crc = ((q>>48)*rev(P - x^16)) >> 15
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc16ClmulFold(uint16_t crc, const uint8_t* msg, unsigned int len) {
+	const __m128i kfold = _mm_set_epi64x((long long)0xC100000000000000ULL,(long long)0xCCD0000000000000ULL);
+	const __m128i k64 = _mm_set_epi64x(0,(long long)0xD101000000000000ULL);
+	const __m128i kbarrett = _mm_set_epi64x(0xA001,(long long)0xF87FF5FFE7FFDFFFULL);
+	__m128i x;
+	uint64_t r;
+	uint64_t t;
+	x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)msg),_mm_cvtsi32_si128(crc));
+	msg += 16;
+	len -= 16;
+	while( len >= 16 ) {
+		x = _mm_xor_si128(
+			_mm_xor_si128(_mm_clmulepi64_si128(x,kfold,0x00),_mm_clmulepi64_si128(x,kfold,0x11)),
+			_mm_loadu_si128((const __m128i*)msg));
+		msg += 16;
+		len -= 16;
+	}
+	x = _mm_xor_si128(_mm_clmulepi64_si128(x,k64,0x00),_mm_slli_si128(_mm_srli_si128(x,8),8));
+	x = _mm_xor_si128(_mm_clmulepi64_si128(x,k64,0x00),_mm_slli_si128(_mm_srli_si128(x,8),8));
+	r = (uint64_t)_mm_cvtsi128_si64(_mm_srli_si128(x,8));
+	t = (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128((long long)r),kbarrett,0x00));
+	r ^= t<<1;
+	t = (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128((long long)(r>>48)),kbarrett,0x10));
+	return crc16Slice8((uint16_t)(t>>15),msg,len);
+}
+#endif
+
+int crc16ClmulSupported() {
+	#ifdef CRC16CLMUL
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul");
+	#else
+	return 0;
+	#endif
+}
+
+//Falls back to crc16Slice8 for short messages and where PCLMULQDQ is not
+//available
+uint16_t crc16Clmul(uint16_t crc, const uint8_t* msg, unsigned int len) {
+	#ifdef CRC16CLMUL
+	static int supported = -1;
+	if( supported < 0 ) {
+		supported = crc16ClmulSupported();
+	}
+	if( supported && len >= 16 ) {
+		return crc16ClmulFold(crc,msg,len);
+	}
+	#endif
+	return crc16Slice8(crc,msg,len);
+}
+
+//First call: choose the implementation for the rest of the run
+static uint16_t crc16Select(uint16_t crc, const uint8_t* msg, unsigned int len) {
+	crc16Slices();
+	crc16_impl = crc16ClmulSupported() ? crc16Clmul : crc16Slice8;
+	return crc16_impl(crc,msg,len);
+}
+
+uint16_t crc16(const uint8_t* msg, unsigned int len) {
+	return crc16_impl(0xFFFF,msg,len);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CRC16_H__
+#define __CRC16_H__
+
+#include <stdint.h>
+
+//Modbus RTU CRC (polynomial 0xA001 reflected, initial value 0xFFFF).
+//The low byte is sent first.  Uses whichever implementation below
+//measured fastest for Modbus frame sizes.
+uint16_t crc16(const uint8_t* msg, unsigned int len);
+
+//The implementations, each continuing crc (0xFFFF to start) over len
+//more bytes.  None keeps state between calls.
+uint16_t crc16Table(uint16_t crc, const uint8_t* msg, unsigned int len);
+uint16_t crc16Slice8(uint16_t crc, const uint8_t* msg, unsigned int len);
+uint16_t crc16Clmul(uint16_t crc, const uint8_t* msg, unsigned int len);
+int crc16ClmulSupported();
+
+#endif //__CRC16_H__
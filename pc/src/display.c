@@ -30,31 +30,372 @@
 #include "cli.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+//The template is compiled once by displayLoad() into static text runs
+//separated by value slots.  Each slot remembers where its value lands on
+//screen (when the template only uses cursor movements we understand),
+//so a frame only has to send the slots whose values changed.
+
+#define GFXSLOTSSTEP 256
+#define GFXATTRMAX  32
+#define GFXVALMAX   10
+#define GFXOUTSIZE  16384
+
+typedef struct {
+	char* text;               //static text preceding the value
+	unsigned int len;
+	char* name;               //candidate variable name before the ':'
+	unsigned int namelen;
+	unsigned char width;      //spaces after the ':' replaced by the value
+	unsigned short row;       //screen position of the value (1 based)
+	unsigned short col;
+	char attr[GFXATTRMAX];    //SGR sequence in effect at the value
+	var_t* var;
+	val_t last;
+	uint8_t dirty;
+	uint8_t wide;             //value drawn did not fit the spaces
+} gfxslot_t;
+
 static char gfxdata[GFXSIZE+1];
 char gfxpath[256];
-static char gfxval[10];
+unsigned int display_delay;
 static unsigned int last_display_millis;
 static uint8_t gfxrun;
 
+static gfxslot_t* gfxslots;      //grown by GFXSLOTSSTEP as templates need
+static unsigned int gfxslotsmax;
+static unsigned int gfxnslots;
+static char* gfxtail;
+static unsigned int gfxtaillen;
+static uint8_t gfxtracked;        //cursor positions are known for every slot
+static uint8_t gfxslotstracked;   //...and every bound slot has a fixed width
+static unsigned short gfxendrow;
+static unsigned short gfxendcol;
+static char gfxendattr[GFXATTRMAX];
+static unsigned int gfxversion;
+static uint8_t gfxfull;
+
+static char gfxout[GFXOUTSIZE];
+static unsigned int gfxoutlen;
+
+static void gfxFlushOut() {
+	displayWrite(gfxout,gfxoutlen);
+	gfxoutlen = 0;
+}
+
+static void gfxPut(const char* data, unsigned int len) {
+	while( len ) {
+		unsigned int n = GFXOUTSIZE-gfxoutlen;
+		if( n > len ) {
+			n = len;
+		}
+		memcpy(gfxout+gfxoutlen,data,n);
+		gfxoutlen += n;
+		data += n;
+		len -= n;
+		if( gfxoutlen == GFXOUTSIZE ) {
+			gfxFlushOut();
+		}
+	}
+}
+
+static void gfxPuts(const char* str) {
+	gfxPut(str,strlen(str));
+}
+
+static int isNameChar(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static int isUtf8(char* data) {
+	unsigned char* c = (unsigned char*)data;
+	unsigned int follow;
+	while( *c ) {
+		if( *c < 0x80 ) { c++; continue; }
+		else if( (*c & 0xE0) == 0xC0 ) { follow = 1; }
+		else if( (*c & 0xF0) == 0xE0 ) { follow = 2; }
+		else if( (*c & 0xF8) == 0xF0 ) { follow = 3; }
+		else { return 0; }
+		c++;
+		while( follow-- ) {
+			if( (*c & 0xC0) != 0x80 ) {
+				return 0;
+			}
+			c++;
+		}
+	}
+	return 1;
+}
+
+//Apply an SGR sequence to the tracked attribute string
+static void gfxAttr(char* attr, char* seq, unsigned int len) {
+	unsigned int alen = strlen(attr);
+	//"ESC[m" and "ESC[0m" reset, "ESC[0;..m" resets and sets
+	if( len == 3 || (len >= 4 && seq[2] == '0' && (seq[3] == 'm' || seq[3] == ';')) ) {
+		alen = 0;
+	}
+	if( alen+len >= GFXATTRMAX ) {
+		alen = 0;
+		if( len >= GFXATTRMAX ) {
+			attr[0] = 0;
+			return;
+		}
+	}
+	memcpy(attr+alen,seq,len);
+	attr[alen+len] = 0;
+}
+
+//Returns -1 if there is no memory for the template's slots
+static int displayCompile() {
+	char* n = gfxdata;
+	char* run = gfxdata;
+	char* p;
+	char* seq;
+	gfxslot_t* slot;
+	unsigned int row = 1;
+	unsigned int col = 1;
+	unsigned int saverow = 1;
+	unsigned int savecol = 1;
+	unsigned int params[2];
+	unsigned int nparams;
+	char attr[GFXATTRMAX];
+	int utf8 = isUtf8(gfxdata);
+	
+	gfxnslots = 0;
+	gfxtracked = 1;
+	attr[0] = 0;
+	
+	while( *n != 0 ) {
+		if( *n == ':' ) {
+			p = n-1;
+			while( (p > gfxdata) && isNameChar(*p) )
+				p--;
+			p++;
+			while( (*p >= '0' && *p <= '9') )
+				p++;
+			if( p < n ) {
+				if( gfxnslots == gfxslotsmax ) {
+					slot = realloc(gfxslots,(gfxslotsmax+GFXSLOTSSTEP)*sizeof(gfxslot_t));
+					if( slot == 0 ) {
+						gfxnslots = 0;
+						return -1;
+					}
+					gfxslots = slot;
+					gfxslotsmax += GFXSLOTSSTEP;
+				}
+				slot = &gfxslots[gfxnslots++];
+				slot->text = run;
+				slot->len = n+1-run;
+				slot->name = p;
+				slot->namelen = n-p;
+				slot->width = 0;
+				n++;
+				col++;
+				while( *n == ' ' && slot->width < 255 ) {
+					slot->width++;
+					n++;
+				}
+				slot->row = row;
+				slot->col = col;
+				strcpy(slot->attr,attr);
+				col += slot->width;
+				run = n;
+				continue;
+			}
+		}
+		if( *n == 0x1b ) {
+			//Only CSI sequences with known cursor effects keep tracking
+			seq = n++;
+			if( *n != '[' ) {
+				gfxtracked = 0;
+				continue;
+			}
+			n++;
+			nparams = 0;
+			params[0] = 0;
+			params[1] = 0;
+			while( (*n >= '0' && *n <= '9') || *n == ';' || *n == '?' ) {
+				if( *n == ';' ) {
+					nparams++;
+				}
+				else if( *n != '?' && nparams < 2 ) {
+					params[nparams] = params[nparams]*10 + (*n-'0');
+				}
+				n++;
+			}
+			if( *n == 0 ) {
+				break;
+			}
+			switch( *n ) {
+				case 'm': gfxAttr(attr,seq,n+1-seq); break;
+				case 'A': row = (row > (params[0]?params[0]:1)) ? row-(params[0]?params[0]:1) : 1; break;
+				case 'B': row += params[0] ? params[0] : 1; break;
+				case 'C': col += params[0] ? params[0] : 1; break;
+				case 'D': col = (col > (params[0]?params[0]:1)) ? col-(params[0]?params[0]:1) : 1; break;
+				case 'H':
+				case 'f':
+					row = params[0] ? params[0] : 1;
+					col = params[1] ? params[1] : 1;
+					break;
+				case 's': saverow = row; savecol = col; break;
+				case 'u': row = saverow; col = savecol; break;
+				case 'J':
+				case 'K':
+				case 'h':
+				case 'l':
+					break;
+				default:
+					gfxtracked = 0;
+			}
+			n++;
+			continue;
+		}
+		if( *n == '\n' ) {
+			row++;
+			col = 1;
+		}
+		else if( *n == '\r' ) {
+			col = 1;
+		}
+		else if( *n == '\t' ) {
+			col = ((col-1)/8+1)*8+1;
+		}
+		else if( *n == 0x08 ) {
+			if( col > 1 ) col--;
+		}
+		else if( (unsigned char)*n >= 0x20 && ! (utf8 && (*n & 0xC0) == 0x80) ) {
+			col++;
+		}
+		n++;
+	}
+	gfxtail = run;
+	gfxtaillen = n-run;
+	gfxendrow = row;
+	gfxendcol = col;
+	strcpy(gfxendattr,attr);
+	gfxversion = varsVersion-1;
+	return 0;
+}
+
+//Resolve slot names to variables; repeated whenever variables are added
+//or moved
+static void displayBind() {
+	unsigned int i;
+	gfxslot_t* slot;
+	char* p;
+	var_t* v;
+	
+	gfxslotstracked = gfxtracked;
+	for( i=0; i<gfxnslots; i++ ) {
+		slot = &gfxslots[i];
+		p = slot->name;
+		//Strip trailing letters of ANSI sequences in front of the name
+		while( 1 ) {
+			v = get_var(p,slot->name+slot->namelen-p);
+			if( v == 0 && ((*p >= 'A' && *p <= 'H') || (*p == 'J') || (*p == 'K') || (*p == 'S') || (*p == 'T') || (*p == 'f') || (*p == 'm') || (*p == 'i') || (*p == 'n')) ) {
+				p++;
+			} else {
+				break;
+			}
+		}
+		slot->var = v;
+		slot->last.type = VAL_NONE;
+		slot->wide = 0;
+		if( v && slot->width == 0 ) {
+			gfxslotstracked = 0;
+		}
+	}
+	gfxversion = varsVersion;
+}
+
+static unsigned int displayFormat(gfxslot_t* slot, char* val) {
+	if( slot->last.type == VAL_INT )
+		snprintf(val,GFXVALMAX,"%d",slot->last.i);
+	else if( slot->last.type == VAL_FLOAT )
+		snprintf(val,GFXVALMAX,"%0.3f",slot->last.f);
+	else
+		snprintf(val,GFXVALMAX,"?");
+	return strlen(val);
+}
+
+//A value wider than its spaces is drawn whole and pushes the rest of the
+//line right, as the template would read it
+static void displayValue(gfxslot_t* slot) {
+	char val[GFXVALMAX];
+	unsigned int len;
+	unsigned int i;
+	
+	if( slot->var == 0 ) {
+		for( i=0; i<slot->width; i++ ) {
+			gfxPut(" ",1);
+		}
+		return;
+	}
+	len = displayFormat(slot,val);
+	gfxPut(val,len);
+	for( ; len<slot->width; len++ ) {
+		gfxPut(" ",1);
+	}
+}
+
+static void displayFull() {
+	unsigned int i;
+	gfxPuts("\x1b[H\x1b[2J");
+	for( i=0; i<gfxnslots; i++ ) {
+		gfxPut(gfxslots[i].text,gfxslots[i].len);
+		displayValue(&gfxslots[i]);
+		gfxslots[i].dirty = 0;
+	}
+	gfxPut(gfxtail,gfxtaillen);
+}
+
+static void displayDiff() {
+	unsigned int i;
+	char pos[24];
+	for( i=0; i<gfxnslots; i++ ) {
+		if( gfxslots[i].dirty ) {
+			snprintf(pos,sizeof(pos),"\x1b[0m\x1b[%u;%uH",gfxslots[i].row,gfxslots[i].col);
+			gfxPuts(pos);
+			gfxPuts(gfxslots[i].attr);
+			displayValue(&gfxslots[i]);
+			gfxslots[i].dirty = 0;
+		}
+	}
+	snprintf(pos,sizeof(pos),"\x1b[0m\x1b[%u;%uH",gfxendrow,gfxendcol);
+	gfxPuts(pos);
+	gfxPuts(gfxendattr);
+}
 
 void displayBegin() {
 	gfxdata[0] = 0;
 	gfxpath[0] = 0;
 	gfxrun = 0;
+	gfxnslots = 0;
+	gfxtail = gfxdata;
+	gfxtaillen = 0;
+	display_delay = DISPLAYDELAY;
 }
 
 void displayRun() {
-	if( gfxdata[0] )
+	if( gfxdata[0] ) {
 		gfxrun = 1;
+		gfxfull = 1;
+		last_display_millis = compatMillis()-display_delay-1;
+	}
 }
 
 void displayStop() {
 	gfxrun = 0;
 }
 
-void displayLoad(char* path) {
+void displayInvalidate() {
+	gfxfull = 1;
+}
+
+//Returns -1 if the file could not be read or compiled
+int displayLoad(char* path) {
 	FILE* fp;
 	unsigned int len = 0;
 	char* c;
@@ -68,6 +409,7 @@ void displayLoad(char* path) {
 		if( len ) {
 			last_display_millis = 0;
 			fp = fopen(path,"rb");
+			len = 0;
 			if( fp ) {
 				len = fread(gfxdata,1,GFXSIZE,fp);
 				fclose(fp);
@@ -82,60 +424,69 @@ void displayLoad(char* path) {
 	}
 	gfxdata[len] = 0;
 	gfxrun = 0;
+	if( displayCompile() ) {
+		gfxpath[0] = 0;
+		gfxdata[0] = 0;
+		displayCompile();
+		return -1;
+	}
+	return gfxpath[0] ? 0 : -1;
 }
 
 void displayProcess() {
 	unsigned int millis;
-	var_t* v;
-	char* n;
-	char* p;
 	if( gfxrun ) {
 		millis = compatMillis();
-		if( millis - last_display_millis > DISPLAYDELAY ) {
+		if( millis - last_display_millis > display_delay ) {
 			last_display_millis = millis;
-			displayOut(0x1b);
-			displayOut('[');
-			displayOut('2');
-			displayOut('J');
-			n = gfxdata;
-			while( *n != 0 ) {
-				displayOut(*n);
-				if( *n == ':' ) {
-					p = n-1;
-					while( (p > gfxdata) && ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')) )
-						p--;
-					p++;
-					while( (*p >= '0' && *p <= '9') )
-						p++;
-					while( 1 ) {
-						v = get_var(p,n-p);
-						if( v == 0 && ((*p >= 'A' && *p <= 'H') || (*p == 'J') || (*p == 'K') || (*p == 'S') || (*p == 'T') || (*p == 'f') || (*p == 'm') || (*p == 'i') || (*p == 'n')) ) {
-							p++;
-						} else {
-							break;
-						}
-					}
-					n++;
-					if( v ) {
-						if( v->value.type == VAL_INT )
-							snprintf(gfxval,10,"%d",v->value.i);
-						else if( v->value.type == VAL_FLOAT )
-							snprintf(gfxval,10,"%0.3f",v->value.f);
-						else
-							snprintf(gfxval,10,"?");
-						p = gfxval;
-						while( *p ) {
-							displayOut(*p);
-							p++;
-							if( *n == ' ' ) {
-								n++;
-							}
-						}
-					}
-				} else {
-					n++;
-				}
+			displayRefresh();
+		}
+	}
+}
+
+//Draw one frame now, sending only what changed since the last one
+void displayRefresh() {
+	unsigned int i;
+	uint8_t changed = 0;
+	uint8_t wide;
+	char val[GFXVALMAX];
+	gfxslot_t* slot;
+	if( ! gfxrun ) {
+		return;
+	}
+	if( gfxversion != varsVersion ) {
+		displayBind();
+		gfxfull = 1;
+	}
+	for( i=0; i<gfxnslots; i++ ) {
+		slot = &gfxslots[i];
+		if( slot->var == 0 ) {
+			continue;
+		}
+		if( slot->var->value.type != slot->last.type ||
+		    (slot->last.type == VAL_INT && slot->var->value.i != slot->last.i) ||
+		    (slot->last.type == VAL_FLOAT && slot->var->value.f != slot->last.f) ) {
+			slot->last = slot->var->value;
+			slot->dirty = 1;
+			changed = 1;
+			//Text after a value that is or was too wide moves, so only
+			//a full frame draws it right
+			wide = displayFormat(slot,val) > slot->width;
+			if( wide || slot->wide ) {
+				gfxfull = 1;
 			}
+			slot->wide = wide;
 		}
 	}
+	if( gfxfull || (changed && ! gfxslotstracked) ) {
+		displayFull();
+		gfxfull = 0;
+	}
+	else if( changed ) {
+		displayDiff();
+	}
+	if( gfxoutlen ) {
+		gfxFlushOut();
+		displayFlush();
+	}
 }
@@ -32,11 +32,14 @@
 void displayBegin();
 void displayRun();
 void displayStop();
-void displayLoad(char* path);
+int displayLoad(char* path);
 void displayProcess();
+void displayRefresh();
+void displayInvalidate();
 
 #ifndef __DISPLAY_C__
 extern char gfxpath[256];
+extern unsigned int display_delay;
 #endif //__DISPLAY_C__
 
 #endif //__DISPLAY_H__
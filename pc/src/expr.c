@@ -53,16 +53,17 @@
 #define FUNC_ROUND	 9
 #define FUNC_RAND	 10
 #define FUNC_SERIES 11
+#define FUNC_VT     12
 
 #ifdef EXTRA_MATH
-#define FUNC_SIN	12
-#define FUNC_COS	13
-#define FUNC_TAN	14
-#define FUNC_ASIN	 15
-#define FUNC_ACOS	 16
-#define FUNC_ATAN	 17
-#define FUNC_LOG	18
-#define FUNC_LN	 19
+#define FUNC_SIN	13
+#define FUNC_COS	14
+#define FUNC_TAN	15
+#define FUNC_ASIN	 16
+#define FUNC_ACOS	 17
+#define FUNC_ATAN	 18
+#define FUNC_LOG	19
+#define FUNC_LN	 20
 #endif //EXTRA_MATH
 
 const char func_table[] = {
@@ -78,6 +79,7 @@ const char func_table[] = {
 	'r','o','u','n','d'|0x80,
 	'r','a','n','d'|0x80,
 	's','e','r','i','e','s'|0x80,
+	'v','t'|0x80,
 #ifdef EXTRA_MATH
 	's','i','n'|0x80,
 	'c','o','s'|0x80,
@@ -223,6 +225,10 @@ static val_t expr7() {
 	}
 	
 	idx = table_scan(func_table,txtpos,next-txtpos);
+	//vt is newer than existing models, a variable of that name wins
+	if( idx == FUNC_VT && get_var(txtpos,next-txtpos) ) {
+		idx = -1;
+	}
 	if( idx >= 0 ) {
 		val_t b;
 		switch(idx) {
@@ -238,6 +244,17 @@ static val_t expr7() {
 				txtpos = next;
 				SET_INT(a, compatMillis() );
 				break;
+			case FUNC_VT:
+				//Fraction of the current second; sub-tick evaluation
+				//(e.g. sampled values) supplies its own sample time
+				txtpos = next;
+				if( vtime >= 0 ) {
+					SET_FLOAT(a, vtime);
+				}
+				else {
+					SET_FLOAT(a, (float)(compatMillis()%1000)/1000.0);
+				}
+				break;
 			case FUNC_IF:
 				FUNC_FIRST_ARG(a);
 				if( IS_VAL(a) ) {
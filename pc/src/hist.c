@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "hist.h"
+
+#include <string.h>
+
+typedef struct {
+	uint8_t* buf;
+	unsigned int pos;     //whole bytes written
+	uint64_t acc;         //pending bits, the last nacc of them
+	unsigned int nacc;
+} bitwriter_t;
+
+typedef struct {
+	const uint8_t* buf;
+	unsigned int pos;     //in bits
+	unsigned int end;
+} bitreader_t;
+
+//n is at most 32
+static void putBits(bitwriter_t* w, uint32_t value, unsigned int n) {
+	w->acc = (w->acc<<n) | (value & (uint32_t)(((uint64_t)1<<n)-1));
+	w->nacc += n;
+	while( w->nacc >= 8 ) {
+		w->nacc -= 8;
+		w->buf[w->pos++] = (uint8_t)(w->acc>>w->nacc);
+	}
+}
+
+//Pad with zeros to the next byte boundary
+static void alignBits(bitwriter_t* w) {
+	if( w->nacc ) {
+		w->buf[w->pos++] = (uint8_t)(w->acc<<(8-w->nacc));
+		w->nacc = 0;
+	}
+}
+
+static uint32_t getBits(bitreader_t* r, unsigned int n) {
+	uint32_t value = 0;
+	unsigned int avail;
+	unsigned int take;
+	uint8_t byte;
+	while( n ) {
+		avail = 8-(r->pos&7);
+		take = n < avail ? n : avail;
+		byte = r->pos < r->end ? r->buf[r->pos>>3] : 0;
+		value = (value<<take) | ((byte>>(avail-take)) & ((1u<<take)-1));
+		r->pos += take;
+		n -= take;
+	}
+	return value;
+}
+
+//v must not be 0
+static unsigned int bitLength(uint32_t v) {
+	return 32-__builtin_clz(v);
+}
+
+static unsigned int trailingZeros(uint32_t v) {
+	return __builtin_ctz(v);
+}
+
+static void putInt(bitwriter_t* w, uint32_t* prev, uint32_t v) {
+	uint32_t d = v-*prev;
+	uint32_t z = (d<<1) ^ (uint32_t)((int32_t)d>>31);
+	unsigned int len;
+	*prev = v;
+	if( z == 0 ) {
+		putBits(w,0,1);
+		return;
+	}
+	len = bitLength(z);
+	putBits(w,0x20|(len-1),6);
+	putBits(w,z,len);
+}
+
+static uint32_t getInt(bitreader_t* r, uint32_t* prev) {
+	uint32_t z;
+	if( getBits(r,1) ) {
+		z = getBits(r,getBits(r,5)+1);
+		*prev += (z>>1) ^ (uint32_t)-(int32_t)(z&1);
+	}
+	return *prev;
+}
+
+static void putFloat(bitwriter_t* w, uint32_t* prev, uint32_t v) {
+	uint32_t x = v ^ *prev;
+	unsigned int lead;
+	unsigned int trail;
+	*prev = v;
+	if( x == 0 ) {
+		putBits(w,0,1);
+		return;
+	}
+	lead = 32-bitLength(x);
+	trail = trailingZeros(x);
+	putBits(w,0x400|(lead<<5)|(32-lead-trail-1),11);
+	putBits(w,x>>trail,32-lead-trail);
+}
+
+static uint32_t getFloat(bitreader_t* r, uint32_t* prev) {
+	unsigned int lead;
+	unsigned int len;
+	if( getBits(r,1) ) {
+		lead = getBits(r,5);
+		len = getBits(r,5)+1;
+		*prev ^= getBits(r,len) << (32-lead-len);
+	}
+	return *prev;
+}
+
+static uint32_t valBits(const val_t* v) {
+	uint32_t bits;
+	if( v->type == VAL_FLOAT ) {
+		memcpy(&bits,&v->f,4);
+	}
+	else {
+		bits = (uint32_t)v->i;
+	}
+	return bits;
+}
+
+//Worst case: header, offsets and every value at full width
+unsigned int histBlockMax(unsigned int nvars, unsigned int count) {
+	unsigned int ncols = nvars+2;
+	return sizeof(histblock_t) + 4*(ncols+1) + ncols*((2+count*(2+1+10+32))/8+1) + 8;
+}
+
+static void encodeColumn(bitwriter_t* w, const val_t* v, unsigned int stride, unsigned int count) {
+	unsigned int mode = HIST_MISSING;
+	uint32_t prev_i = 0;
+	uint32_t prev_f = 0;
+	unsigned int type;
+	unsigned int k;
+	for( k=0; k<count; k++ ) {
+		type = v[k*stride].type == VAL_FLOAT ? HIST_FLOAT : v[k*stride].type == VAL_INT ? HIST_INT : HIST_MISSING;
+		if( k == 0 ) {
+			mode = type;
+		}
+		else if( type != mode ) {
+			mode = HIST_MIXED;
+			break;
+		}
+	}
+	putBits(w,mode,2);
+	if( mode == HIST_MISSING ) {
+		return;
+	}
+	for( k=0; k<count; k++, v+=stride ) {
+		type = v->type == VAL_FLOAT ? HIST_FLOAT : v->type == VAL_INT ? HIST_INT : HIST_MISSING;
+		if( mode == HIST_MIXED ) {
+			putBits(w,type,2);
+		}
+		if( type == HIST_FLOAT ) {
+			putFloat(w,&prev_f,valBits(v));
+		}
+		else if( type == HIST_INT ) {
+			putInt(w,&prev_i,valBits(v));
+		}
+	}
+}
+
+//rows holds count rows of nvars values.  out must have room for
+//histBlockMax(nvars,count) bytes.  Returns the block size.
+unsigned int histEncodeBlock(uint8_t* out, uint32_t base_tick, uint32_t base_ms,
+	const uint32_t* tickinc, const uint32_t* msinc, const val_t* rows,
+	unsigned int nvars, unsigned int count) {
+	histblock_t* head = (histblock_t*)out;
+	uint32_t* offsets = (uint32_t*)(out+sizeof(histblock_t));
+	bitwriter_t w;
+	val_t inc[HISTBLOCKTICKS];
+	unsigned int ncols = nvars+2;
+	unsigned int col;
+	unsigned int k;
+	unsigned int size;
+	
+	memset(head,0,sizeof(histblock_t));
+	memcpy(head->magic,HISTBLOCKMAGIC,sizeof(HISTBLOCKMAGIC));
+	head->base_tick = base_tick;
+	head->count = count;
+	head->base_ms = base_ms;
+	head->ncols = ncols;
+	
+	w.buf = out;
+	w.pos = sizeof(histblock_t)+4*(ncols+1);
+	w.acc = 0;
+	w.nacc = 0;
+	for( col=0; col<ncols; col++ ) {
+		offsets[col] = w.pos;
+		if( col < 2 ) {
+			for( k=0; k<count; k++ ) {
+				SET_INT(inc[k],(int)(col == 0 ? tickinc[k] : msinc[k]));
+			}
+			encodeColumn(&w,inc,1,count);
+		}
+		else {
+			encodeColumn(&w,rows+col-2,nvars,count);
+		}
+		//Columns start on byte boundaries
+		alignBits(&w);
+	}
+	offsets[ncols] = w.pos;
+	size = (offsets[ncols]+7)&~7;
+	memset(out+offsets[ncols],0,size-offsets[ncols]);
+	head->size = size;
+	return size;
+}
+
+//Decode column col of a block into out (count values).  Returns the
+//count, or -1 if the block is damaged.
+int histDecodeColumn(const uint8_t* block, unsigned int col, val_t* out) {
+	const histblock_t* head = (const histblock_t*)block;
+	const uint32_t* offsets = (const uint32_t*)(block+sizeof(histblock_t));
+	bitreader_t r;
+	unsigned int mode;
+	unsigned int type;
+	uint32_t prev_i = 0;
+	uint32_t prev_f = 0;
+	uint32_t bits;
+	unsigned int k;
+	
+	if( memcmp(head->magic,HISTBLOCKMAGIC,sizeof(HISTBLOCKMAGIC)) != 0 || col >= head->ncols ||
+	    head->count > HISTBLOCKTICKS || offsets[col] > offsets[col+1] || offsets[col+1] > head->size ) {
+		return -1;
+	}
+	r.buf = block;
+	r.pos = offsets[col]*8;
+	r.end = offsets[col+1]*8;
+	mode = getBits(&r,2);
+	for( k=0; k<head->count; k++ ) {
+		type = mode == HIST_MIXED ? getBits(&r,2) : mode;
+		if( type == HIST_FLOAT ) {
+			bits = getFloat(&r,&prev_f);
+			out[k].type = VAL_FLOAT;
+			memcpy(&out[k].f,&bits,4);
+		}
+		else if( type == HIST_INT ) {
+			SET_INT(out[k],(int)getInt(&r,&prev_i));
+		}
+		else {
+			out[k].type = VAL_NONE;
+			out[k].i = 0;
+		}
+	}
+	return head->count;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <stdint.h>
+#include "val.h"
+
+//Historian file layout (little endian):
+//  histheader_t
+//  variable names, each NUL terminated (nameslen bytes, padded to 8)
+//  blocks, each:
+//    histblock_t
+//    uint32_t offsets[ncols+1], column start offsets from the block start
+//    columns: 0 tick increments, 1 millisecond increments, then one per
+//    variable in header order
+//    padding to a multiple of 8
+//Blocks are self contained, so a reader can map the file and decode any
+//column of any block without touching the others.
+//
+//A column is a bit stream (most significant bit first) of HISTBLOCKTICKS
+//values at most.  It starts with a 2 bit mode (all int, all float, mixed,
+//all missing); mixed columns prefix every value with its 2 bit type.
+//Ints are stored as the zigzag delta to the previous int, floats as the
+//XOR with the previous float's bits; in both cases 0 costs one bit.
+
+#define HISTMAGIC      "SIMHIST"
+#define HISTBLOCKMAGIC "BLK"
+#define HISTVERSION    1
+#define HISTBLOCKTICKS 32
+
+#define HIST_INT     0
+#define HIST_FLOAT   1
+#define HIST_MIXED   2
+#define HIST_MISSING 3
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t nvars;
+	uint32_t blockticks;
+	uint32_t tickdelay;
+	uint64_t start_ms;    //wall clock (ms since the epoch) when recording started
+	uint32_t nameslen;
+	uint32_t reserved;
+} histheader_t;
+
+typedef struct {
+	char magic[4];
+	uint32_t size;        //whole block, header included
+	uint32_t base_tick;   //tick and time (ms since start_ms) of the row
+	uint32_t count;       //before this block; the increment columns
+	uint32_t base_ms;     //add up from there
+	uint32_t ncols;
+} histblock_t;
+
+unsigned int histBlockMax(unsigned int nvars, unsigned int count);
+unsigned int histEncodeBlock(uint8_t* out, uint32_t base_tick, uint32_t base_ms,
+	const uint32_t* tickinc, const uint32_t* msinc, const val_t* rows,
+	unsigned int nvars, unsigned int count);
+int histDecodeColumn(const uint8_t* block, unsigned int col, val_t* out);
+
+#endif //__HIST_H__
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Export a historian recording (see hist.h) to CSV on stdout:
+//  histcsv file [variable ...]
+//The first two columns are the tick and the wall clock time in ms since
+//the epoch, followed by the requested (default all) variables.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hist.h"
+
+static void usage(char* cmd) {
+	printf("Usage:\n");
+	printf("%s file [variable ...]\n",cmd);
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	const histheader_t* header;
+	const histblock_t* block;
+	const uint8_t* data;
+	const char* names;
+	const char** name;
+	unsigned int* cols;
+	unsigned int ncols;
+	val_t* values;
+	val_t tickinc[HISTBLOCKTICKS];
+	val_t msinc[HISTBLOCKTICKS];
+	uint32_t tick;
+	uint32_t ms;
+	struct stat st;
+	size_t pos;
+	unsigned int i;
+	unsigned int k;
+	int count;
+	int fd;
+	
+	if( argc < 2 || argv[1][0] == '-' ) {
+		usage(argv[0]);
+	}
+	fd = open(argv[1],O_RDONLY);
+	if( fd < 0 || fstat(fd,&st) < 0 || st.st_size < (off_t)sizeof(histheader_t) ) {
+		fprintf(stderr,"Failed to open %s\n",argv[1]);
+		return 1;
+	}
+	data = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	if( data == MAP_FAILED ) {
+		fprintf(stderr,"Failed to map %s\n",argv[1]);
+		return 1;
+	}
+	header = (const histheader_t*)data;
+	if( memcmp(header->magic,HISTMAGIC,sizeof(HISTMAGIC)) != 0 || header->version != HISTVERSION ||
+	    sizeof(histheader_t)+header->nameslen > (size_t)st.st_size ) {
+		fprintf(stderr,"%s is not a recording\n",argv[1]);
+		return 1;
+	}
+	
+	//Column of every variable, in header order
+	name = malloc(header->nvars*sizeof(char*));
+	names = (const char*)(data+sizeof(histheader_t));
+	for( i=0; i<header->nvars; i++ ) {
+		name[i] = names;
+		names += strlen(names)+1;
+	}
+	ncols = argc > 2 ? (unsigned int)argc-2 : header->nvars;
+	cols = malloc(ncols*sizeof(unsigned int));
+	values = malloc((size_t)ncols*HISTBLOCKTICKS*sizeof(val_t));
+	for( k=0; k<ncols; k++ ) {
+		if( argc == 2 ) {
+			cols[k] = k;
+			continue;
+		}
+		for( i=0; i<header->nvars && strcmp(name[i],argv[k+2]) != 0; i++ );
+		if( i == header->nvars ) {
+			fprintf(stderr,"%s is not recorded\n",argv[k+2]);
+			return 1;
+		}
+		cols[k] = i;
+	}
+	
+	printf("tick,time_ms");
+	for( k=0; k<ncols; k++ ) {
+		printf(",%s",name[cols[k]]);
+	}
+	printf("\n");
+	
+	pos = sizeof(histheader_t)+header->nameslen;
+	while( pos+sizeof(histblock_t) <= (size_t)st.st_size ) {
+		block = (const histblock_t*)(data+pos);
+		if( block->size < sizeof(histblock_t) || pos+block->size > (size_t)st.st_size ) {
+			//Last block still being written
+			break;
+		}
+		count = histDecodeColumn(data+pos,0,tickinc);
+		if( count < 0 || block->ncols != header->nvars+2 || histDecodeColumn(data+pos,1,msinc) < 0 ) {
+			fprintf(stderr,"Damaged block at offset %lu\n",(unsigned long)pos);
+			return 1;
+		}
+		for( k=0; k<ncols; k++ ) {
+			histDecodeColumn(data+pos,cols[k]+2,values+k*HISTBLOCKTICKS);
+		}
+		tick = block->base_tick;
+		ms = block->base_ms;
+		for( i=0; i<(unsigned int)count; i++ ) {
+			tick += tickinc[i].i;
+			ms += msinc[i].i;
+			printf("%u,%llu",tick,(unsigned long long)(header->start_ms+ms));
+			for( k=0; k<ncols; k++ ) {
+				val_t* v = &values[k*HISTBLOCKTICKS+i];
+				if( v->type == VAL_INT ) {
+					printf(",%d",v->i);
+				}
+				else if( v->type == VAL_FLOAT ) {
+					printf(",%.9g",v->f);
+				}
+				else {
+					printf(",");
+				}
+			}
+			printf("\n");
+		}
+		pos += block->size;
+	}
+	return 0;
+}
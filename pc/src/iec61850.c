@@ -25,6 +25,7 @@
  */
 #define __IEC61850_C__
 #include "iec61850.h"
+#include "iec61850sv.h"
 #include <iec61850_server.h>
 #include <mms_value.h>
 #include <goose_publisher.h>
@@ -32,8 +33,11 @@
 #include "cli.h"
 #include "var.h"
 #include "display.h"
+#include "metrics.h"
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 
 #define IEDNAME "ScadaSim"
 #define VENDOR "GTRI"
@@ -42,6 +46,8 @@
 
 char iec61850_serv_name[256];
 uint16_t iec61850_serv_port;
+uint16_t iec61850_serv_maxconn;
+uint8_t iec61850_serv_threadless;
 
 char iec61850_goose_digital_eth[256];
 uint16_t iec61850_goose_digital_appid;
@@ -54,6 +60,15 @@ char iec61850_goose_analog_dst[6];
 char iec61850_icd_path[256];
 char iec61850_scd_path[256];
 
+//Points are grouped into GGIO instances of at most GGIOPOINTSMAX data
+//objects, and GGIO instances into logical devices of at most LDGGIOMAX.
+//This keeps every node, data set and report bounded no matter how many
+//points are configured (both the library and MMS search them linearly).
+#define LDNAME        "GenericIO"
+#define GGIOPOINTSMAX 256
+#define LDGGIOMAX     8
+#define LDPOINTSMAX   (GGIOPOINTSMAX*LDGGIOMAX)
+
 static char* iec61850_serv_name_backup;
 static IedServer iedServer;
 static IedModel *iedModel;
@@ -65,6 +80,36 @@ static GoosePublisher iedMeasurementsPublisher;
 static LinkedList gooseEvents;
 static LinkedList gooseMeasurements;
 
+//Points in model order, filled in a single pass by modelPointList()
+static var_t* points[VARSMAX];
+
+static unsigned int modelPointList() {
+	unsigned int i;
+	unsigned int n = 0;
+	for( i=0; i<VARSMAX; i++ ) {
+		if( vars[i].value.type == VAL_NONE ) {
+			break;
+		}
+		if( vars[i].pnttype != PNT_NONE ) {
+			points[n++] = &vars[i];
+		}
+	}
+	return n;
+}
+
+static void modelDeviceName(char* name, unsigned int len, unsigned int ld) {
+	if( ld == 0 ) {
+		snprintf(name,len,"%s",LDNAME);
+	}
+	else {
+		snprintf(name,len,"%s%u",LDNAME,ld+1);
+	}
+}
+
+static int isDigital(var_t* v) {
+	return v->pnttype == PNT_DO || v->pnttype == PNT_DI;
+}
+
 static LogicalNode* modelNode(char* name, DataObject** lastObj) {
 	LogicalNode* node = LogicalNode_create(name,dev);
 	DataObject* obj;
@@ -99,109 +144,62 @@ static LogicalNode* modelNode(char* name, DataObject** lastObj) {
 
 
 static LogicalNode* modelLLN0() {
-	unsigned int i;
 	DataObject* obj;
 	LogicalNode* node;
-	DataSet* set;
-	ReportControlBlock* rcb;
-	char variable[32];
 	node = modelNode("LLN0",&obj);
-	uint8_t digitalPoints = 0;
-	uint8_t analogPoints = 0;
 	
 	DataAttribute_create("configRev",(ModelNode*)obj,IEC61850_VISIBLE_STRING_255,IEC61850_FC_DC,0,0,0);
 	DataAttribute_create("ldNs",(ModelNode*)obj,IEC61850_VISIBLE_STRING_255,IEC61850_FC_EX,0,0,0);
 	
-	//Check to see if there are digital and/or analog points to export to IEC61850
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO || 
-		    vars[i].pnttype == PNT_DI ) {
-			digitalPoints = 1;
-		}
-		else if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AO_SCALED ||
-		    vars[i].pnttype == PNT_AI || vars[i].pnttype == PNT_AI_SCALED ) {
-			analogPoints = 1;
-		} 
-	}
-	
-	//Create Dataset for DO/DI
-	if( digitalPoints ) {
-		set = DataSet_create("dsEvents", node);
-		for( i=0; i<VARSMAX; i++ ) {
-			if( vars[i].pnttype == PNT_DO ) {
-				snprintf(variable,32,"GGIO1$ST$SPCSO%d$stVal",vars[i].pntaddr);
-				DataSetEntry_create(set,variable,-1,0);
-			}
-			if( vars[i].pnttype == PNT_DI ) {
-				snprintf(variable,32,"GGIO1$ST$Ind%d$stVal",vars[i].pntaddr);
-				DataSetEntry_create(set,variable,-1,0);
-			}
-		}
-	}
-	
-	//Create Dataset of AO/AI Measurements
-	if( analogPoints ) {
-		set = DataSet_create("dsMeasurements", node);
-		for( i=0; i<VARSMAX; i++ ) {
-			if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AO_SCALED ) {
-				snprintf(variable,32,"GGIO1$MX$AnOut%d$mag$f",vars[i].pntaddr);
-				DataSetEntry_create(set,variable,-1,0);
-			}
-			else if( vars[i].pnttype == PNT_AI || vars[i].pnttype == PNT_AI_SCALED ) {
-				snprintf(variable,32,"GGIO1$MX$AnIn%d$mag$f",vars[i].pntaddr);
-				DataSetEntry_create(set,variable,-1,0);
-			}
-		}
-	}
+	return node;
+}
+
+static void modelReports(LogicalNode* node, char* dataset) {
+	char name[32];
+	char rptId[32];
 	
-	//Create ReportControlBlock for Events
-	if( digitalPoints ) {
-		rcb = ReportControlBlock_create("brcbEvents",node,
-			"brEvents",true,"dsEvents",1,
-			TRG_OPT_DATA_CHANGED|TRG_OPT_DATA_UPDATE|TRG_OPT_GI|TRG_OPT_INTEGRITY,
-			RPT_OPT_SEQ_NUM|RPT_OPT_TIME_STAMP|RPT_OPT_DATA_SET|RPT_OPT_REASON_FOR_INCLUSION|RPT_OPT_CONF_REV,
-			TICKDELAY/10,DISPLAYDELAY);
-		rcb = ReportControlBlock_create("urcbEvents",node,
-			"rpEvents",false,"dsEvents",1,
-			TRG_OPT_DATA_CHANGED|TRG_OPT_DATA_UPDATE|TRG_OPT_GI|TRG_OPT_INTEGRITY,
-			RPT_OPT_SEQ_NUM|RPT_OPT_TIME_STAMP|RPT_OPT_DATA_SET|RPT_OPT_REASON_FOR_INCLUSION|RPT_OPT_CONF_REV,
-			TICKDELAY/10,DISPLAYDELAY);
-		//DataAttribute_create("RptID",(ModelNode*)rcb,IEC61850_INT32,IEC61850_FC_BR,0,0,0);
+	snprintf(name,sizeof(name),"brcb%s",dataset+2);
+	snprintf(rptId,sizeof(rptId),"br%s",dataset+2);
+	ReportControlBlock_create(name,node,
+		rptId,true,dataset,1,
+		TRG_OPT_DATA_CHANGED|TRG_OPT_DATA_UPDATE|TRG_OPT_GI|TRG_OPT_INTEGRITY,
+		RPT_OPT_SEQ_NUM|RPT_OPT_TIME_STAMP|RPT_OPT_DATA_SET|RPT_OPT_REASON_FOR_INCLUSION|RPT_OPT_CONF_REV,
+		TICKDELAY/10,DISPLAYDELAY);
+	snprintf(name,sizeof(name),"urcb%s",dataset+2);
+	snprintf(rptId,sizeof(rptId),"rp%s",dataset+2);
+	ReportControlBlock_create(name,node,
+		rptId,false,dataset,1,
+		TRG_OPT_DATA_CHANGED|TRG_OPT_DATA_UPDATE|TRG_OPT_GI|TRG_OPT_INTEGRITY,
+		RPT_OPT_SEQ_NUM|RPT_OPT_TIME_STAMP|RPT_OPT_DATA_SET|RPT_OPT_REASON_FOR_INCLUSION|RPT_OPT_CONF_REV,
+		TICKDELAY/10,DISPLAYDELAY);
+}
+
+static void modelDataSetEntry(DataSet* set, DataSetEntry** last, char* variable) {
+	//DataSet_addEntry() walks to the end of the list; hand it the
+	//current tail so large data sets are built in linear time
+	DataSetEntry* first = set->fcdas;
+	if( *last != 0 ) {
+		set->fcdas = *last;
 	}
-	
-	//CreateReportControlBlock for Measurements
-	if( analogPoints ) {
-		rcb = ReportControlBlock_create("brcbMeasurements",node,
-			"brMeasurements",true,"dsMeasurements",1,
-			TRG_OPT_DATA_CHANGED|TRG_OPT_DATA_UPDATE|TRG_OPT_GI|TRG_OPT_INTEGRITY,
-			RPT_OPT_SEQ_NUM|RPT_OPT_TIME_STAMP|RPT_OPT_DATA_SET|RPT_OPT_REASON_FOR_INCLUSION|RPT_OPT_CONF_REV,
-			TICKDELAY/10,DISPLAYDELAY);	
-		rcb = ReportControlBlock_create("urcbMeasurements",node,
-			"rpMeasurements",false,"dsMeasurements",1,
-			TRG_OPT_DATA_CHANGED|TRG_OPT_DATA_UPDATE|TRG_OPT_GI|TRG_OPT_INTEGRITY,
-			RPT_OPT_SEQ_NUM|RPT_OPT_TIME_STAMP|RPT_OPT_DATA_SET|RPT_OPT_REASON_FOR_INCLUSION|RPT_OPT_CONF_REV,
-			TICKDELAY/10,DISPLAYDELAY);	
-		//DataAttribute_create("RptID",(ModelNode*)rcb,IEC61850_INT32,IEC61850_FC_BR,0,0,0);
+	*last = DataSetEntry_create(set,variable,-1,0);
+	if( first != 0 ) {
+		set->fcdas = first;
 	}
-	
-	
 }
 
 static void modelLLN0NamePlt() {
-	DataObject* lln0 = (DataObject*)(iedModel->firstChild->firstChild);
-	DataObject* namplt = (DataObject*)(lln0->firstChild->sibling->sibling->sibling);
-	DataAttribute* vendor = (DataAttribute*)(namplt->firstChild);
-	DataAttribute* swrev = (DataAttribute*)(vendor->sibling);
-	DataAttribute* descr = (DataAttribute*)(swrev->sibling);
-	
-	IedServer_updateVisibleStringAttributeValue(iedServer,vendor,VENDOR);
-	IedServer_updateVisibleStringAttributeValue(iedServer,swrev,SWREV);
-	IedServer_updateVisibleStringAttributeValue(iedServer,descr,DESCR);
-
-	//DataAttribute* rptId = (DataAttribute*)(namplt->sibling->firstChild);
-	//printf("Meaurements: %s\n",namplt->sibling->name);fflush(0);
-	//printf("rptId: %s\n",rptId->name);fflush(0);
-	//IedServer_updateInt32AttributeValue(iedServer,rptId,25);
+	LogicalDevice* ld;
+	for( ld = iedModel->firstChild; ld != 0; ld = (LogicalDevice*)ld->sibling ) {
+		DataObject* lln0 = (DataObject*)(ld->firstChild);
+		DataObject* namplt = (DataObject*)(lln0->firstChild->sibling->sibling->sibling);
+		DataAttribute* vendor = (DataAttribute*)(namplt->firstChild);
+		DataAttribute* swrev = (DataAttribute*)(vendor->sibling);
+		DataAttribute* descr = (DataAttribute*)(swrev->sibling);
+		
+		IedServer_updateVisibleStringAttributeValue(iedServer,vendor,VENDOR);
+		IedServer_updateVisibleStringAttributeValue(iedServer,swrev,SWREV);
+		IedServer_updateVisibleStringAttributeValue(iedServer,descr,DESCR);
+	}
 }
 
 static void modelLPHD1() {
@@ -236,12 +234,12 @@ modelControl(ControlAction action, void* parameter, MmsValue* value, bool test)
 
 	if( MmsValue_getBoolean(value) ) {
 		MAKE_ONE(v->value);
-		v->expr = 0;
 	}
 	else {
 		MAKE_ZERO(v->value);
-		v->expr = 0;
 	}
+	override_var(v);
+	valuesVersion++;
 		
     return CONTROL_RESULT_OK;
 }
@@ -306,7 +304,7 @@ static void modelAO(var_t* v) {
 	DataAttribute* oper;
 	char name[16];
 	snprintf(name,16,"AnOut%d",v->pntaddr);
-	obj = DataObject_create(v->name,(ModelNode*)ggio,0);
+	obj = DataObject_create(name,(ModelNode*)ggio,0);
 	mag = DataAttribute_create("mag",(ModelNode*)obj,IEC61850_CONSTRUCTED,IEC61850_FC_MX,TRG_OPT_DATA_CHANGED,0,0);
 	v->iec61850_value =
 	DataAttribute_create("f",(ModelNode*)mag,IEC61850_FLOAT32,IEC61850_FC_MX,TRG_OPT_DATA_CHANGED,0,0);
@@ -333,28 +331,83 @@ static void modelAI(var_t* v) {
 }
 
 
-static LogicalNode* modelGGIO1() {
-	unsigned int i;
+//Build every logical device in a single pass over the point list
+static void modelDevices() {
+	unsigned int n = modelPointList();
+	unsigned int i = 0;
+	unsigned int inst;
+	char name[32];
+	char variable[64];
+	LogicalNode* lln0;
+	DataSet* events;
+	DataSet* measurements;
+	DataSetEntry* lastEvent;
+	DataSetEntry* lastMeasurement;
+	var_t* v;
 	
-	ggio = modelNode("GGIO1",0);
-
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO ) {
-			modelDO(&vars[i]);
-		}
-		else if( vars[i].pnttype == PNT_DI ) {
-			modelDI(&vars[i]);
-		}
-		else if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AO_SCALED ) {
-			modelAO(&vars[i]);
+	do {
+		modelDeviceName(name,sizeof(name),i/LDPOINTSMAX);
+		dev = LogicalDevice_create(name,iedModel);
+		lln0 = modelLLN0();
+		modelLPHD1();
+		events = 0;
+		measurements = 0;
+		lastEvent = 0;
+		lastMeasurement = 0;
+		inst = 0;
+		
+		do {
+			snprintf(name,sizeof(name),"GGIO%u",++inst);
+			ggio = modelNode(name,0);
+			
+			for( ; i<n; i++ ) {
+				v = points[i];
+				if( v->pnttype == PNT_DO ) {
+					modelDO(v);
+					snprintf(variable,sizeof(variable),"GGIO%u$ST$SPCSO%d$stVal",inst,v->pntaddr);
+				}
+				else if( v->pnttype == PNT_DI ) {
+					modelDI(v);
+					snprintf(variable,sizeof(variable),"GGIO%u$ST$Ind%d$stVal",inst,v->pntaddr);
+				}
+				else if( v->pnttype == PNT_AO || v->pnttype == PNT_AO_SCALED ) {
+					modelAO(v);
+					snprintf(variable,sizeof(variable),"GGIO%u$MX$AnOut%d$mag$f",inst,v->pntaddr);
+				}
+				else {
+					modelAI(v);
+					snprintf(variable,sizeof(variable),"GGIO%u$MX$AnIn%d$mag$f",inst,v->pntaddr);
+				}
+				
+				if( isDigital(v) ) {
+					if( events == 0 ) {
+						events = DataSet_create("dsEvents",lln0);
+					}
+					modelDataSetEntry(events,&lastEvent,variable);
+				}
+				else {
+					if( measurements == 0 ) {
+						measurements = DataSet_create("dsMeasurements",lln0);
+					}
+					modelDataSetEntry(measurements,&lastMeasurement,variable);
+				}
+				
+				if( (i+1)%GGIOPOINTSMAX == 0 ) {
+					i++;
+					break;
+				}
+			}
+		} while( i<n && i%LDPOINTSMAX != 0 );
+		
+		if( events != 0 ) {
+			modelReports(lln0,"dsEvents");
 		}
-		else if( vars[i].pnttype == PNT_AI  || vars[i].pnttype == PNT_AI_SCALED ) {
-			modelAI(&vars[i]);
+		if( measurements != 0 ) {
+			modelReports(lln0,"dsMeasurements");
 		}
-	}
+	} while( i<n );
 }
 
-
 static void modelUpdate(int force) {
 	unsigned int i;
 	bool b;
@@ -385,6 +438,7 @@ static void modelUpdate(int force) {
 			if( force || IedServer_getBooleanAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_value) != b ) {
 				IedServer_updateBooleanAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_value,b);
 				IedServer_updateTimestampAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_timestamp,&iecTimestamp);
+				metrics_iec61850_updates++;
 			}
 		}
 		else if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AI ) {
@@ -397,6 +451,7 @@ static void modelUpdate(int force) {
 			if( force || IedServer_getFloatAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_value) != f ) {
 				IedServer_updateFloatAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_value,f);
 				IedServer_updateTimestampAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_timestamp,&iecTimestamp);
+				metrics_iec61850_updates++;
 			}
 		}
 		else if( vars[i].pnttype == PNT_AO_SCALED || vars[i].pnttype == PNT_AI_SCALED ) {
@@ -415,6 +470,7 @@ static void modelUpdate(int force) {
 			if( force || IedServer_getFloatAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_value) != f ) {
 				IedServer_updateFloatAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_value,f);
 				IedServer_updateTimestampAttributeValue(iedServer,(DataAttribute*)vars[i].iec61850_timestamp,&iecTimestamp);
+				metrics_iec61850_updates++;
 			}
 		}
 	}
@@ -423,8 +479,11 @@ static void modelUpdate(int force) {
 }
 
 
+//GOOSE data sets live in the first logical device, so only its points
+//(the first LDPOINTSMAX) are published
 static void gooseDigitalUpdate( int create ) {
 	unsigned int i;
+	unsigned int n = 0;
 	int nidx = 0;
 	bool b;
 	int pub = create;
@@ -432,6 +491,9 @@ static void gooseDigitalUpdate( int create ) {
 	MmsValue* value;
 	
 	for( i=0; i<VARSMAX; i++ ) {
+		if( vars[i].pnttype != PNT_NONE && n++ >= LDPOINTSMAX ) {
+			break;
+		}
 		if( vars[i].pnttype == PNT_DO || vars[i].pnttype == PNT_DI ) {
 			if( (vars[i].value.type == VAL_INT && vars[i].value.i != 0 ) ||
 				(vars[i].value.type == VAL_FLOAT && vars[i].value.f != 0.0 ) ) {
@@ -459,11 +521,13 @@ static void gooseDigitalUpdate( int create ) {
 
 	if( pub ) {
 		GoosePublisher_publish(iedEventsPublisher, gooseEvents);
+		metrics_goose_events++;
 	}
 }
 
 static void gooseAnalogUpdate(int create) {
 	unsigned int i;
+	unsigned int n = 0;
 	int nidx = 0;
 	float f;
 	int pub = create;
@@ -471,6 +535,9 @@ static void gooseAnalogUpdate(int create) {
 	MmsValue* value;
 	
 	for( i=0; i<VARSMAX; i++ ) {
+		if( vars[i].pnttype != PNT_NONE && n++ >= LDPOINTSMAX ) {
+			break;
+		}
 		if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AI ) {
 			if( vars[i].value.type == VAL_INT ) {
 				f = (float)vars[i].value.i;
@@ -525,6 +592,7 @@ static void gooseAnalogUpdate(int create) {
 
 	if( pub ) {
 		GoosePublisher_publish(iedMeasurementsPublisher, gooseMeasurements);
+		metrics_goose_measurements++;
 	}
 }
 
@@ -533,6 +601,8 @@ static void iec61850ServBegin() {
 	iedServer = 0;
 	iec61850_serv_name[0] = 0;
 	iec61850_serv_port = 61850;
+	iec61850_serv_maxconn = 2;
+	iec61850_serv_threadless = 0;
 }
 
 
@@ -566,6 +636,7 @@ void iec61850Begin() {
 	iec61850ServBegin();
 	iec61850GooseDigitalBegin();
 	iec61850GooseAnalogBegin();
+	iec61850SvReset();
 	iec61850_icd_path[0] = 0;
 }
 
@@ -581,16 +652,13 @@ void iec61850Serv() {
     IedServerConfig_enableFileService(config, false);
     IedServerConfig_enableDynamicDataSetService(config, true);
     IedServerConfig_enableLogService(config, true);
-    IedServerConfig_setMaxMmsConnections(config, 2);
+    IedServerConfig_setMaxMmsConnections(config, iec61850_serv_maxconn);
 
 	// Set-up iedModel with basic info
 	iedModel = IedModel_create("");
 	iec61850_serv_name_backup = iedModel->name;
 	iedModel->name = iec61850_serv_name;
-	dev = LogicalDevice_create("GenericIO",iedModel);
-	modelLLN0();
-	modelLPHD1();
-	modelGGIO1();
+	modelDevices();
 	
     // Create a new IEC 61850 server instance
     iedServer = IedServer_createWithConfig(iedModel, NULL, config);
@@ -601,7 +669,14 @@ void iec61850Serv() {
 	modelLLN0NamePlt();
 	modelDOCallbacks();
 	
-	IedServer_start(iedServer, iec61850_serv_port);
+	//In threadless mode the MMS stack is serviced from iec61850Update()
+	//in the main loop instead of from the library's own threads
+	if( iec61850_serv_threadless ) {
+		IedServer_startThreadless(iedServer, iec61850_serv_port);
+	}
+	else {
+		IedServer_start(iedServer, iec61850_serv_port);
+	}
 }
 
 void iec61850GooseDigital() {
@@ -620,9 +695,9 @@ void iec61850GooseDigital() {
 	
 	iedEventsPublisher = GoosePublisher_create(&gooseCommParameters, iec61850_goose_digital_eth);
 	if( iedEventsPublisher == 0 ) { iec61850GooseDigitalReset(); return; }
-	snprintf(ref,sizeof(ref),"%sGenericIO/LLN0$GO$gcbEvents",iec61850_serv_name);
+	snprintf(ref,sizeof(ref),"%s" LDNAME "/LLN0$GO$gcbEvents",iec61850_serv_name);
 	GoosePublisher_setGoCbRef(iedEventsPublisher,ref);
-	snprintf(ref,sizeof(ref),"%sGenericIO/LLN0$dsEvents",iec61850_serv_name);
+	snprintf(ref,sizeof(ref),"%s" LDNAME "/LLN0$dsEvents",iec61850_serv_name);
 	GoosePublisher_setDataSetRef(iedEventsPublisher,ref);
 	GoosePublisher_setConfRev(iedEventsPublisher, 1);
 	GoosePublisher_setTimeAllowedToLive(iedEventsPublisher, 500);
@@ -648,9 +723,9 @@ void iec61850GooseAnalog() {
 	
 	iedMeasurementsPublisher = GoosePublisher_create(&gooseCommParameters, iec61850_goose_analog_eth);
 	if( iedMeasurementsPublisher == 0 ) { iec61850GooseAnalogReset(); return; }
-	snprintf(ref,sizeof(ref),"%sGenericIO/LLN0$GO$gcbMeasurements",iec61850_serv_name);
+	snprintf(ref,sizeof(ref),"%s" LDNAME "/LLN0$GO$gcbMeasurements",iec61850_serv_name);
 	GoosePublisher_setGoCbRef(iedMeasurementsPublisher,ref);
-	snprintf(ref,sizeof(ref),"%sGenericIO/LLN0$dsMeasurements",iec61850_serv_name);
+	snprintf(ref,sizeof(ref),"%s" LDNAME "/LLN0$dsMeasurements",iec61850_serv_name);
 	GoosePublisher_setDataSetRef(iedMeasurementsPublisher,ref);
 	GoosePublisher_setConfRev(iedMeasurementsPublisher, 1);
 	GoosePublisher_setTimeAllowedToLive(iedMeasurementsPublisher, 500);
@@ -663,7 +738,12 @@ void iec61850GooseAnalog() {
 void iec61850ServReset() {
 	if( iedServer != 0 ) {
 		unsigned int i;
-		IedServer_stop(iedServer);
+		if( iec61850_serv_threadless ) {
+			IedServer_stopThreadless(iedServer);
+		}
+		else {
+			IedServer_stop(iedServer);
+		}
 		
 		for( i=0; i<VARSMAX; i++ ) {
 			vars[i].iec61850_value = 0;
@@ -697,9 +777,14 @@ void iec61850Reset() {
 	iec61850ServReset();
 	iec61850GooseDigitalReset();
 	iec61850GooseAnalogReset();
+	iec61850SvReset();
 }
 
 void iec61850Update() {
+	if( iedServer != 0 && iec61850_serv_threadless ) {
+		IedServer_processIncomingData(iedServer);
+		IedServer_performPeriodicTasks(iedServer);
+	}
 	if( newVars ) {
 		if( iedServer!= 0 ) {
 			modelUpdate(0);
@@ -734,7 +819,7 @@ static char XML_TEMPLATE_COMMUNICATION_1[] = \
 "        </Address>\n";
 
 static char XML_TEMPLATE_COMMUNICATION_GSE[] = \
-"        <GSE cbName=\"%s\" ldInst=\"GenericIO\">\n"\
+"        <GSE cbName=\"%s\" ldInst=\"" LDNAME "\">\n"\
 "          <Address>\n"\
 "            <P type=\"MAC-Address\">%02X:%02X:%02X:%02X:%02X:%02X</P>\n"\
 "            <P type=\"APPID\">%d</P>\n"\
@@ -769,8 +854,10 @@ static char XML_TEMPLATE_2[] = \
 "    </Services>\n" \
 "    <AccessPoint name=\"AP1\">\n" \
 "      <Server>\n" \
-"        <Authentication />\n" \
-"        <LDevice inst=\"GenericIO\">\n" \
+"        <Authentication />\n";
+
+static char XML_TEMPLATE_LDevice[] = \
+"        <LDevice inst=\"%s\">\n" \
 "          <LN0 lnClass=\"LLN0\" lnType=\"LLN01\" inst=\"\">\n" \
 "\n";
 
@@ -778,13 +865,13 @@ static char XML_TEMPLATE_EventsDataSet_Header[] = \
 "            <DataSet name=\"dsEvents\" desc=\"Events\">\n";
 
 static char XML_TEMPLATE_EventsDataSet[] = \
-"              <FCDA ldInst=\"GenericIO\" lnClass=\"GGIO\" fc=\"ST\" lnInst=\"1\" doName=\"%s\" daName=\"stVal\" />\n";
+"              <FCDA ldInst=\"%s\" lnClass=\"GGIO\" fc=\"ST\" lnInst=\"%u\" doName=\"%s%d\" daName=\"stVal\" />\n";
 
 static char XML_TEMPLATE_MeasurementsDataSet_Header[] = \
 "            <DataSet name=\"dsMeasurements\" desc=\"Measurements\">\n";
 
 static char XML_TEMPLATE_MeasurementsDataSet[] = \
-"              <FCDA ldInst=\"GenericIO\" lnClass=\"GGIO\" fc=\"MX\" lnInst=\"1\" doName=\"%s\" daName=\"mag.f\" />\n";
+"              <FCDA ldInst=\"%s\" lnClass=\"GGIO\" fc=\"MX\" lnInst=\"%u\" doName=\"%s%d\" daName=\"mag.f\" />\n";
 
 static char XML_TEMPLATE_DataSet_Footer[] = \
 "            </DataSet>\n" \
@@ -868,8 +955,10 @@ static char XML_TEMPLATE_3[] = \
 "              	<Val>ok</Val>\n" \
 "              </DAI>\n" \
 "            </DOI>\n" \
-"          </LN>\n" \
-"          <LN lnClass=\"GGIO\" lnType=\"GGIO1\" inst=\"1\" prefix=\"\">\n" \
+"          </LN>\n";
+
+static char XML_TEMPLATE_GGIO[] = \
+"          <LN lnClass=\"GGIO\" lnType=\"GGIO%u\" inst=\"%u\" prefix=\"\">\n" \
 "            <DOI name=\"Mod\">\n" \
 "              <DAI name=\"stVal\">\n" \
 "              	<Val>on</Val>\n" \
@@ -890,11 +979,15 @@ static char XML_TEMPLATE_3[] = \
 "            </DOI>\n";
 
 static char XML_TEMPLATE_ctlModel [] = \
-"            <DOI name=\"%s\"><DAI name=\"ctlModel\"><Val>direct-with-normal-security</Val></DAI></DOI>\n";
+"            <DOI name=\"SPCSO%d\"><DAI name=\"ctlModel\"><Val>direct-with-normal-security</Val></DAI></DOI>\n";
+
+static char XML_TEMPLATE_LN_Footer[] = \
+"          </LN>\n";
+
+static char XML_TEMPLATE_LDevice_Footer[] = \
+"        </LDevice>\n";
 
 static char XML_TEMPLATE_4[] = \
-"          </LN>\n" \
-"        </LDevice>\n" \
 "      </Server>\n" \
 "    </AccessPoint>\n" \
 "  </IED>\n" \
@@ -912,19 +1005,23 @@ static char XML_TEMPLATE_4[] = \
 "      <DO name=\"PhyHealth\" type=\"THealth\" />\n" \
 "      <DO name=\"Proxy\" type=\"TInd\" />\n" \
 "    </LNodeType>\n" \
-"\n" \
-"    <LNodeType id=\"GGIO1\" lnClass=\"GGIO\">\n" \
+"\n";
+
+static char XML_TEMPLATE_GGIOType[] = \
+"    <LNodeType id=\"GGIO%u\" lnClass=\"GGIO\">\n" \
 "      <DO name=\"Mod\" type=\"TMod\" />\n" \
 "      <DO name=\"Beh\" type=\"TBeh\" />\n" \
 "      <DO name=\"Health\" type=\"THealth\" />\n" \
 "      <DO name=\"NamPlt\" type=\"TNamPlt\" />\n";
 
 static char XML_TEMPLATE_DO[] = \
-"      <DO name=\"%s\" type=\"%s\" />\n";
+"      <DO name=\"%s%d\" type=\"%s\" />\n";
 
-static char XML_TEMPLATE_5[] = \
+static char XML_TEMPLATE_LNodeType_Footer[] = \
 "    </LNodeType>\n" \
-"\n" \
+"\n";
+
+static char XML_TEMPLATE_5[] = \
 "    <DOType id=\"TMod\" cdc=\"ENC\">\n" \
 "      <DA name=\"stVal\" bType=\"Enum\" type=\"EBeh\" fc=\"ST\" dchg=\"true\" />\n" \
 "      <DA name=\"q\" bType=\"Quality\" fc=\"ST\" qchg=\"true\" />\n" \
@@ -974,6 +1071,13 @@ static char XML_TEMPLATE_5[] = \
 "      <DA name=\"t\" bType=\"Timestamp\" fc=\"MX\" />\n" \
 "    </DOType>\n" \
 "\n" \
+"    <DOType id=\"TAnOut\" cdc=\"APC\">\n" \
+"      <DA name=\"mag\" type=\"TMag\" bType=\"Struct\" fc=\"MX\" dchg=\"true\" />\n" \
+"      <DA name=\"q\" bType=\"Quality\" fc=\"MX\" qchg=\"true\" />\n" \
+"      <DA name=\"t\" bType=\"Timestamp\" fc=\"MX\" />\n" \
+"      <DA name=\"Oper\" type=\"TMag\" bType=\"Struct\" fc=\"SP\" />\n" \
+"    </DOType>\n" \
+"\n" \
 "    <DOType id=\"TSPC\" cdc=\"SPC\">\n" \
 "      <DA name=\"stVal\" bType=\"BOOLEAN\" fc=\"ST\" dchg=\"true\" />\n" \
 "      <DA name=\"q\" bType=\"Quality\" fc=\"ST\" qchg=\"true\" />\n" \
@@ -1037,139 +1141,240 @@ static char XML_TEMPLATE_5[] = \
 "  </DataTypeTemplates>\n" \
 "</SCL>\n";
 
-static void iec61850ExportScl(char* path, int include_com) {
+//SCL output is streamed through one large buffer instead of being
+//handed to stdio a few bytes at a time
+#define SCLBUFSIZE 65536
+
+static FILE* scl_fp;
+static char scl_buf[SCLBUFSIZE];
+static unsigned int scl_len;
+
+static void sclFlush() {
+	if( scl_len ) {
+		fwrite(scl_buf,1,scl_len,scl_fp);
+		scl_len = 0;
+	}
+}
+
+static void sclPuts(const char* str) {
+	unsigned int len = strlen(str);
+	if( scl_len + len > SCLBUFSIZE ) {
+		sclFlush();
+		if( len > SCLBUFSIZE ) {
+			fwrite(str,1,len,scl_fp);
+			return;
+		}
+	}
+	memcpy(scl_buf+scl_len,str,len);
+	scl_len += len;
+}
+
+static void sclPrintf(const char* fmt, ...) {
+	va_list ap;
+	int len;
+	va_start(ap,fmt);
+	len = vsnprintf(scl_buf+scl_len,SCLBUFSIZE-scl_len,fmt,ap);
+	va_end(ap);
+	if( len >= 0 && scl_len + len >= SCLBUFSIZE ) {
+		//Did not fit, flush and format again at the start of the buffer
+		sclFlush();
+		va_start(ap,fmt);
+		len = vsnprintf(scl_buf,SCLBUFSIZE,fmt,ap);
+		va_end(ap);
+		if( len >= SCLBUFSIZE ) {
+			len = SCLBUFSIZE-1;
+		}
+	}
+	if( len > 0 ) {
+		scl_len += len;
+	}
+}
+
+static char* sclPointPrefix(var_t* v) {
+	switch( v->pnttype ) {
+		case PNT_DO:
+			return "SPCSO";
+		case PNT_DI:
+			return "Ind";
+		case PNT_AO:
+		case PNT_AO_SCALED:
+			return "AnOut";
+		default:
+			return "AnIn";
+	}
+}
+
+static void sclDevice(unsigned int ld, unsigned int first, unsigned int last) {
 	unsigned int i;
-	FILE* fp;
-	char name[16];
+	unsigned int inst;
 	uint8_t digitalPoints = 0;
 	uint8_t analogPoints = 0;
+	char name[32];
 	
-	if( path == 0 || path[0] == 0 ) {
-		return;
-	}
-	
-	//Check to see if there are digital and/or analog points to export to IEC61850
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO || 
-		    vars[i].pnttype == PNT_DI ) {
+	modelDeviceName(name,sizeof(name),ld);
+	for( i=first; i<last; i++ ) {
+		if( isDigital(points[i]) ) {
 			digitalPoints = 1;
 		}
-		else if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AO_SCALED ||
-		    vars[i].pnttype == PNT_AI || vars[i].pnttype == PNT_AI_SCALED ) {
+		else {
 			analogPoints = 1;
-		} 
-	}
-	
-	fp = fopen(path,"w");
-	if( fp == 0 ) {
-		return;
-	}
-	
-	fprintf(fp,"%s",XML_TEMPLATE_1);
-	
-	if( include_com ) {
-		fprintf(fp,XML_TEMPLATE_COMMUNICATION_1,iec61850_serv_name);
-		if( digitalPoints && iec61850_goose_digital_eth[0] ) {
-			fprintf(fp,XML_TEMPLATE_COMMUNICATION_GSE,"gcbEvents",
-					iec61850_goose_digital_dst[0]&0xFF,iec61850_goose_digital_dst[1]&0xFF,iec61850_goose_digital_dst[2]&0xFF,
-					iec61850_goose_digital_dst[3]&0xFF,iec61850_goose_digital_dst[4]&0xFF,iec61850_goose_digital_dst[5]&0xFF,
-					iec61850_goose_digital_appid);
 		}
-		if( analogPoints && iec61850_goose_analog_eth[0] ) {
-			fprintf(fp,XML_TEMPLATE_COMMUNICATION_GSE,"gcbMeasurements",
-					iec61850_goose_analog_dst[0]&0xFF,iec61850_goose_analog_dst[1]&0xFF,iec61850_goose_analog_dst[2]&0xFF,
-					iec61850_goose_analog_dst[3]&0xFF,iec61850_goose_analog_dst[4]&0xFF,iec61850_goose_analog_dst[5]&0xFF,
-					iec61850_goose_analog_appid);
-		}
-		fprintf(fp,"%s",XML_TEMPLATE_COMMUNICATION_2);
 	}
 	
-	if( ! strlen(iec61850_serv_name) ) {
-		fprintf(fp,XML_TEMPLATE_2,"TEMPLATE");
-	}
-	else {
-		fprintf(fp,XML_TEMPLATE_2,iec61850_serv_name);
-	}
+	sclPrintf(XML_TEMPLATE_LDevice,name);
 	
 	if( digitalPoints ) {
-		fprintf(fp,"%s",XML_TEMPLATE_EventsDataSet_Header);
-		for( i=0; i<VARSMAX; i++ ) {
-			if( vars[i].pnttype == PNT_DO ) {
-				snprintf(name,16,"SPCSO%d",vars[i].pntaddr);
-				fprintf(fp,XML_TEMPLATE_EventsDataSet,name);
-			}
-			else if( vars[i].pnttype == PNT_DI ) {
-				snprintf(name,16,"Ind%d",vars[i].pntaddr);
-				fprintf(fp,XML_TEMPLATE_EventsDataSet,name);
+		sclPuts(XML_TEMPLATE_EventsDataSet_Header);
+		for( i=first; i<last; i++ ) {
+			if( isDigital(points[i]) ) {
+				sclPrintf(XML_TEMPLATE_EventsDataSet,name,(i-first)/GGIOPOINTSMAX+1,
+					sclPointPrefix(points[i]),points[i]->pntaddr);
 			}
 		}
-		fprintf(fp,"%s",XML_TEMPLATE_DataSet_Footer);
+		sclPuts(XML_TEMPLATE_DataSet_Footer);
 	}
 	
 	if( analogPoints ) {
-		fprintf(fp,"%s",XML_TEMPLATE_MeasurementsDataSet_Header);
-		for( i=0; i<VARSMAX; i++ ) {
-			if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AO_SCALED) {
-				snprintf(name,16,"AnOut%d",vars[i].pntaddr);
-				fprintf(fp,XML_TEMPLATE_MeasurementsDataSet,name);
-			}
-			else if( vars[i].pnttype == PNT_AI || vars[i].pnttype == PNT_AI_SCALED ) {
-				snprintf(name,16,"AnIn%d",vars[i].pntaddr);
-				fprintf(fp,XML_TEMPLATE_MeasurementsDataSet,name);
+		sclPuts(XML_TEMPLATE_MeasurementsDataSet_Header);
+		for( i=first; i<last; i++ ) {
+			if( ! isDigital(points[i]) ) {
+				sclPrintf(XML_TEMPLATE_MeasurementsDataSet,name,(i-first)/GGIOPOINTSMAX+1,
+					sclPointPrefix(points[i]),points[i]->pntaddr);
 			}
 		}
-		fprintf(fp,"%s",XML_TEMPLATE_DataSet_Footer);
+		sclPuts(XML_TEMPLATE_DataSet_Footer);
 	}
 	
 	if( digitalPoints ) {
-		fprintf(fp,"%s",XML_TEMPLATE_EventsBufferedReportControlBlock);
-		fprintf(fp,"%s",XML_TEMPLATE_EventsUnbufferedReportControlBlock);
+		sclPuts(XML_TEMPLATE_EventsBufferedReportControlBlock);
+		sclPuts(XML_TEMPLATE_EventsUnbufferedReportControlBlock);
 	}
 	
 	if( analogPoints ) {
-		fprintf(fp,"%s",XML_TEMPLATE_MeasurementsBufferedReportControlBlock);
-		fprintf(fp,"%s",XML_TEMPLATE_MeasurementsUnbufferedReportControlBlock);
+		sclPuts(XML_TEMPLATE_MeasurementsBufferedReportControlBlock);
+		sclPuts(XML_TEMPLATE_MeasurementsUnbufferedReportControlBlock);
 	}
 	
-	if( digitalPoints && iec61850_goose_digital_eth[0] ) {
-		fprintf(fp,"%s",XML_TEMPLATE_EventsGSEControl);
+	//GOOSE is only published from the first logical device
+	if( ld == 0 && digitalPoints && iec61850_goose_digital_eth[0] ) {
+		sclPuts(XML_TEMPLATE_EventsGSEControl);
 	}
 	
-	if( analogPoints && iec61850_goose_analog_eth[0] ) {
-		fprintf(fp,"%s",XML_TEMPLATE_MeasurementsGSEControl);
+	if( ld == 0 && analogPoints && iec61850_goose_analog_eth[0] ) {
+		sclPuts(XML_TEMPLATE_MeasurementsGSEControl);
 	}
 	
-	fprintf(fp,"%s",XML_TEMPLATE_3);
+	sclPuts(XML_TEMPLATE_3);
 	
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO ) {
-			snprintf(name,16,"SPCSO%d",vars[i].pntaddr);
-			fprintf(fp,XML_TEMPLATE_ctlModel,name);
+	i = first;
+	inst = 0;
+	do {
+		inst++;
+		sclPrintf(XML_TEMPLATE_GGIO,ld*LDGGIOMAX+inst,inst);
+		for( ; i<last && i<first+inst*GGIOPOINTSMAX; i++ ) {
+			if( points[i]->pnttype == PNT_DO ) {
+				sclPrintf(XML_TEMPLATE_ctlModel,points[i]->pntaddr);
+			}
+		}
+		sclPuts(XML_TEMPLATE_LN_Footer);
+	} while( i<last );
+	
+	sclPuts(XML_TEMPLATE_LDevice_Footer);
+}
+
+//Logical devices are always filled before the next one is started, so
+//GGIO types are simply numbered across the whole model
+static void sclTypes(unsigned int n) {
+	unsigned int i = 0;
+	unsigned int type = 0;
+	do {
+		type++;
+		sclPrintf(XML_TEMPLATE_GGIOType,type);
+		for( ; i<n && i<type*GGIOPOINTSMAX; i++ ) {
+			if( points[i]->pnttype == PNT_DO ) {
+				sclPrintf(XML_TEMPLATE_DO,"SPCSO",points[i]->pntaddr,"TSPC");
+			}
+			else if( points[i]->pnttype == PNT_DI ) {
+				sclPrintf(XML_TEMPLATE_DO,"Ind",points[i]->pntaddr,"TInd");
+			}
+			else if( points[i]->pnttype == PNT_AO || points[i]->pnttype == PNT_AO_SCALED) {
+				sclPrintf(XML_TEMPLATE_DO,"AnOut",points[i]->pntaddr,"TAnOut");
+			}
+			else {
+				sclPrintf(XML_TEMPLATE_DO,"AnIn",points[i]->pntaddr,"TAnIn");
+			}
 		}
+		sclPuts(XML_TEMPLATE_LNodeType_Footer);
+	} while( i<n );
+}
+
+static void iec61850ExportScl(char* path, int include_com) {
+	unsigned int i;
+	unsigned int n;
+	uint8_t digitalPoints = 0;
+	uint8_t analogPoints = 0;
+	
+	if( path == 0 || path[0] == 0 ) {
+		return;
 	}
-	fprintf(fp,"%s",XML_TEMPLATE_4);
 	
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO ) {
-			snprintf(name,16,"SPCSO%d",vars[i].pntaddr);
-			fprintf(fp,XML_TEMPLATE_DO,name,"TSPC");
+	//Check to see if there are digital and/or analog points in the
+	//first logical device (the one that can publish GOOSE)
+	n = modelPointList();
+	for( i=0; i<n && i<LDPOINTSMAX; i++ ) {
+		if( isDigital(points[i]) ) {
+			digitalPoints = 1;
 		}
-		else if( vars[i].pnttype == PNT_DI ) {
-			snprintf(name,16,"Ind%d",vars[i].pntaddr);
-			fprintf(fp,XML_TEMPLATE_DO,name,"TInd");
+		else {
+			analogPoints = 1;
 		}
-		else if( vars[i].pnttype == PNT_AO || vars[i].pnttype == PNT_AO_SCALED) {
-			//snprintf(name,16,"AnOut%d",vars[i].pntaddr);
-			//fprintf(fp,XML_TEMPLATE_DO,name,"TAnOut");
+	}
+	
+	scl_fp = fopen(path,"w");
+	if( scl_fp == 0 ) {
+		return;
+	}
+	setvbuf(scl_fp,0,_IONBF,0);
+	scl_len = 0;
+	
+	sclPuts(XML_TEMPLATE_1);
+	
+	if( include_com ) {
+		sclPrintf(XML_TEMPLATE_COMMUNICATION_1,iec61850_serv_name);
+		if( digitalPoints && iec61850_goose_digital_eth[0] ) {
+			sclPrintf(XML_TEMPLATE_COMMUNICATION_GSE,"gcbEvents",
+					iec61850_goose_digital_dst[0]&0xFF,iec61850_goose_digital_dst[1]&0xFF,iec61850_goose_digital_dst[2]&0xFF,
+					iec61850_goose_digital_dst[3]&0xFF,iec61850_goose_digital_dst[4]&0xFF,iec61850_goose_digital_dst[5]&0xFF,
+					iec61850_goose_digital_appid);
 		}
-		else if( vars[i].pnttype == PNT_AI || vars[i].pnttype == PNT_AI_SCALED ) {
-			snprintf(name,16,"AnIn%d",vars[i].pntaddr);
-			fprintf(fp,XML_TEMPLATE_DO,name,"TAnIn");
+		if( analogPoints && iec61850_goose_analog_eth[0] ) {
+			sclPrintf(XML_TEMPLATE_COMMUNICATION_GSE,"gcbMeasurements",
+					iec61850_goose_analog_dst[0]&0xFF,iec61850_goose_analog_dst[1]&0xFF,iec61850_goose_analog_dst[2]&0xFF,
+					iec61850_goose_analog_dst[3]&0xFF,iec61850_goose_analog_dst[4]&0xFF,iec61850_goose_analog_dst[5]&0xFF,
+					iec61850_goose_analog_appid);
 		}
+		sclPuts(XML_TEMPLATE_COMMUNICATION_2);
+	}
+	
+	if( ! strlen(iec61850_serv_name) ) {
+		sclPrintf(XML_TEMPLATE_2,"TEMPLATE");
+	}
+	else {
+		sclPrintf(XML_TEMPLATE_2,iec61850_serv_name);
 	}
-	fprintf(fp,"%s",XML_TEMPLATE_5);
 	
-	fclose(fp);
+	i = 0;
+	do {
+		sclDevice(i/LDPOINTSMAX,i,(n-i > LDPOINTSMAX) ? i+LDPOINTSMAX : n);
+		i += LDPOINTSMAX;
+	} while( i<n );
+	
+	sclPuts(XML_TEMPLATE_4);
+	sclTypes(n);
+	sclPuts(XML_TEMPLATE_5);
+	
+	sclFlush();
+	fclose(scl_fp);
 }
 
 void iec61850ExportIcd() {
@@ -33,6 +33,8 @@
 //Server Related
 extern char iec61850_serv_name[256];
 extern uint16_t iec61850_serv_port;
+extern uint16_t iec61850_serv_maxconn;
+extern uint8_t iec61850_serv_threadless;
 
 //GOOSE (Digital) Related
 extern char iec61850_goose_digital_eth[256];
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#define __IEC61850SV_C__
+#include "iec61850sv.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+
+#include "var.h"
+#include "parse.h"
+#include "expr.h"
+#include "table.h"
+#include "play.h"
+
+//IEC 61850-9-2LE sampled values publisher.  Frames are encoded once
+//into a template; each sample only rewrites smpCnt and seqData before
+//being queued for a batched sendmmsg() on a raw AF_PACKET socket.
+
+#define SVBATCH      32
+#define SVFRAMEMAX   1518
+#define SVETHERTYPE  0x88BA
+#define SVVLANPRIO   4
+#define NSEC         1000000000ULL
+
+char iec61850_sv_eth[256];
+uint16_t iec61850_sv_appid;
+char iec61850_sv_dst[6];
+char iec61850_sv_id[SVIDMAX+1];
+unsigned int iec61850_sv_rate;
+
+unsigned long iec61850_sv_sent;
+unsigned long iec61850_sv_lost;
+unsigned long iec61850_sv_late;
+unsigned long iec61850_sv_maxlate;
+
+static char sv_names[SVNAMESMAX];
+static var_t* sv_vars[SVVARSMAX];
+static unsigned int sv_nvars;
+static unsigned int sv_version;
+
+static int sv_fd = -1;
+static uint8_t sv_frames[SVBATCH][SVFRAMEMAX];
+static struct mmsghdr sv_msgs[SVBATCH];
+static struct iovec sv_iovs[SVBATCH];
+static uint16_t sv_frame_len;
+static uint16_t sv_smpcnt_off;
+static uint16_t sv_data_off;
+static unsigned int sv_pending;
+static uint64_t sv_start;
+static uint64_t sv_next;
+
+static uint64_t svNanos() {
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC,&tv);
+	return (uint64_t)tv.tv_sec*NSEC + tv.tv_nsec;
+}
+
+static unsigned int berLengthSize(unsigned int len) {
+	if( len < 128 ) return 1;
+	if( len < 256 ) return 2;
+	return 3;
+}
+
+static uint8_t* berTag(uint8_t* p, uint8_t tag, unsigned int len) {
+	*p++ = tag;
+	if( len < 128 ) {
+		*p++ = len;
+	}
+	else if( len < 256 ) {
+		*p++ = 0x81;
+		*p++ = len;
+	}
+	else {
+		*p++ = 0x82;
+		*p++ = len>>8;
+		*p++ = len&0xFF;
+	}
+	return p;
+}
+
+//Encodes the complete frame into frame and records the offsets of the
+//fields that change per sample. Returns the frame length.
+static uint16_t svTemplate(uint8_t* frame, uint8_t* src) {
+	unsigned int idlen = strlen(iec61850_sv_id);
+	unsigned int data_len = sv_nvars*8;
+	unsigned int asdu_len = 2+idlen + 4 + 6 + 3 + 1+berLengthSize(data_len)+data_len;
+	unsigned int seq_len = 1+berLengthSize(asdu_len)+asdu_len;
+	unsigned int pdu_len = 3 + 1+berLengthSize(seq_len)+seq_len;
+	unsigned int apdu_len = 1+berLengthSize(pdu_len)+pdu_len;
+	uint8_t* p = frame;
+	
+	memset(frame,0,SVFRAMEMAX);
+	memcpy(p,iec61850_sv_dst,6); p+=6;
+	memcpy(p,src,6); p+=6;
+	//802.1Q tag, VLAN 0
+	*p++ = 0x81; *p++ = 0x00;
+	*p++ = SVVLANPRIO<<5; *p++ = 0x00;
+	*p++ = SVETHERTYPE>>8; *p++ = SVETHERTYPE&0xFF;
+	*p++ = iec61850_sv_appid>>8; *p++ = iec61850_sv_appid&0xFF;
+	*p++ = (8+apdu_len)>>8; *p++ = (8+apdu_len)&0xFF;
+	p += 4; //Reserved 1 and 2
+	
+	p = berTag(p,0x60,pdu_len);       //savPdu
+	p = berTag(p,0x80,1); *p++ = 1;   //noASDU
+	p = berTag(p,0xA2,seq_len);       //seqASDU
+	p = berTag(p,0x30,asdu_len);      //ASDU
+	p = berTag(p,0x80,idlen);         //svID
+	memcpy(p,iec61850_sv_id,idlen); p+=idlen;
+	p = berTag(p,0x82,2);             //smpCnt
+	sv_smpcnt_off = p-frame; p+=2;
+	p = berTag(p,0x83,4);             //confRev
+	p[3] = 1; p+=4;
+	p = berTag(p,0x85,1); *p++ = 0;   //smpSynch (none)
+	p = berTag(p,0x87,data_len);      //seqData
+	sv_data_off = p-frame; p+=data_len;
+	
+	//Minimum ethernet payload, raw sockets are not padded
+	if( p-frame < 60 ) {
+		return 60;
+	}
+	return p-frame;
+}
+
+static void svResolve() {
+	char* entry = sv_names;
+	char* n;
+	unsigned int i = 0;
+	while( *entry != 0 && i < sv_nvars ) {
+		n = table_next(entry);
+		sv_vars[i++] = get_var(entry,n-entry);
+		entry = n;
+	}
+	sv_version = varsVersion;
+}
+
+static void svEncode(uint8_t* frame, uint16_t smpcnt) {
+	unsigned int i;
+	int32_t d;
+	var_t* v;
+	uint8_t* p = frame+sv_data_off;
+	frame[sv_smpcnt_off] = smpcnt>>8;
+	frame[sv_smpcnt_off+1] = smpcnt&0xFF;
+	for( i=0; i<sv_nvars; i++, p+=8 ) {
+		v = sv_vars[i];
+		if( v == 0 ) {
+			d = 0;
+			p[7] = 0x01; //Quality: invalid
+		}
+		else {
+			if( v->value.type == VAL_FLOAT ) {
+				d = (int32_t)(v->value.f >= 0 ? v->value.f+0.5 : v->value.f-0.5);
+			}
+			else {
+				d = v->value.i;
+			}
+			p[7] = 0x00;
+		}
+		p[0] = (d>>24)&0xFF;
+		p[1] = (d>>16)&0xFF;
+		p[2] = (d>>8)&0xFF;
+		p[3] = d&0xFF;
+	}
+}
+
+static void svEvaluate() {
+	unsigned int i;
+	val_t a;
+	var_t* v;
+	for( i=0; i<sv_nvars; i++ ) {
+		v = sv_vars[i];
+		if( v != 0 && v->expr != 0 && ! play_bound[v-vars] && ! v->override ) {
+			txtpos = v->expr;
+			parse_error = 0;
+			MAKE_ZERO(a);
+			if( expr_eval(&a) ) {
+				v->value = a;
+			}
+		}
+	}
+	valuesVersion++;
+}
+
+static void svFlush() {
+	int n;
+	if( sv_pending == 0 ) {
+		return;
+	}
+	n = sendmmsg(sv_fd,sv_msgs,sv_pending,0);
+	if( n < 0 ) {
+		n = 0;
+	}
+	iec61850_sv_sent += n;
+	iec61850_sv_lost += sv_pending-n;
+	sv_pending = 0;
+}
+
+void iec61850SvReset() {
+	if( sv_fd != -1 ) {
+		close(sv_fd);
+		sv_fd = -1;
+	}
+	iec61850_sv_eth[0] = 0;
+	iec61850_sv_appid = 0x4000;
+	iec61850_sv_dst[0] = 0x01;
+	iec61850_sv_dst[1] = 0x0C;
+	iec61850_sv_dst[2] = 0xCD;
+	iec61850_sv_dst[3] = 0x04;
+	iec61850_sv_dst[4] = 0x00;
+	iec61850_sv_dst[5] = 0x00;
+	iec61850_sv_id[0] = 0;
+	iec61850_sv_rate = 4800;
+	iec61850_sv_sent = 0;
+	iec61850_sv_lost = 0;
+	iec61850_sv_late = 0;
+	iec61850_sv_maxlate = 0;
+	table_init(sv_names);
+	sv_nvars = 0;
+	sv_pending = 0;
+}
+
+int iec61850SvBind(char* name, unsigned int len) {
+	if( sv_nvars >= SVVARSMAX || 8*(sv_nvars+1)+SVIDMAX+64 > SVFRAMEMAX ) {
+		return 0;
+	}
+	if( table_add(sv_names,SVNAMESMAX,name,len,0) == 0 ) {
+		return 0;
+	}
+	sv_nvars++;
+	return 1;
+}
+
+char* iec61850SvBinding(unsigned int idx) {
+	char* entry = sv_names;
+	while( *entry != 0 ) {
+		if( idx == 0 ) {
+			return entry;
+		}
+		entry = table_next(entry);
+		idx--;
+	}
+	return 0;
+}
+
+void iec61850Sv() {
+	struct ifreq ifr;
+	struct sockaddr_ll addr;
+	unsigned int i;
+	int one = 1;
+	
+	if( sv_nvars == 0 || iec61850_sv_rate == 0 || strlen(iec61850_sv_eth) >= IFNAMSIZ ) {
+		iec61850SvReset();
+		return;
+	}
+	
+	sv_fd = socket(AF_PACKET,SOCK_RAW,0);
+	if( sv_fd < 0 ) {
+		sv_fd = -1;
+		iec61850SvReset();
+		return;
+	}
+	
+	memset(&ifr,0,sizeof(ifr));
+	strcpy(ifr.ifr_name,iec61850_sv_eth);
+	if( ioctl(sv_fd,SIOCGIFINDEX,&ifr) < 0 ) {
+		iec61850SvReset();
+		return;
+	}
+	memset(&addr,0,sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_ifindex = ifr.ifr_ifindex;
+	if( bind(sv_fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 ||
+	    ioctl(sv_fd,SIOCGIFHWADDR,&ifr) < 0 ) {
+		iec61850SvReset();
+		return;
+	}
+	//Never let a full transmit queue stall the main loop
+	fcntl(sv_fd,F_SETFL,O_NONBLOCK);
+	#ifdef PACKET_QDISC_BYPASS
+	setsockopt(sv_fd,SOL_PACKET,PACKET_QDISC_BYPASS,&one,sizeof(one));
+	#endif
+	
+	sv_frame_len = svTemplate(sv_frames[0],(uint8_t*)ifr.ifr_hwaddr.sa_data);
+	memset(sv_msgs,0,sizeof(sv_msgs));
+	for( i=0; i<SVBATCH; i++ ) {
+		if( i != 0 ) {
+			memcpy(sv_frames[i],sv_frames[0],sv_frame_len);
+		}
+		sv_iovs[i].iov_base = sv_frames[i];
+		sv_iovs[i].iov_len = sv_frame_len;
+		sv_msgs[i].msg_hdr.msg_iov = &sv_iovs[i];
+		sv_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	svResolve();
+	sv_pending = 0;
+	sv_next = 0;
+	sv_start = svNanos();
+}
+
+void iec61850SvProcess() {
+	uint64_t now;
+	uint64_t elapsed;
+	uint64_t due;
+	uint64_t sched;
+	uint64_t late;
+	uint64_t rate = iec61850_sv_rate;
+	uint16_t smpcnt;
+	
+	if( sv_fd == -1 ) {
+		return;
+	}
+	if( sv_version != varsVersion ) {
+		svResolve();
+	}
+	
+	now = svNanos();
+	elapsed = now - sv_start;
+	due = (elapsed/NSEC)*rate + (elapsed%NSEC)*rate/NSEC;
+	if( due < sv_next ) {
+		return;
+	}
+	
+	//Drop samples that are more than 100ms overdue rather than bursting them
+	if( due - sv_next > rate/10 ) {
+		iec61850_sv_lost += due - sv_next;
+		sv_next = due;
+	}
+	
+	while( sv_next <= due ) {
+		sched = sv_start + (sv_next/rate)*NSEC + (sv_next%rate)*NSEC/rate;
+		late = now > sched ? now - sched : 0;
+		if( late > NSEC/rate ) {
+			iec61850_sv_late++;
+		}
+		if( late/1000 > iec61850_sv_maxlate ) {
+			iec61850_sv_maxlate = late/1000;
+		}
+		
+		smpcnt = sv_next%rate;
+		vtime = (float)smpcnt/(float)rate;
+		svEvaluate();
+		svEncode(sv_frames[sv_pending],smpcnt);
+		sv_pending++;
+		sv_next++;
+		if( sv_pending == SVBATCH ) {
+			svFlush();
+		}
+	}
+	vtime = -1;
+	svFlush();
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __IEC61850SV_H__
+#define __IEC61850SV_H__
+
+#include <stdint.h>
+
+#define SVVARSMAX  32
+#define SVNAMESMAX 512
+#define SVIDMAX    64
+
+#ifndef __IEC61850SV_C__
+extern char iec61850_sv_eth[256];
+extern uint16_t iec61850_sv_appid;
+extern char iec61850_sv_dst[6];
+extern char iec61850_sv_id[SVIDMAX+1];
+extern unsigned int iec61850_sv_rate;
+
+//Statistics
+extern unsigned long iec61850_sv_sent;
+extern unsigned long iec61850_sv_lost;
+extern unsigned long iec61850_sv_late;
+extern unsigned long iec61850_sv_maxlate;
+#endif //__IEC61850SV_C__
+
+void iec61850SvReset();
+int iec61850SvBind(char* name, unsigned int len);
+char* iec61850SvBinding(unsigned int idx);
+void iec61850Sv();
+void iec61850SvProcess();
+
+#endif //__IEC61850SV_H__
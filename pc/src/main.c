@@ -29,9 +29,15 @@
 #include "var.h"
 #include "command.h"
 #include "display.h"
+#include "prof.h"
+#include "metrics.h"
+#include "cdc.h"
 
 #ifdef MODBUS
 #include "modbus.h"
+#ifdef LINUX
+#include "rtu.h"
+#endif
 #endif
 
 #ifdef MODBUSTCP
@@ -40,28 +46,48 @@
 
 #ifdef IEC61850
 #include "iec61850.h"
+#include "iec61850sv.h"
 #endif
 
 #include <string.h>
 #include <stdio.h>
 
 int main(int argc , char** argv) {
+	unsigned long long start;
 	compatBegin(argc, argv);
 	commandBegin();
 	
 	for(;;) {
+		profLoop();
 		varProcess();
+		start = profStart();
 		displayProcess();
+		profSection(PROF_DISPLAY,start);
+		start = profStart();
 		commandProcess();
+		profSection(PROF_CONSOLE,start);
 		#ifdef MODBUS
+			start = profStart();
 			modbusProcess();
+			#ifdef LINUX
+			rtuProcess();
+			#endif
+			profSection(PROF_MODBUS,start);
 		#endif
 		#ifdef MODBUSTCP
+			start = profStart();
 			modbusTcpProcess();
+			modbusUdpProcess();
+			profSection(PROF_MODBUSTCP,start);
 		#endif
 		#ifdef IEC61850
+			start = profStart();
 			iec61850Update();
+			iec61850SvProcess();
+			profSection(PROF_IEC61850,start);
 		#endif
+		metricsProcess();
+		cdcProcess();
 	}
 	return 0;
 }
\ No newline at end of file
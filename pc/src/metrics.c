@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __METRICS_C__
+#include "metrics.h"
+#include "var.h"
+#include "compat.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef LINUX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif //LINUX
+
+#define METRICSCLIENTSMAX 8
+#define METRICSREQMAX     1024
+#define METRICSRESMAX     65536
+
+unsigned long long metrics_ticks;
+unsigned long long metrics_tick_overruns;
+histogram_t metrics_tick_duration;
+unsigned long long metrics_modbus_requests[METRICSTRANSPORTS][METRICSFCS];
+unsigned long long metrics_modbus_exceptions[METRICSTRANSPORTS][METRICSFCS];
+histogram_t metrics_modbus_duration[METRICSFCS];
+unsigned long long metrics_rtu_frames;
+unsigned long long metrics_rtu_crc_errors;
+unsigned long long metrics_rtu_overruns;
+unsigned long long metrics_rtu_timeouts;
+unsigned long long metrics_rtu_gaps;
+unsigned long long metrics_modbus_cache_hits;
+unsigned long long metrics_modbus_cache_misses;
+unsigned long long metrics_iec61850_updates;
+unsigned long long metrics_goose_events;
+unsigned long long metrics_goose_measurements;
+uint16_t metrics_port;
+
+//Bucket upper bounds in nanoseconds
+static const unsigned long tick_bounds[METRICSBUCKETS] = {
+	100000,500000,1000000,5000000,10000000,50000000,100000000,250000000,1000000000
+};
+static const unsigned long modbus_bounds[METRICSBUCKETS] = {
+	10000,50000,100000,500000,1000000,5000000,10000000,50000000,100000000
+};
+static const char* transport_names[METRICSTRANSPORTS] = { "rtu", "tcp", "udp" };
+
+static void histogramAdd(histogram_t* h, const unsigned long* bounds, unsigned long long ns) {
+	unsigned int i;
+	for( i=0; i<METRICSBUCKETS && ns > bounds[i]; i++ );
+	h->counts[i]++;
+	h->sum_ns += ns;
+	h->count++;
+}
+
+void metricsTick(unsigned long long start) {
+	unsigned long long ns = compatNanos()-start;
+	metrics_ticks++;
+	if( ns > (unsigned long long)TICKDELAY*1000000 ) {
+		metrics_tick_overruns++;
+	}
+	histogramAdd(&metrics_tick_duration,tick_bounds,ns);
+}
+
+//fc is the requested function code, resfc the one answered (0x80 set
+//for an exception)
+void metricsModbus(unsigned int transport, uint8_t fc, uint8_t resfc, unsigned long long start) {
+	fc &= METRICSFCS-1;
+	metrics_modbus_requests[transport][fc]++;
+	if( resfc & 0x80 ) {
+		metrics_modbus_exceptions[transport][fc]++;
+	}
+	histogramAdd(&metrics_modbus_duration[fc],modbus_bounds,compatNanos()-start);
+}
+
+#ifdef LINUX
+static int metricsfd = -1;
+static int clients[METRICSCLIENTSMAX];
+static char clientreq[METRICSCLIENTSMAX][METRICSREQMAX];
+static unsigned int clientlen[METRICSCLIENTSMAX];
+static char response[METRICSRESMAX];
+static unsigned int reslen;
+
+#define res_printf(...) reslen = reslen + snprintf(response+reslen,METRICSRESMAX > reslen ? METRICSRESMAX-reslen : 0,__VA_ARGS__)
+
+static void histogramPrint(const char* name, const char* labels, histogram_t* h, const unsigned long* bounds) {
+	const char* sep = labels[0] ? "," : "";
+	unsigned long long total = 0;
+	unsigned int i;
+	for( i=0; i<METRICSBUCKETS; i++ ) {
+		total += h->counts[i];
+		res_printf("%s_bucket{%s%sle=\"%g\"} %llu\n",name,labels,sep,bounds[i]/1e9,total);
+	}
+	res_printf("%s_bucket{%s%sle=\"+Inf\"} %llu\n",name,labels,sep,h->count);
+	if( labels[0] ) {
+		res_printf("%s_sum{%s} %g\n%s_count{%s} %llu\n",name,labels,h->sum_ns/1e9,name,labels,h->count);
+	}
+	else {
+		res_printf("%s_sum %g\n%s_count %llu\n",name,h->sum_ns/1e9,name,h->count);
+	}
+}
+
+static void metricsFormat() {
+	unsigned int n = 0;
+	unsigned int t;
+	unsigned int fc;
+	char labels[32];
+	
+	reslen = 0;
+	while( n < VARSMAX && vars[n].value.type != VAL_NONE ) {
+		n++;
+	}
+	res_printf("# TYPE scadasim_variables gauge\nscadasim_variables %u\n",n);
+	res_printf("# TYPE scadasim_ticks_total counter\nscadasim_ticks_total %llu\n",metrics_ticks);
+	res_printf("# TYPE scadasim_tick_overruns_total counter\nscadasim_tick_overruns_total %llu\n",metrics_tick_overruns);
+	res_printf("# TYPE scadasim_tick_duration_seconds histogram\n");
+	histogramPrint("scadasim_tick_duration_seconds","",&metrics_tick_duration,tick_bounds);
+	
+	res_printf("# TYPE scadasim_modbus_requests_total counter\n");
+	for( t=0; t<METRICSTRANSPORTS; t++ ) {
+		for( fc=0; fc<METRICSFCS; fc++ ) {
+			if( metrics_modbus_requests[t][fc] ) {
+				res_printf("scadasim_modbus_requests_total{transport=\"%s\",function=\"%u\"} %llu\n",
+					transport_names[t],fc,metrics_modbus_requests[t][fc]);
+			}
+		}
+	}
+	res_printf("# TYPE scadasim_modbus_exceptions_total counter\n");
+	for( t=0; t<METRICSTRANSPORTS; t++ ) {
+		for( fc=0; fc<METRICSFCS; fc++ ) {
+			if( metrics_modbus_exceptions[t][fc] ) {
+				res_printf("scadasim_modbus_exceptions_total{transport=\"%s\",function=\"%u\"} %llu\n",
+					transport_names[t],fc,metrics_modbus_exceptions[t][fc]);
+			}
+		}
+	}
+	res_printf("# TYPE scadasim_modbus_request_duration_seconds histogram\n");
+	for( fc=0; fc<METRICSFCS; fc++ ) {
+		if( metrics_modbus_duration[fc].count ) {
+			snprintf(labels,sizeof(labels),"function=\"%u\"",fc);
+			histogramPrint("scadasim_modbus_request_duration_seconds",labels,&metrics_modbus_duration[fc],modbus_bounds);
+		}
+	}
+	res_printf("# TYPE scadasim_modbus_rtu_frames_total counter\nscadasim_modbus_rtu_frames_total %llu\n",metrics_rtu_frames);
+	res_printf("# TYPE scadasim_modbus_rtu_errors_total counter\n");
+	res_printf("scadasim_modbus_rtu_errors_total{error=\"crc\"} %llu\n",metrics_rtu_crc_errors);
+	res_printf("scadasim_modbus_rtu_errors_total{error=\"overrun\"} %llu\n",metrics_rtu_overruns);
+	res_printf("scadasim_modbus_rtu_errors_total{error=\"timeout\"} %llu\n",metrics_rtu_timeouts);
+	res_printf("scadasim_modbus_rtu_errors_total{error=\"gap\"} %llu\n",metrics_rtu_gaps);
+	res_printf("# TYPE scadasim_modbus_cache_total counter\n");
+	res_printf("scadasim_modbus_cache_total{result=\"hit\"} %llu\n",metrics_modbus_cache_hits);
+	res_printf("scadasim_modbus_cache_total{result=\"miss\"} %llu\n",metrics_modbus_cache_misses);
+	
+	res_printf("# TYPE scadasim_iec61850_updates_total counter\nscadasim_iec61850_updates_total %llu\n",metrics_iec61850_updates);
+	res_printf("# TYPE scadasim_goose_published_total counter\n");
+	res_printf("scadasim_goose_published_total{dataset=\"events\"} %llu\n",metrics_goose_events);
+	res_printf("scadasim_goose_published_total{dataset=\"measurements\"} %llu\n",metrics_goose_measurements);
+	if( reslen > METRICSRESMAX ) {
+		reslen = METRICSRESMAX;
+	}
+}
+
+static void metricsClose(unsigned int i) {
+	close(clients[i]);
+	clients[i] = -1;
+	clientlen[i] = 0;
+}
+
+static void metricsRespond(unsigned int i) {
+	char head[160];
+	int len;
+	if( strncmp(clientreq[i],"GET /metrics ",13) == 0 || strncmp(clientreq[i],"GET /metrics?",13) == 0 ) {
+		metricsFormat();
+		len = snprintf(head,sizeof(head),"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",reslen);
+	}
+	else {
+		reslen = 0;
+		len = snprintf(head,sizeof(head),"HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+	}
+	//The reply is small enough for the socket buffer; give up rather
+	//than stall the simulation if it is not
+	send(clients[i],head,len,MSG_DONTWAIT|MSG_NOSIGNAL);
+	send(clients[i],response,reslen,MSG_DONTWAIT|MSG_NOSIGNAL);
+	metricsClose(i);
+}
+
+int metricsServ() {
+	struct sockaddr_in addr;
+	unsigned int i;
+	int on = 1;
+	for( i=0; i<METRICSCLIENTSMAX; i++ ) {
+		clients[i] = -1;
+	}
+	metricsfd = socket(AF_INET,SOCK_STREAM,0);
+	if( metricsfd < 0 ) {
+		return -1;
+	}
+	setsockopt(metricsfd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(metrics_port);
+	if( bind(metricsfd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(metricsfd,METRICSCLIENTSMAX) < 0 ) {
+		close(metricsfd);
+		metricsfd = -1;
+		return -1;
+	}
+	fcntl(metricsfd,F_SETFL,O_NONBLOCK);
+	return 0;
+}
+#endif //LINUX
+
+void metricsProcess() {
+	#ifdef LINUX
+	unsigned int i;
+	int fd;
+	ssize_t len;
+	if( metricsfd == -1 ) {
+		return;
+	}
+	while( (fd = accept(metricsfd,0,0)) >= 0 ) {
+		for( i=0; i<METRICSCLIENTSMAX && clients[i] != -1; i++ );
+		if( i == METRICSCLIENTSMAX ) {
+			close(fd);
+			continue;
+		}
+		fcntl(fd,F_SETFL,O_NONBLOCK);
+		clients[i] = fd;
+		clientlen[i] = 0;
+	}
+	for( i=0; i<METRICSCLIENTSMAX; i++ ) {
+		if( clients[i] == -1 ) {
+			continue;
+		}
+		len = recv(clients[i],clientreq[i]+clientlen[i],METRICSREQMAX-1-clientlen[i],0);
+		if( len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ) {
+			metricsClose(i);
+			continue;
+		}
+		if( len < 0 ) {
+			continue;
+		}
+		clientlen[i] += len;
+		clientreq[i][clientlen[i]] = 0;
+		//Only the request line matters; answer once the headers are in
+		if( strstr(clientreq[i],"\r\n\r\n") || strstr(clientreq[i],"\n\n") || clientlen[i] == METRICSREQMAX-1 ) {
+			metricsRespond(i);
+		}
+	}
+	#endif //LINUX
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+#define METRICS_RTU 0
+#define METRICS_TCP 1
+#define METRICS_UDP 2
+#define METRICSTRANSPORTS 3
+#define METRICSFCS 128
+#define METRICSBUCKETS 9
+
+typedef struct {
+	unsigned long long counts[METRICSBUCKETS+1];  //last one is +Inf
+	unsigned long long sum_ns;
+	unsigned long long count;
+} histogram_t;
+
+//Counters are only written from the main loop (which also serves the
+//metrics requests), so they are plain integers
+#ifndef __METRICS_C__
+extern unsigned long long metrics_ticks;
+extern unsigned long long metrics_tick_overruns;
+extern histogram_t metrics_tick_duration;
+extern unsigned long long metrics_modbus_requests[METRICSTRANSPORTS][METRICSFCS];
+extern unsigned long long metrics_modbus_exceptions[METRICSTRANSPORTS][METRICSFCS];
+extern histogram_t metrics_modbus_duration[METRICSFCS];
+extern unsigned long long metrics_rtu_frames;
+extern unsigned long long metrics_rtu_crc_errors;
+extern unsigned long long metrics_rtu_overruns;
+extern unsigned long long metrics_rtu_timeouts;
+extern unsigned long long metrics_rtu_gaps;
+extern unsigned long long metrics_modbus_cache_hits;
+extern unsigned long long metrics_modbus_cache_misses;
+extern unsigned long long metrics_iec61850_updates;
+extern unsigned long long metrics_goose_events;
+extern unsigned long long metrics_goose_measurements;
+extern uint16_t metrics_port;
+#endif //__METRICS_C__
+
+void metricsTick(unsigned long long start);
+void metricsModbus(unsigned int transport, uint8_t fc, uint8_t resfc, unsigned long long start);
+int metricsServ();
+void metricsProcess();
+
+#endif //__METRICS_H__
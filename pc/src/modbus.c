@@ -26,107 +26,253 @@
 #define __MODBUS_C__
 #include "modbus.h"
 #include "pointvar.h"
+#include "var.h"
 #include "compat.h"
+#include "metrics.h"
+#include "crc16.h"
+#include <string.h>
 
-#define MODBUSMSGLEN 1024
 #define RXTIMEOUT 250
+#define DEVIDMAX  254 //unit id and the 253 byte PDU an RTU frame can carry
+#define CACHESLOTS  16
+#define CACHEMSGLEN 256 //up to a 125 register read
+
+//Responses to reads (FC1-4), good while ticks, varsVersion and
+//valuesVersion are what they were when the entry was filled.  A tick, a
+//console line or any write drops them all.
+typedef struct {
+	uint8_t req[6];          //unit, function, start and count
+	uint8_t crc_valid;
+	uint16_t crc;            //RTU CRC of the response
+	uint16_t len;            //0 for an empty slot
+	unsigned int ticks;
+	unsigned int vars_version;
+	unsigned int values_version;
+	uint8_t res[CACHEMSGLEN];
+} cache_t;
 
 uint8_t modbus_address = 0;
+char modbus_devid[MODBUSIDOBJS][MODBUSIDLEN];
+uint8_t modbus_cache = 1;
 
-static uint8_t req[MODBUSMSGLEN];
-static uint16_t req_len;
+modbusport_t modbus_port;
 static uint8_t res[MODBUSMSGLEN];
 static uint16_t res_len;
-static uint16_t calc_crc;
-static uint16_t msg_idx;
-static unsigned long last_recv;
+static cache_t cache[CACHESLOTS];
+static cache_t* cache_entry; //entry that answered the last request
 
+static int validCrc(uint8_t* req, uint16_t len) {
+	uint16_t crc = crc16(req,len-2);
+	if( (crc&0xFF) == req[len-2] &&
+			(crc>>8)	 == req[len-1] ) {
+			return 1;
+	}
+	else {
+		return 0;
+	}
+}
 
-static const uint16_t CRC16TABLE[256] = {
-	0x0000,0xC0C1,0xC181,0x0140,0xC301,0x03C0,0x0280,0xC241,
-	0xC601,0x06C0,0x0780,0xC741,0x0500,0xC5C1,0xC481,0x0440,
-	0xCC01,0x0CC0,0x0D80,0xCD41,0x0F00,0xCFC1,0xCE81,0x0E40,
-	0x0A00,0xCAC1,0xCB81,0x0B40,0xC901,0x09C0,0x0880,0xC841,
-	0xD801,0x18C0,0x1980,0xD941,0x1B00,0xDBC1,0xDA81,0x1A40,
-	0x1E00,0xDEC1,0xDF81,0x1F40,0xDD01,0x1DC0,0x1C80,0xDC41,
-	0x1400,0xD4C1,0xD581,0x1540,0xD701,0x17C0,0x1680,0xD641,
-	0xD201,0x12C0,0x1380,0xD341,0x1100,0xD1C1,0xD081,0x1040,
-	0xF001,0x30C0,0x3180,0xF141,0x3300,0xF3C1,0xF281,0x3240,
-	0x3600,0xF6C1,0xF781,0x3740,0xF501,0x35C0,0x3480,0xF441,
-	0x3C00,0xFCC1,0xFD81,0x3D40,0xFF01,0x3FC0,0x3E80,0xFE41,
-	0xFA01,0x3AC0,0x3B80,0xFB41,0x3900,0xF9C1,0xF881,0x3840,
-	0x2800,0xE8C1,0xE981,0x2940,0xEB01,0x2BC0,0x2A80,0xEA41,
-	0xEE01,0x2EC0,0x2F80,0xEF41,0x2D00,0xEDC1,0xEC81,0x2C40,
-	0xE401,0x24C0,0x2580,0xE541,0x2700,0xE7C1,0xE681,0x2640,
-	0x2200,0xE2C1,0xE381,0x2340,0xE101,0x21C0,0x2080,0xE041,
-	0xA001,0x60C0,0x6180,0xA141,0x6300,0xA3C1,0xA281,0x6240,
-	0x6600,0xA6C1,0xA781,0x6740,0xA501,0x65C0,0x6480,0xA441,
-	0x6C00,0xACC1,0xAD81,0x6D40,0xAF01,0x6FC0,0x6E80,0xAE41,
-	0xAA01,0x6AC0,0x6B80,0xAB41,0x6900,0xA9C1,0xA881,0x6840,
-	0x7800,0xB8C1,0xB981,0x7940,0xBB01,0x7BC0,0x7A80,0xBA41,
-	0xBE01,0x7EC0,0x7F80,0xBF41,0x7D00,0xBDC1,0xBC81,0x7C40,
-	0xB401,0x74C0,0x7580,0xB541,0x7700,0xB7C1,0xB681,0x7640,
-	0x7200,0xB2C1,0xB381,0x7340,0xB101,0x71C0,0x7080,0xB041,
-	0x5000,0x90C1,0x9181,0x5140,0x9301,0x53C0,0x5280,0x9241,
-	0x9601,0x56C0,0x5780,0x9741,0x5500,0x95C1,0x9481,0x5440,
-	0x9C01,0x5CC0,0x5D80,0x9D41,0x5F00,0x9FC1,0x9E81,0x5E40,
-	0x5A00,0x9AC1,0x9B81,0x5B40,0x9901,0x59C0,0x5880,0x9841,
-	0x8801,0x48C0,0x4980,0x8941,0x4B00,0x8BC1,0x8A81,0x4A40,
-	0x4E00,0x8EC1,0x8F81,0x4F40,0x8D01,0x4DC0,0x4C80,0x8C41,
-	0x4400,0x84C1,0x8581,0x4540,0x8701,0x47C0,0x4680,0x8641,
-	0x8201,0x42C0,0x4380,0x8341,0x4100,0x81C1,0x8081,0x4040,
-};
+//Length of the RTU frame at the start of req from its function code, 0
+//while more bytes are needed to tell and -1 for function codes whose
+//length is not known (those frames end at a T3.5 silence)
+static int frameLength(uint8_t* req, uint16_t req_len) {
+	if( req_len < 2 ) { return 0; }
+	switch( req[1] ) {
+		case 1: case 2: case 3: case 4: case 5: case 6: case 8:
+			return 8;
+		case 7: case 11: case 12: case 17:
+			return 4;
+		case 15: case 16:
+			return req_len < 7 ? 0 : 9+req[6];
+		case 20: case 21:
+			return req_len < 3 ? 0 : 5+req[2];
+		case 22:
+			return 10;
+		case 23:
+			return req_len < 11 ? 0 : 13+req[10];
+		case 24:
+			return 6;
+		case 43:
+			return req_len < 3 ? 0 : req[2] == 14 ? 7 : -1;
+		default:
+			return -1;
+	}
+}
 
-static void calcCrc(uint8_t* msg, uint16_t len) {
-	calc_crc = 0xFFFF;
-	for(msg_idx=0; msg_idx<len; msg_idx++) {
-		calc_crc = (calc_crc>>8) ^ CRC16TABLE[(calc_crc^msg[msg_idx]) & 0xFF];
+//Move the count points starting at the address at pos into the port's
+//window, returns 0 if they do not fit
+static int windowRange(modbusport_t* p, uint8_t* pos, uint32_t count) {
+	uint32_t offset = (pos[0]<<8) | pos[1];
+	if( offset+count > p->count ) {
+		return 0;
 	}
+	offset += p->base;
+	pos[0] = offset>>8;
+	pos[1] = offset&0xFF;
+	return 1;
 }
-	 
-static int validCrc() {
-	calcCrc(req,req_len-2);
-	if( (calc_crc&0xFF) == req[req_len-2] &&
-			(calc_crc>>8)	 == req[req_len-1] ) {
-			return 1;
+
+//Move the point ranges of a request into the port's window, returns 0 if
+//they do not fit
+static int frameWindow(modbusport_t* p, uint8_t* req) {
+	if( p->count == 0 ) {
+		return 1;
 	}
-	else {
-		return 0;
+	switch( req[1] ) {
+		case 1: case 2: case 3: case 4: case 15: case 16:
+			return windowRange(p,req+2,(req[4]<<8) | req[5]);
+		case 5: case 6: case 22:
+			return windowRange(p,req+2,1);
+		case 23:
+			return windowRange(p,req+2,(req[4]<<8) | req[5]) &&
+				windowRange(p,req+6,(req[8]<<8) | req[9]);
+		default:
+			return 1;
 	}
 }
 
-static int inputRequest() {
-	int c = scadaReadByte();
-	if( c == -1 ) { return 0; }
-	if( compatMillis() - last_recv > RXTIMEOUT ) {
-		req_len = 0;
-	}
-	last_recv = compatMillis();
-	req[req_len++] = (int8_t) c;
-	if( req_len == MODBUSMSGLEN ) {
-		req_len = 0;
-	}
-	if( req_len > 1 ) {
-		if( (req[1]	< 7 && req_len == 8) ||
-			(req[1] == 7 && req_len == 4) ||
-			(req[1] == 8 && req_len == 8) ||
-		    ( (req[1] == 15 || req[1] == 16) && req_len > 6 && req_len == (9 + req[6]) ) ) {
-			if( validCrc() ) { 
-				if( req[0] == 0 || req[0] == modbus_address ) {
-					return 1;
-				}
+//Handle the len byte frame at the start of the port's receive buffer
+static void inputFrame(modbusport_t* p, uint16_t len) {
+	uint8_t* req = p->rx;
+	unsigned long long start;
+	uint16_t crc;
+	if( len < 4 || !validCrc(req,len) ) {
+		p->crc_errors++;
+		metrics_rtu_crc_errors++;
+		return;
+	}
+	p->frames++;
+	metrics_rtu_frames++;
+	if( p->gap ) {
+		p->gaps++;
+		metrics_rtu_gaps++;
+	}
+	if( req[0] != 0 && req[0] != p->address && !pointUnit(req[0]) ) {
+		return;
+	}
+	start = compatNanos();
+	cache_entry = 0;
+	if( frameWindow(p,req) ) {
+		modbusProcessRequest(req, res, &res_len);
+	}
+	else {
+		res[1] = req[1]|0x80;
+		res[2] = 2; //Illegal data address
+		res_len = 3;
+	}
+	metricsModbus(METRICS_RTU,req[1],res[1],start);
+	p->requests++;
+	res[0] = req[0];
+	
+	//Send the response if request was not a broadcast
+	if( req[0] ) {
+		if( cache_entry && cache_entry->crc_valid ) {
+			crc = cache_entry->crc;
+		}
+		else {
+			crc = crc16(res,res_len);
+			if( cache_entry ) {
+				cache_entry->crc = crc;
+				cache_entry->crc_valid = 1;
 			}
-			req_len = 0; 
 		}
+		p->send(p,res,res_len,crc);
 	}
-	return 0;
+}
+
+static void scadaSend(modbusport_t* p, uint8_t* msg, uint16_t len, uint16_t crc) {
+	scadaWriteMsgWithCRC(msg,len,crc);
+}
+
+void modbusPortBegin(modbusport_t* p) {
+	memset(p,0,sizeof(*p));
+	p->fd = -1;
+	p->send = scadaSend;
 }
 
 void modbusBegin() {
+	uint8_t i;
 	modbus_address = 0;
-	req_len = 0;
+	modbus_cache = 1;
+	for( i=0; i<CACHESLOTS; i++ ) {
+		cache[i].len = 0;
+	}
+	cache_entry = 0;
+	for( i=0; i<MODBUSIDOBJS; i++ ) {
+		modbus_devid[i][0] = 0;
+	}
 	res_len = 0;
-	last_recv = 0;
+	modbusPortBegin(&modbus_port);
+}
+
+//Device identification object, the basic objects fall back to defaults
+const char* modbusDevId(uint8_t id) {
+	if( modbus_devid[id][0] == 0 ) {
+		switch( id ) {
+			case MODBUSID_VENDOR:
+			case MODBUSID_PRODUCT:
+				return "scadasim";
+			case MODBUSID_REVISION:
+				return "1.0";
+		}
+	}
+	return modbus_devid[id];
+}
+
+//Read device identification (FC43 MEI type 14).  Objects that do not fit
+//in one response are left for the master to ask for with "more follows".
+static int deviceId(uint8_t* req, uint8_t* res, uint16_t* res_len) {
+	uint8_t code = req[3];
+	uint8_t id = req[4];
+	uint8_t last;
+	uint16_t len;
+	uint16_t n;
+	const char* obj;
+	if( req[2] != 14 ) {
+		res[2] = 1; //Error Code
+		return 0;
+	}
+	if( code < 1 || code > 4 ) {
+		res[2] = 3; //Error Code
+		return 0;
+	}
+	last = code == 1 ? MODBUSID_REVISION : MODBUSIDOBJS-1;
+	if( code == 4 ) {
+		if( id >= MODBUSIDOBJS || modbusDevId(id)[0] == 0 ) {
+			res[2] = 2; //Error Code
+			return 0;
+		}
+		last = id;
+	}
+	else if( id > last ) {
+		id = 0;
+	}
+	res[2] = 14;
+	res[3] = code;
+	res[4] = 0x82; //Regular identification, stream and individual access
+	res[5] = 0;    //More follows
+	res[6] = 0;    //Next object id
+	res[7] = 0;    //Number of objects
+	len = 8;
+	for( ; id <= last; id++ ) {
+		obj = modbusDevId(id);
+		n = strlen(obj);
+		if( n == 0 && id > MODBUSID_REVISION ) {
+			continue;
+		}
+		if( len+2+n > DEVIDMAX ) {
+			res[5] = 0xFF;
+			res[6] = id;
+			break;
+		}
+		res[len++] = id;
+		res[len++] = n;
+		memcpy(res+len,obj,n);
+		len += n;
+		res[7]++;
+	}
+	*res_len = len;
+	return 1;
 }
 
 //Caller must fill in the modbus address (first byte of res)
@@ -138,7 +284,24 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 	uint8_t digital_value;
 	uint8_t byte_count;
 	uint8_t bit_count;
+	uint16_t write_offset;
+	uint16_t write_count;
 	int success;
+	cache_t* c = 0;
+	
+	cache_entry = 0;
+	if( modbus_cache && req[1] >= 1 && req[1] <= 4 ) {
+		c = cache + ((req[0] + req[1]*3 + req[3]*5 + req[5]*7) & (CACHESLOTS-1));
+		if( c->len && c->ticks == ticks && c->vars_version == varsVersion &&
+				c->values_version == valuesVersion && memcmp(c->req,req,6) == 0 ) {
+			memcpy(res+1,c->res+1,c->len-1);
+			*res_len = c->len;
+			cache_entry = c;
+			metrics_modbus_cache_hits++;
+			return;
+		}
+		metrics_modbus_cache_misses++;
+	}
 	
 	//res[0] = modbus_address;
 	res[1] = req[1];
@@ -158,7 +321,7 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 				}
 				res[2+res[2]] = 0;
 			}
-			success = getDO(offset+i,&digital_value);
+			success = getDO(req[0],offset+i,&digital_value);
 			if( !success ) { 
 				res[2] = 2; //Error Code
 				break; 
@@ -182,7 +345,7 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 				}
 				res[2+res[2]] = 0;
 			}
-			success = getDI(offset+i,&digital_value);
+			success = getDI(req[0],offset+i,&digital_value);
 			if( !success ) { 
 				res[2] = 2; //Error Code
 				break; 
@@ -195,7 +358,7 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 	else if( req[1] == 3 ) {
 		res[2] = 0; //Byte Count
 		for( i=0; i<count; i++ ) {
-			success = getAO(offset+i,&analog_value);
+			success = getAO(req[0],offset+i,&analog_value);
 			if( !success ) { 
 				res[2] = 2; //Error Code
 				break; 
@@ -214,7 +377,7 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 	else if( req[1] == 4 ) {
 		res[2] = 0; //Byte Count
 		for( i=0; i<count; i++ ) {
-			success = getAI(offset+i,&analog_value);
+			success = getAI(req[0],offset+i,&analog_value);
 			if( !success ) { 
 				res[2] = 2; //Error Code
 				break; 
@@ -237,10 +400,10 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 		res[5] = req[5];
 		*res_len = 6;	
 		if( count ) { //Count is register value
-			success = setDO(offset,CLOSE);
+			success = setDO(req[0],offset,CLOSE);
 		}
 		else {
-			success = setDO(offset,OPEN);
+			success = setDO(req[0],offset,OPEN);
 		}
 		if( !success ) {
 			res[2] = 2; //Error Code
@@ -252,7 +415,7 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 		res[4] = req[4];
 		res[5] = req[5];
 		*res_len = 6;	
-		success = setAO(offset,count); //Count is register value
+		success = setAO(req[0],offset,count); //Count is register value
 		if( !success ) {
 			res[2] = 2; //Error Code
 		}
@@ -275,10 +438,10 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 		bit_count = 0;
 		for( i=0; i<count; i++ ) {
 			if( req[7+byte_count] & (1<<bit_count) ) {
-				success = setDO(offset+i,CLOSE);
+				success = setDO(req[0],offset+i,CLOSE);
 			}
 			else {
-				success = setDO(offset+i,OPEN);
+				success = setDO(req[0],offset+i,OPEN);
 			}
 			if( !success ) {
 				res[2] = 2; //Error Code
@@ -304,7 +467,7 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 		byte_count = 0;
 		for( i=0; i<count; i++ ) {
 			analog_value = (req[7+byte_count] << 8) | req[8+byte_count];
-			success = setAO(offset+i,analog_value);
+			success = setAO(req[0],offset+i,analog_value);
 			if( !success ) {
 				res[2] = 2; //Error Code
 				break;
@@ -321,6 +484,53 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 		res[5] = req[5];
 		*res_len = 6;
 	}
+	else if( req[1] == 22 ) {
+		memcpy(res+2,req+2,6);
+		*res_len = 8;
+		success = getAO(req[0],offset,&analog_value);
+		if( success ) {
+			//count is the AND mask, req[6..7] the OR mask
+			write_count = (req[6]<<8) | req[7];
+			success = setAO(req[0],offset,(analog_value & count) | (write_count & ~count));
+		}
+		if( !success ) {
+			res[2] = 2; //Error Code
+		}
+	}
+	else if( req[1] == 23 ) {
+		//Writes are done before the read, as the spec requires
+		write_offset = (req[6]<<8) | req[7];
+		write_count = (req[8]<<8) | req[9];
+		success = count >= 1 && count <= 125 && write_count >= 1 && write_count <= 121 &&
+			req[10] == write_count*2;
+		if( !success ) {
+			res[2] = 3; //Error Code
+		}
+		for( i=0; success && i<write_count; i++ ) {
+			analog_value = (req[11+i*2] << 8) | req[12+i*2];
+			success = setAO(req[0],write_offset+i,analog_value);
+			if( !success ) {
+				res[2] = 2; //Error Code
+			}
+		}
+		if( success ) {
+			res[2] = 0; //Byte Count
+			for( i=0; i<count; i++ ) {
+				success = getAO(req[0],offset+i,&analog_value);
+				if( !success ) {
+					res[2] = 2; //Error Code
+					break;
+				}
+				res[3+res[2]] = (analog_value>>8);
+				res[4+res[2]] = (analog_value&0xFF);
+				res[2] = res[2] + 2;
+			}
+			*res_len = 3+res[2];
+		}
+	}
+	else if( req[1] == 43 ) {
+		success = deviceId(req,res,res_len);
+	}
 	else {
 		success = 0;
 		res[2] = 1;
@@ -331,30 +541,81 @@ void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len) {
 		res[1] = res[1]|0x80;
 		*res_len = 3;
 	}
+	else if( c && *res_len <= CACHEMSGLEN ) {
+		memcpy(c->req,req,6);
+		memcpy(c->res+1,res+1,*res_len-1);
+		c->res[0] = req[0];
+		c->len = *res_len;
+		c->crc_valid = 0;
+		c->ticks = ticks;
+		c->vars_version = varsVersion;
+		c->values_version = valuesVersion;
+		cache_entry = c;
+	}
 }
 
-void modbusProcess() {
-	while( scadaAvailable() ) {
-		if( inputRequest() ) {
-			//printf("Modbus Request: ");
-			//for( int i=0; i<req_len; i++ ) {
-			//	printf("%02X ",req[i]);
-			//}
-			//printf("\r\n");
-			modbusProcessRequest(req, res, &res_len);
-			res[0] = modbus_address;
-			
-			//Send the response if request was not a broadcast
-			if( req[0] ) {
-				calcCrc(res,res_len);
-				//printf("Modbus Response: ");
-				//for( int i=0; i<res_len; i++ ) {
-				//	printf("%02X ",res[i]);
-				//}
-				//printf("%02X %02X\r\n",calc_crc&0xFF,(calc_crc>>8)&0xFF);
-				scadaWriteMsgWithCRC(res,res_len,calc_crc);
-			}
-			req_len = 0;
+//Frames are handed on as soon as the bytes their function code calls for
+//are in, or at a T3.5 silence for unknown function codes.  Silence is
+//only trusted from a read that came back empty (n == 0), since bytes
+//that arrived while the main loop was busy are all read at once.
+void modbusPortInput(modbusport_t* p, int n, unsigned long long now) {
+	unsigned long long t15;
+	unsigned long long t35;
+	int len;
+	
+	//Character times are 11 bits, fixed above 19200 baud (and for RTU
+	//over TCP) as the Modbus serial line spec recommends
+	if( p->baud == 0 || p->baud > 19200 ) {
+		t15 = 750000;
+		t35 = 1750000;
+	}
+	else {
+		t15 = 16500000000ULL/p->baud;
+		t35 = 38500000000ULL/p->baud;
+	}
+	if( n > 0 ) {
+		p->rx_len += n;
+		p->last_rx = now;
+		while( (len = frameLength(p->rx,p->rx_len)) > 0 && len <= p->rx_len ) {
+			inputFrame(p,len);
+			p->rx_len -= len;
+			memmove(p->rx,p->rx+len,p->rx_len);
+			p->gap = 0;
+		}
+		if( p->rx_len == MODBUSMSGLEN ) {
+			p->overruns++;
+			metrics_rtu_overruns++;
+			p->rx_len = 0;
+			p->gap = 0;
+		}
+	}
+	else if( p->rx_len ) {
+		len = frameLength(p->rx,p->rx_len);
+		if( len == -1 && now-p->last_rx >= t35 ) {
+			inputFrame(p,p->rx_len);
+			p->rx_len = 0;
+			p->gap = 0;
+		}
+		else if( now-p->last_rx >= (unsigned long long)RXTIMEOUT*1000000 ) {
+			//Partial frame of a known length went quiet
+			p->timeouts++;
+			metrics_rtu_timeouts++;
+			p->rx_len = 0;
+			p->gap = 0;
+		}
+		else if( len != -1 && now-p->last_rx >= t15 ) {
+			p->gap = 1;
 		}
 	}
 }
+
+void modbusProcess() {
+	modbusport_t* p = &modbus_port;
+	int n;
+	p->address = modbus_address;
+	p->baud = scadaBaud();
+	do {
+		n = scadaRead(p->rx+p->rx_len,MODBUSMSGLEN-p->rx_len);
+		modbusPortInput(p,n,compatNanos());
+	} while( n > 0 );
+}
@@ -28,12 +28,47 @@
 
 #include <stdint.h>
 
+#define MODBUSMSGLEN 1024
+
+//Device identification objects (FC43/14), by object id
+#define MODBUSIDOBJS        7
+#define MODBUSIDLEN         64
+#define MODBUSID_VENDOR     0
+#define MODBUSID_PRODUCT    1
+#define MODBUSID_REVISION   2
+
+//Receive state of one Modbus RTU line
+typedef struct modbusport_s {
+	uint8_t rx[MODBUSMSGLEN];
+	uint16_t rx_len;
+	uint8_t gap;
+	uint8_t address;
+	unsigned long long last_rx;
+	unsigned long baud;         //0 when the line has no character timing
+	uint16_t base;              //points served are base..base+count-1,
+	uint16_t count;             //every point when count is 0
+	unsigned long long frames;
+	unsigned long long requests;
+	unsigned long long crc_errors;
+	unsigned long long overruns;
+	unsigned long long timeouts;
+	unsigned long long gaps;
+	int fd;
+	void (*send)(struct modbusport_s* p, uint8_t* msg, uint16_t len, uint16_t crc);
+} modbusport_t;
+
 #ifndef __MODBUS_C__
 extern uint8_t modbus_address;
+extern char modbus_devid[MODBUSIDOBJS][MODBUSIDLEN]; //empty for the default
+extern uint8_t modbus_cache;               //reuse read responses within a tick
+extern modbusport_t modbus_port;           //the -s/-t SCADA channel
 #endif //__MODBUS_C__
 
 void modbusBegin();
+const char* modbusDevId(uint8_t id);
 void modbusProcessRequest(uint8_t* req, uint8_t* res, uint16_t* res_len);
 void modbusProcess();
+void modbusPortBegin(modbusport_t* p);
+void modbusPortInput(modbusport_t* p, int n, unsigned long long now);
 
 #endif
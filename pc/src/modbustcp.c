@@ -23,10 +23,12 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _GNU_SOURCE
 #define __MODBUSTCP_C__
 #include "modbustcp.h"
 
 #include <unistd.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -35,11 +37,16 @@
 
 #include "compat.h"
 #include "modbus.h"
+#include "pointvar.h"
+#include "metrics.h"
 
 #define MODBUSMSGLEN 1024
 #define RXTIMEOUT 250
+#define UDPBATCH 32     //datagrams drained per recvmmsg()/sendmmsg() pair
 
 uint16_t modbustcp_port = 0;
+uint16_t modbusudp_port = 0;
+uint8_t modbusudp_shared = 0;   //SO_REUSEPORT, other processes may bind too
 
 static uint8_t req[MODBUSMSGLEN];
 static uint16_t req_len;
@@ -50,6 +57,15 @@ static unsigned long last_recv;
 static int servfd = -1;
 static int comfd	= -1;
 
+static int udpfd = -1;
+static uint8_t udp_req[UDPBATCH][MODBUSMSGLEN];
+static uint8_t udp_res[UDPBATCH][MODBUSMSGLEN];
+static struct sockaddr_in udp_addrs[UDPBATCH];
+static struct iovec udp_rxiovs[UDPBATCH];
+static struct iovec udp_txiovs[UDPBATCH];
+static struct mmsghdr udp_rxmsgs[UDPBATCH];
+static struct mmsghdr udp_txmsgs[UDPBATCH];
+
 static int byteAvailable() {
 	fd_set rfds;
 	struct timeval timeout;
@@ -166,23 +182,39 @@ int modbusTcpServ() {
 }
 
 
+//Answer one complete MBAP framed request (TCP or UDP), returning the
+//length of the framed response
+static uint16_t mbapRespond(uint8_t* req, uint8_t* res, unsigned int transport) {
+	unsigned long long start = compatNanos();
+	uint16_t len;
+	if( pointUnit(req[6]) || pointUnit(0) ) {
+		modbusProcessRequest(req+6,res+6,&len);
+	}
+	else {
+		res[7] = req[7]|0x80;
+		res[8] = 0x0B; //Gateway target device failed to respond
+		len = 3;
+	}
+	metricsModbus(transport,req[7],res[7],start);
+	res[0] = req[0]; //Transation ID
+	res[1] = req[1];
+	res[2] = req[2]; //Protocol ID (already verified)
+	res[3] = req[3]; 
+	res[4] = (len & 0xFF00)>>8;
+	res[5] = (len & 0x00FF);
+	res[6] = req[6]; //unit id
+	return len + 6;
+}
+
 void modbusTcpProcess() {
 	while( byteAvailable() ) {
 		if( inputRequest() ) {
-			modbusProcessRequest(req+6,res+6,&res_len);
 			//printf("ModbusTCP Request: ");
 			//for( int i=0; i<req_len; i++ ) {
 			//	printf("%02X ",req[i]);
 			//}
 			//printf("\r\n");
-			res[0] = req[0]; //Transation ID
-			res[1] = req[1];
-			res[2] = req[2]; //Protocol ID (already verified)
-			res[3] = req[3]; 
-			res[4] = (res_len & 0xFF00)>>8;
-			res[5] = (res_len & 0x00FF);
-			res[6] = req[6]; //unit id (ignored)
-			res_len = res_len + 6;
+			res_len = mbapRespond(req,res,METRICS_TCP);
 			
 			//Send the response
 			//printf("Modbus Response: ");
@@ -198,3 +230,100 @@ void modbusTcpProcess() {
 		}
 	}
 }
+
+void modbusUdpBegin() {
+	if( udpfd != -1 ) {
+		close(udpfd);
+		udpfd = -1;
+	}
+	modbusudp_port = 0;
+	modbusudp_shared = 0;
+}
+
+int modbusUdpServ() {
+	struct sockaddr_in addr;
+	int on = 1;
+	uint16_t port = modbusudp_port;
+	uint8_t shared = modbusudp_shared;
+	unsigned int i;
+	modbusUdpBegin();
+	modbusudp_port = port;
+	modbusudp_shared = shared;
+	
+	if( modbusudp_port == 0 ) {
+		return -1;
+	}
+
+	udpfd = socket(AF_INET,SOCK_DGRAM|SOCK_NONBLOCK,0);
+	if( udpfd < 0 ) { 
+		return -1; 
+	}
+	//Only on request several simulator processes share the port and the
+	//kernel spreads the datagrams across them; otherwise a second bind
+	//fails as it should
+	if( modbusudp_shared ) {
+		setsockopt(udpfd,SOL_SOCKET,SO_REUSEPORT,&on,sizeof(on));
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(modbusudp_port);
+	if( bind( udpfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ) {
+		close(udpfd);
+		udpfd = -1;
+		return -1;
+	}
+	
+	for( i=0; i<UDPBATCH; i++ ) {
+		udp_rxiovs[i].iov_base = udp_req[i];
+		udp_rxiovs[i].iov_len = MODBUSMSGLEN;
+	}
+	return 0;
+}
+
+//Drain every queued datagram, one recvmmsg() and one sendmmsg() per
+//batch of up to UDPBATCH requests
+void modbusUdpProcess() {
+	int n;
+	int i;
+	unsigned int tx;
+	uint16_t len;
+	uint8_t* msg;
+	if( udpfd == -1 ) {
+		return;
+	}
+	do {
+		for( i=0; i<UDPBATCH; i++ ) {
+			memset(&udp_rxmsgs[i].msg_hdr,0,sizeof(struct msghdr));
+			udp_rxmsgs[i].msg_hdr.msg_name = &udp_addrs[i];
+			udp_rxmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			udp_rxmsgs[i].msg_hdr.msg_iov = &udp_rxiovs[i];
+			udp_rxmsgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		n = recvmmsg(udpfd,udp_rxmsgs,UDPBATCH,MSG_DONTWAIT,0);
+		if( n <= 0 ) {
+			return;
+		}
+		tx = 0;
+		for( i=0; i<n; i++ ) {
+			//One complete MBAP frame per datagram, anything else is dropped
+			msg = udp_req[i];
+			len = udp_rxmsgs[i].msg_len;
+			if( len < 8 || (udp_rxmsgs[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+			    ((msg[4]<<8) | msg[5]) + 6 != len || msg[2] != 0 || msg[3] != 0 ) {
+				continue;
+			}
+			udp_txiovs[tx].iov_base = udp_res[i];
+			udp_txiovs[tx].iov_len = mbapRespond(msg,udp_res[i],METRICS_UDP);
+			memset(&udp_txmsgs[tx].msg_hdr,0,sizeof(struct msghdr));
+			udp_txmsgs[tx].msg_hdr.msg_name = &udp_addrs[i];
+			udp_txmsgs[tx].msg_hdr.msg_namelen = udp_rxmsgs[i].msg_hdr.msg_namelen;
+			udp_txmsgs[tx].msg_hdr.msg_iov = &udp_txiovs[tx];
+			udp_txmsgs[tx].msg_hdr.msg_iovlen = 1;
+			tx++;
+		}
+		if( tx ) {
+			sendmmsg(udpfd,udp_txmsgs,tx,MSG_DONTWAIT);
+		}
+	} while( n == UDPBATCH );
+}
@@ -30,10 +30,15 @@
 
 #ifndef __MODBUSTCP_C__
 extern uint16_t modbustcp_port;
+extern uint16_t modbusudp_port;
+extern uint8_t modbusudp_shared;
 #endif //__MODBUSTCP_C__
 
 void modbusTcpBegin();
 int modbusTcpServ();
 void modbusTcpProcess();
+void modbusUdpBegin();
+int modbusUdpServ();
+void modbusUdpProcess();
 
 #endif
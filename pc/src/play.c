@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __PLAY_C__
+#include "play.h"
+#include "hist.h"
+#include "table.h"
+#include "var.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif //LINUX
+
+//Variables are driven from the columns of a CSV file (a header line of
+//column names followed by one line of comma separated numbers per row)
+//or of a recording made with the record command.  The file is mapped
+//and read with a cursor, so only the rows around the current position
+//are ever touched.  Without "time" every tick plays the next row.  With
+//it rows are placed by their time (the time_ms column, or else the first
+//column in seconds) and the simulation advances TICKDELAY ms per tick.
+
+char play_path[256];
+uint8_t play_linear;
+uint8_t play_loop;
+uint8_t play_time;
+uint8_t play_active;
+uint8_t play_done;
+unsigned long play_rows;
+unsigned long play_loops;
+uint8_t play_bound[VARSMAX];
+
+static char play_names[PLAYNAMESMAX];
+static char play_cols[PLAYNAMESMAX];
+static var_t* play_vars[PLAYVARSMAX];
+static unsigned int play_nvars;
+static unsigned int play_version;
+
+static const char* data;
+static size_t datalen;
+static size_t first;            //offset of the first row or block
+static size_t cursor;
+static uint8_t binary;
+
+//CSV
+static int* colmap;             //binding of every file column, or -1
+static unsigned int ncols;
+static int keycol;
+static double keyscale;         //ms per unit of the time column
+
+//Recordings
+static unsigned int bincol[PLAYVARSMAX];
+static val_t blockvals[PLAYVARSMAX][HISTBLOCKTICKS];
+static val_t blockms[HISTBLOCKTICKS];
+static unsigned int blockrow;
+static unsigned int blockcount;
+static uint32_t blockmsacc;
+
+//The row being played and, in time mode, the one after it
+static val_t prevrow[PLAYVARSMAX];
+static val_t nextrow[PLAYVARSMAX];
+static double prevkey;
+static double nextkey;
+static uint8_t havenext;
+static double firstkey;
+static unsigned int startticks;
+
+static void playUnmap() {
+	if( data ) {
+		#ifdef LINUX
+		munmap((void*)data,datalen);
+		#else
+		free((void*)data);
+		#endif //LINUX
+	}
+	data = 0;
+	datalen = 0;
+}
+
+static int playMap(char* path) {
+	#ifdef LINUX
+	struct stat st;
+	void* map;
+	int fd = open(path,O_RDONLY);
+	if( fd < 0 ) {
+		return 0;
+	}
+	if( fstat(fd,&st) < 0 || st.st_size == 0 ) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if( map == MAP_FAILED ) {
+		return 0;
+	}
+	madvise(map,st.st_size,MADV_SEQUENTIAL);
+	data = map;
+	datalen = st.st_size;
+	#else
+	//No mmap; read the whole file
+	FILE* fp = fopen(path,"rb");
+	char* buf;
+	long len;
+	if( fp == 0 ) {
+		return 0;
+	}
+	fseek(fp,0,SEEK_END);
+	len = ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	buf = len > 0 ? malloc(len) : 0;
+	if( buf == 0 || fread(buf,1,len,fp) != (size_t)len ) {
+		free(buf);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	data = buf;
+	datalen = len;
+	#endif //LINUX
+	return 1;
+}
+
+void playReset() {
+	playUnmap();
+	free(colmap);
+	colmap = 0;
+	ncols = 0;
+	table_init(play_names);
+	table_init(play_cols);
+	play_nvars = 0;
+	memset(play_bound,0,sizeof(play_bound));
+	play_path[0] = 0;
+	play_linear = 0;
+	play_loop = 0;
+	play_time = 0;
+	play_active = 0;
+	play_done = 0;
+	play_rows = 0;
+	play_loops = 0;
+}
+
+int playBind(char* name, unsigned int len, char* col, unsigned int collen) {
+	if( play_active || play_nvars >= PLAYVARSMAX ) {
+		return 0;
+	}
+	if( table_add(play_names,PLAYNAMESMAX,name,len,0) == 0 ) {
+		return 0;
+	}
+	if( table_add(play_cols,PLAYNAMESMAX,col,collen,0) == 0 ) {
+		return 0;
+	}
+	play_nvars++;
+	return 1;
+}
+
+static char* playEntry(char* table, unsigned int idx) {
+	while( *table != 0 ) {
+		if( idx == 0 ) {
+			return table;
+		}
+		table = table_next(table);
+		idx--;
+	}
+	return 0;
+}
+
+//col is set to 0 when the column has the variable's name
+char* playBinding(unsigned int idx, char** col) {
+	char* name = playEntry(play_names,idx);
+	char* n;
+	char* c;
+	if( name == 0 ) {
+		return 0;
+	}
+	*col = playEntry(play_cols,idx);
+	for( n=name, c=*col; *n == *c && (*n&0x80) == 0; n++, c++ );
+	if( *n == *c ) {
+		*col = 0;
+	}
+	return name;
+}
+
+static void playResolve() {
+	char* entry = play_names;
+	char* n;
+	unsigned int i = 0;
+	memset(play_bound,0,sizeof(play_bound));
+	while( *entry != 0 && i < play_nvars ) {
+		n = table_next(entry);
+		play_vars[i] = get_var(entry,n-entry);
+		if( play_vars[i] ) {
+			play_bound[play_vars[i]-vars] = 1;
+		}
+		entry = n;
+		i++;
+	}
+	play_version = varsVersion;
+}
+
+//Copy one field (without quotes) and step over it.  Returns 1 if
+//another field follows on the same line.
+static int csvField(const char** p, char* field, unsigned int max) {
+	const char* end = data+datalen;
+	unsigned int len = 0;
+	while( *p < end && (**p == ' ' || **p == '\t') ) {
+		(*p)++;
+	}
+	while( *p < end && **p != ',' && **p != '\n' && **p != '\r' ) {
+		if( **p != '"' && len < max-1 ) {
+			field[len++] = **p;
+		}
+		(*p)++;
+	}
+	while( len > 0 && (field[len-1] == ' ' || field[len-1] == '\t') ) {
+		len--;
+	}
+	field[len] = 0;
+	if( *p < end && **p == ',' ) {
+		(*p)++;
+		return 1;
+	}
+	return 0;
+}
+
+static void csvValue(char* field, val_t* v) {
+	char* end;
+	v->type = VAL_NONE;
+	v->i = 0;
+	if( strpbrk(field,".eEnN") ) {
+		double d = strtod(field,&end);
+		if( end != field ) {
+			SET_FLOAT(*v,(float)d);
+		}
+	}
+	else {
+		long l = strtol(field,&end,0);
+		if( end != field ) {
+			SET_INT(*v,(int)l);
+		}
+	}
+}
+
+static int csvHeader() {
+	const char* p = data;
+	char field[256];
+	uint8_t seen[PLAYVARSMAX];
+	unsigned int found = 0;
+	int* grown;
+	int idx;
+	int more;
+	memset(seen,0,sizeof(seen));
+	keycol = play_time ? 0 : -1;
+	keyscale = 1000.0;
+	do {
+		more = csvField(&p,field,sizeof(field));
+		grown = realloc(colmap,(ncols+1)*sizeof(int));
+		if( grown == 0 ) {
+			return 0;
+		}
+		colmap = grown;
+		idx = field[0] ? table_scan(play_cols,field,strlen(field)) : -1;
+		if( idx >= 0 && ! seen[idx] ) {
+			seen[idx] = 1;
+			found++;
+		}
+		else {
+			idx = -1;
+		}
+		colmap[ncols] = idx;
+		if( play_time && strcmp(field,"time_ms") == 0 ) {
+			keycol = ncols;
+			keyscale = 1.0;
+		}
+		ncols++;
+	} while( more );
+	while( p < data+datalen && *p != '\n' ) {
+		p++;
+	}
+	first = p-data;
+	return found == play_nvars;
+}
+
+static int csvRead(val_t* row, double* key) {
+	const char* p;
+	char field[64];
+	unsigned int col = 0;
+	unsigned int i;
+	int more;
+	while( cursor < datalen && (data[cursor] == '\n' || data[cursor] == '\r') ) {
+		cursor++;
+	}
+	if( cursor >= datalen ) {
+		return 0;
+	}
+	for( i=0; i<play_nvars; i++ ) {
+		row[i].type = VAL_NONE;
+		row[i].i = 0;
+	}
+	*key = 0;
+	p = data+cursor;
+	do {
+		more = csvField(&p,field,sizeof(field));
+		if( col < ncols ) {
+			if( (int)col == keycol ) {
+				*key = strtod(field,0)*keyscale;
+			}
+			if( colmap[col] >= 0 ) {
+				csvValue(field,&row[colmap[col]]);
+			}
+		}
+		col++;
+	} while( more );
+	while( p < data+datalen && *p != '\n' ) {
+		p++;
+	}
+	cursor = p-data;
+	return 1;
+}
+
+static int binHeader() {
+	const histheader_t* header = (const histheader_t*)data;
+	const char* name;
+	unsigned int found = 0;
+	unsigned int i;
+	int idx;
+	if( header->version != HISTVERSION || sizeof(histheader_t)+header->nameslen > datalen ) {
+		return 0;
+	}
+	name = data+sizeof(histheader_t);
+	for( i=0; i<header->nvars; i++ ) {
+		idx = table_scan(play_cols,(char*)name,strlen(name));
+		if( idx >= 0 && bincol[idx] == 0 ) {
+			bincol[idx] = i+2;
+			found++;
+		}
+		name += strlen(name)+1;
+	}
+	first = sizeof(histheader_t)+header->nameslen;
+	return found == play_nvars;
+}
+
+static int binRead(val_t* row, double* key) {
+	const histblock_t* block;
+	unsigned int i;
+	int count;
+	if( blockrow >= blockcount ) {
+		block = (const histblock_t*)(data+cursor);
+		if( cursor+sizeof(histblock_t) > datalen || block->size < sizeof(histblock_t) || cursor+block->size > datalen ) {
+			return 0;
+		}
+		count = histDecodeColumn((const uint8_t*)block,1,blockms);
+		if( count <= 0 ) {
+			return 0;
+		}
+		for( i=0; i<play_nvars; i++ ) {
+			if( histDecodeColumn((const uint8_t*)block,bincol[i],blockvals[i]) < 0 ) {
+				return 0;
+			}
+		}
+		blockcount = count;
+		blockrow = 0;
+		blockmsacc = block->base_ms;
+		cursor += block->size;
+	}
+	blockmsacc += blockms[blockrow].i;
+	*key = blockmsacc;
+	for( i=0; i<play_nvars; i++ ) {
+		row[i] = blockvals[i][blockrow];
+	}
+	blockrow++;
+	return 1;
+}
+
+static int playRead(val_t* row, double* key) {
+	return binary ? binRead(row,key) : csvRead(row,key);
+}
+
+static int playRewind() {
+	cursor = first;
+	blockrow = 0;
+	blockcount = 0;
+	if( play_time ) {
+		if( ! playRead(prevrow,&prevkey) ) {
+			return 0;
+		}
+		firstkey = prevkey;
+		play_rows++;
+		havenext = playRead(nextrow,&nextkey);
+	}
+	return 1;
+}
+
+int play(char* path) {
+	unsigned int len;
+	if( play_nvars == 0 || ! playMap(path) ) {
+		playReset();
+		return 0;
+	}
+	memset(bincol,0,sizeof(bincol));
+	binary = datalen >= sizeof(histheader_t) && memcmp(data,HISTMAGIC,sizeof(HISTMAGIC)) == 0;
+	if( ! (binary ? binHeader() : csvHeader()) || ! playRewind() ) {
+		playReset();
+		return 0;
+	}
+	for( len=0; path[len] && len<sizeof(play_path)-1; len++ ) {
+		play_path[len] = path[len];
+	}
+	play_path[len] = 0;
+	startticks = ticks+1;
+	playResolve();
+	play_active = 1;
+	return 1;
+}
+
+void playTick() {
+	double pos = 0;
+	double f;
+	unsigned int i;
+	val_t v;
+	if( ! play_active || play_done ) {
+		return;
+	}
+	if( play_version != varsVersion ) {
+		playResolve();
+	}
+	if( play_time ) {
+		pos = firstkey + (double)(ticks-startticks)*TICKDELAY;
+		while( havenext && nextkey <= pos ) {
+			memcpy(prevrow,nextrow,play_nvars*sizeof(val_t));
+			prevkey = nextkey;
+			havenext = playRead(nextrow,&nextkey);
+			play_rows++;
+		}
+		if( ! havenext && pos > prevkey ) {
+			if( ! play_loop || ! playRewind() ) {
+				play_done = 1;
+				return;
+			}
+			startticks = ticks;
+			pos = firstkey;
+			play_loops++;
+		}
+	}
+	else {
+		if( ! playRead(prevrow,&prevkey) ) {
+			if( ! play_loop || ! playRewind() || ! playRead(prevrow,&prevkey) ) {
+				play_done = 1;
+				return;
+			}
+			play_loops++;
+		}
+		play_rows++;
+	}
+	
+	for( i=0; i<play_nvars; i++ ) {
+		if( play_vars[i] == 0 || play_vars[i]->override || prevrow[i].type == VAL_NONE ) {
+			continue;
+		}
+		v = prevrow[i];
+		if( play_linear && play_time && havenext && nextkey > prevkey && nextrow[i].type != VAL_NONE ) {
+			f = (pos-prevkey)/(nextkey-prevkey);
+			if( v.type == VAL_INT ) {
+				f = v.i + ((IS_INT(nextrow[i]) ? nextrow[i].i : nextrow[i].f)-v.i)*f;
+				SET_INT(v,(int)(f < 0 ? f-0.5 : f+0.5));
+			}
+			else {
+				f = v.f + ((IS_INT(nextrow[i]) ? nextrow[i].i : nextrow[i].f)-v.f)*f;
+				SET_FLOAT(v,(float)f);
+			}
+		}
+		play_vars[i]->value = v;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PLAY_H__
+#define __PLAY_H__
+
+#include <stdint.h>
+#include "var.h"
+
+#define PLAYVARSMAX  64
+#define PLAYNAMESMAX 1024
+
+#ifndef __PLAY_C__
+extern char play_path[256];
+extern uint8_t play_linear;     //interpolate between rows instead of stepping
+extern uint8_t play_loop;       //start over at the end of the file
+extern uint8_t play_time;       //follow the file's time column, not one row per tick
+extern uint8_t play_active;
+extern uint8_t play_done;
+extern unsigned long play_rows;
+extern unsigned long play_loops;
+extern uint8_t play_bound[VARSMAX];
+#endif //__PLAY_C__
+
+void playReset();
+int playBind(char* name, unsigned int len, char* col, unsigned int collen);
+char* playBinding(unsigned int idx, char** col);
+int play(char* path);
+void playTick();
+
+#endif //__PLAY_H__
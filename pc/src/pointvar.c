@@ -25,148 +25,392 @@
  */
 #include "pointvar.h"
 #include "var.h"
+#include <stdlib.h>
+#include <limits.h>
 
-int setDO(uint16_t do_addr, uint8_t value) {
+//Points are found through an index of var numbers sorted by unit, point
+//group and address, rebuilt whenever the variables change.  Each unit
+//that has points of its own gets a slice of it; every other unit id is
+//served from the points without a unit (unit 0).  A 32 or 64 bit ao/ai
+//point covers the registers from its address on; its key is that of its
+//first register.
+
+#define GROUP_DO 0
+#define GROUP_DI 1
+#define GROUP_AO 2
+#define GROUP_AI 3
+
+static unsigned int pnt_index[VARSMAX];
+static uint32_t pnt_keys[VARSMAX];
+static unsigned int unit_first[256];
+static unsigned int unit_len[256];
+static unsigned int pnt_version;
+static uint8_t pnt_built;
+
+//A multiple register write arrives one register at a time.  The bits
+//written so far are kept while the value is the one they produced, so
+//the value ends up as written even when an int or float cannot hold
+//every intermediate step.
+static var_t* write_var;
+static val_t write_value;
+static uint64_t write_bits;
+
+static uint32_t pointKey(var_t* v) {
+	uint32_t group;
+	switch( v->pnttype ) {
+		case PNT_DO:
+			group = GROUP_DO;
+			break;
+		case PNT_DI:
+			group = GROUP_DI;
+			break;
+		case PNT_AO: case PNT_AO_SCALED:
+			group = GROUP_AO;
+			break;
+		default:
+			group = GROUP_AI;
+	}
+	return ((uint32_t)v->pntunit<<24) | (group<<16) | (v->pntaddr&0xFFFF);
+}
+
+static int pointCmp(const void* a, const void* b) {
+	unsigned int ia = *(const unsigned int*)a;
+	unsigned int ib = *(const unsigned int*)b;
+	if( pnt_keys[ia] != pnt_keys[ib] ) {
+		return pnt_keys[ia] < pnt_keys[ib] ? -1 : 1;
+	}
+	//The first variable with an address wins
+	return ia < ib ? -1 : ia > ib;
+}
+
+static void pointIndex() {
+	unsigned int n = 0;
 	unsigned int i;
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO && vars[i].pntaddr == do_addr ) {
-			vars[i].value.type == VAL_INT;
-			vars[i].value.i = value;
-			if( vars[i].expr ) {
-				set_expr(vars+i,0,0);
-			}
-			return 1;
+	uint8_t unit;
+	for( i=0; i<VARSMAX && vars[i].value.type != VAL_NONE; i++ ) {
+		if( vars[i].pnttype != PNT_NONE ) {
+			pnt_keys[i] = pointKey(vars+i);
+			pnt_index[n++] = i;
 		}
 	}
-	return 0;
+	qsort(pnt_index,n,sizeof(pnt_index[0]),pointCmp);
+	for( i=0; i<256; i++ ) {
+		unit_len[i] = 0;
+	}
+	for( i=n; i-- > 0; ) {
+		unit = pnt_keys[pnt_index[i]]>>24;
+		unit_first[unit] = i;
+		unit_len[unit]++;
+	}
+	pnt_version = varsVersion;
+	pnt_built = 1;
+	write_var = 0;
 }
 
-int getDO(uint16_t do_addr, uint8_t *value) {
-	unsigned int i;
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DO && vars[i].pntaddr == do_addr ) {
-			if( (vars[i].value.type == VAL_INT && vars[i].value.i != 0 ) ||
-				(vars[i].value.type == VAL_FLOAT && vars[i].value.f != 0.0 ) ) {
-					*value = 1;
-			}
-			else {
-				*value = 0;
-			}
-			return 1;
+static unsigned int pointWidth(var_t* v) {
+	switch( v->pntenc & PNTENC_TYPE ) {
+		case PNTENC_INT32: case PNTENC_UINT32: case PNTENC_FLOAT32:
+			return 2;
+		case PNTENC_INT64: case PNTENC_FLOAT64:
+			return 4;
+	}
+	return 1;
+}
+
+//Point holding register addr, with the register's offset within it in reg
+static var_t* findPoint(uint8_t unit, uint32_t group, uint16_t addr, unsigned int* reg) {
+	uint32_t key;
+	uint32_t found;
+	unsigned int first;
+	unsigned int lo;
+	unsigned int hi;
+	unsigned int mid;
+	var_t* v;
+	if( !pnt_built || pnt_version != varsVersion ) {
+		pointIndex();
+	}
+	if( unit_len[unit] == 0 ) {
+		unit = 0;
+	}
+	key = ((uint32_t)unit<<24) | (group<<16) | addr;
+	first = unit_first[unit];
+	lo = first;
+	hi = lo+unit_len[unit];
+	//Find the last point at or below the address
+	while( lo < hi ) {
+		mid = (lo+hi)/2;
+		if( pnt_keys[pnt_index[mid]] <= key ) {
+			lo = mid+1;
+		}
+		else {
+			hi = mid;
 		}
 	}
+	if( lo == first ) {
+		return 0;
+	}
+	found = pnt_keys[pnt_index[--lo]];
+	if( (found>>16) != (key>>16) ) {
+		return 0;
+	}
+	while( lo > first && pnt_keys[pnt_index[lo-1]] == found ) {
+		lo--;
+	}
+	v = vars+pnt_index[lo];
+	*reg = key-found;
+	if( *reg >= pointWidth(v) ) {
+		return 0;
+	}
+	return v;
+}
+
+//Raw bits of the point's value in its register encoding
+static uint64_t pointBits(var_t* v) {
+	union { float f; uint32_t u; } f32;
+	union { double d; uint64_t u; } f64;
+	switch( v->pntenc & PNTENC_TYPE ) {
+		case PNTENC_INT32:
+			return (uint32_t)(v->value.type == VAL_INT ? v->value.i : (int32_t)v->value.f);
+		case PNTENC_UINT32:
+			return (uint32_t)(v->value.type == VAL_INT ? (int64_t)v->value.i : (int64_t)v->value.f);
+		case PNTENC_FLOAT32:
+			f32.f = v->value.type == VAL_INT ? (float)v->value.i : v->value.f;
+			return f32.u;
+		case PNTENC_INT64:
+			return (uint64_t)(v->value.type == VAL_INT ? (int64_t)v->value.i : (int64_t)v->value.f);
+		case PNTENC_FLOAT64:
+			f64.d = v->value.type == VAL_INT ? (double)v->value.i : (double)v->value.f;
+			return f64.u;
+	}
 	return 0;
 }
 
-int getDI(uint16_t di_addr, uint8_t *value) {
-	unsigned int i;
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pnttype == PNT_DI && vars[i].pntaddr == di_addr ) {
-			if( (vars[i].value.type == VAL_INT && vars[i].value.i != 0 ) ||
-				(vars[i].value.type == VAL_FLOAT && vars[i].value.f != 0.0 ) ) {
-					*value = 1;
-			}
-			else {
-				*value = 0;
-			}
-			return 1;
-		}
+//Set the point's value from raw bits, as an int when it fits in one
+static void pointSetBits(var_t* v, uint64_t bits) {
+	union { float f; uint32_t u; } f32;
+	union { double d; uint64_t u; } f64;
+	int64_t i;
+	switch( v->pntenc & PNTENC_TYPE ) {
+		case PNTENC_INT32:
+			i = (int32_t)(uint32_t)bits;
+			break;
+		case PNTENC_UINT32:
+			i = (uint32_t)bits;
+			break;
+		case PNTENC_FLOAT32:
+			f32.u = (uint32_t)bits;
+			v->value.type = VAL_FLOAT;
+			v->value.f = f32.f;
+			return;
+		case PNTENC_INT64:
+			i = (int64_t)bits;
+			break;
+		default:
+			f64.u = bits;
+			v->value.type = VAL_FLOAT;
+			v->value.f = (float)f64.d;
+			return;
+	}
+	if( i >= INT_MIN && i <= INT_MAX ) {
+		v->value.type = VAL_INT;
+		v->value.i = (int)i;
+	}
+	else {
+		v->value.type = VAL_FLOAT;
+		v->value.f = (float)i;
+	}
+}
+
+//Shift of register reg within the point's bits
+static unsigned int pointShift(var_t* v, unsigned int reg) {
+	if( v->pntenc & PNTENC_WORDSWAP ) {
+		return 16*reg;
+	}
+	return 16*(pointWidth(v)-1-reg);
+}
+
+static uint16_t getRegister(var_t* v, unsigned int reg) {
+	uint16_t r = (uint16_t)(pointBits(v) >> pointShift(v,reg));
+	if( v->pntenc & PNTENC_BYTESWAP ) {
+		r = (r<<8) | (r>>8);
+	}
+	return r;
+}
+
+static void setRegister(var_t* v, unsigned int reg, uint16_t value) {
+	unsigned int shift = pointShift(v,reg);
+	uint64_t bits;
+	if( v == write_var && v->value.type == write_value.type && v->value.i == write_value.i ) {
+		bits = write_bits;
+	}
+	else {
+		bits = pointBits(v);
+	}
+	if( v->pntenc & PNTENC_BYTESWAP ) {
+		value = (value<<8) | (value>>8);
+	}
+	bits = (bits & ~((uint64_t)0xFFFF << shift)) | ((uint64_t)value << shift);
+	pointSetBits(v,bits);
+	write_var = v;
+	write_value = v->value;
+	write_bits = bits;
+}
+
+//True if the unit has points of its own (unit 0: points without a unit)
+int pointUnit(uint8_t unit) {
+	if( !pnt_built || pnt_version != varsVersion ) {
+		pointIndex();
+	}
+	return unit_len[unit] != 0;
+}
+
+int setDO(uint8_t unit, uint16_t do_addr, uint8_t value) {
+	unsigned int reg;
+	var_t* v = findPoint(unit,GROUP_DO,do_addr,&reg);
+	if( v ) {
+		valuesVersion++;
+		v->value.type = VAL_INT;
+		v->value.i = value;
+		override_var(v);
+		return 1;
 	}
 	return 0;
 }
 
-int getAI(uint16_t ai_addr, uint16_t *value) {
-	unsigned int i;
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pntaddr == ai_addr ) {
-			if( vars[i].pnttype == PNT_AI ) {
-				if( vars[i].value.type == VAL_INT ) {
-					*value = (uint16_t)vars[i].value.i;
-				}
-				else {
-					*value = (uint16_t)vars[i].value.f;
-				}
-				return 1;
-			}
-			else if( vars[i].pnttype == PNT_AI_SCALED ) {
-				float v;
-				if( vars[i].value.type == VAL_INT ) {
-					if( (float)vars[i].value.i <= vars[i].pntmin ) { 
-						*value = 0;
-						return 1;
-					}
-					else
-						v = (float)vars[i].value.i - vars[i].pntmin;
-				}
-				else {
-					v = vars[i].value.f - vars[i].pntmin;
-				}
-				*value = v/(vars[i].pntmax-vars[i].pntmin)*0xFFFF;
-				return 1;
-			}
+int getDO(uint8_t unit, uint16_t do_addr, uint8_t *value) {
+	unsigned int reg;
+	var_t* v = findPoint(unit,GROUP_DO,do_addr,&reg);
+	if( v ) {
+		if( (v->value.type == VAL_INT && v->value.i != 0 ) ||
+			(v->value.type == VAL_FLOAT && v->value.f != 0.0 ) ) {
+				*value = 1;
 		}
+		else {
+			*value = 0;
+		}
+		return 1;
 	}
 	return 0;
 }
 
-int setAO(uint16_t ao_addr, uint16_t value) {
-	unsigned int i;
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pntaddr == ao_addr ) {
-			if( vars[i].pnttype == PNT_AO ) {
-				vars[i].value.type = VAL_INT;
-				vars[i].value.i = value;
-				set_expr(vars+i,0,0);
-				return 1;
-			}
-			else if( vars[i].pnttype == PNT_AO_SCALED ) {
-				float v = (float)value * (vars[i].pntmax - vars[i].pntmin);
-				vars[i].value.type = VAL_FLOAT;
-				if( v == 0 ) {
-					vars[i].value.f = 0.0;
-				}
-				else {
-					vars[i].value.f = v / (float)0xFFFF;
-				}
-				set_expr(vars+i,0,0);
-				return 1;
-			}
+int getDI(uint8_t unit, uint16_t di_addr, uint8_t *value) {
+	unsigned int reg;
+	var_t* v = findPoint(unit,GROUP_DI,di_addr,&reg);
+	if( v ) {
+		if( (v->value.type == VAL_INT && v->value.i != 0 ) ||
+			(v->value.type == VAL_FLOAT && v->value.f != 0.0 ) ) {
+				*value = 1;
 		}
+		else {
+			*value = 0;
+		}
+		return 1;
 	}
 	return 0;
 }
 
-int getAO(uint16_t ao_addr, uint16_t *value) {
-	unsigned int i;
-	for( i=0; i<VARSMAX; i++ ) {
-		if( vars[i].pntaddr == ao_addr ) {
-			if( vars[i].pnttype == PNT_AO ) {
-				if( vars[i].value.type == VAL_INT ) {
-					*value = (uint16_t)vars[i].value.i;
-				}
-				else {
-					*value = (uint16_t)vars[i].value.f;
-				}
+int getAI(uint8_t unit, uint16_t ai_addr, uint16_t *value) {
+	unsigned int reg;
+	var_t* v = findPoint(unit,GROUP_AI,ai_addr,&reg);
+	if( v == 0 ) {
+		return 0;
+	}
+	if( v->pntenc ) {
+		*value = getRegister(v,reg);
+		return 1;
+	}
+	if( v->pnttype == PNT_AI ) {
+		if( v->value.type == VAL_INT ) {
+			*value = (uint16_t)v->value.i;
+		}
+		else {
+			*value = (uint16_t)v->value.f;
+		}
+		return 1;
+	}
+	else {
+		float f;
+		if( v->value.type == VAL_INT ) {
+			if( (float)v->value.i <= v->pntmin ) { 
+				*value = 0;
 				return 1;
 			}
-			else if( vars[i].pnttype == PNT_AO_SCALED ) {
-				float v;
-				if( vars[i].value.type == VAL_INT ) {
-					if( (float)vars[i].value.i <= vars[i].pntmin ) { 
-						*value = 0;
-						return 1;
-					}
-					else
-						v = (float)vars[i].value.i - vars[i].pntmin;
-				}
-				else {
-					v = vars[i].value.f - vars[i].pntmin;
-				}
-				*value = (uint16_t) (v*(float)0xFFFF/(vars[i].pntmax-vars[i].pntmin));
+			else
+				f = (float)v->value.i - v->pntmin;
+		}
+		else {
+			f = v->value.f - v->pntmin;
+		}
+		*value = f/(v->pntmax-v->pntmin)*0xFFFF;
+		return 1;
+	}
+}
+
+int setAO(uint8_t unit, uint16_t ao_addr, uint16_t value) {
+	unsigned int reg;
+	var_t* v = findPoint(unit,GROUP_AO,ao_addr,&reg);
+	if( v == 0 ) {
+		return 0;
+	}
+	valuesVersion++;
+	if( v->pntenc ) {
+		setRegister(v,reg,value);
+		override_var(v);
+		return 1;
+	}
+	if( v->pnttype == PNT_AO ) {
+		v->value.type = VAL_INT;
+		v->value.i = value;
+		override_var(v);
+		return 1;
+	}
+	else {
+		float f = (float)value * (v->pntmax - v->pntmin);
+		v->value.type = VAL_FLOAT;
+		if( f == 0 ) {
+			v->value.f = 0.0;
+		}
+		else {
+			v->value.f = f / (float)0xFFFF;
+		}
+		override_var(v);
+		return 1;
+	}
+}
+
+int getAO(uint8_t unit, uint16_t ao_addr, uint16_t *value) {
+	unsigned int reg;
+	var_t* v = findPoint(unit,GROUP_AO,ao_addr,&reg);
+	if( v == 0 ) {
+		return 0;
+	}
+	if( v->pntenc ) {
+		*value = getRegister(v,reg);
+		return 1;
+	}
+	if( v->pnttype == PNT_AO ) {
+		if( v->value.type == VAL_INT ) {
+			*value = (uint16_t)v->value.i;
+		}
+		else {
+			*value = (uint16_t)v->value.f;
+		}
+		return 1;
+	}
+	else {
+		float f;
+		if( v->value.type == VAL_INT ) {
+			if( (float)v->value.i <= v->pntmin ) { 
+				*value = 0;
 				return 1;
 			}
+			else
+				f = (float)v->value.i - v->pntmin;
 		}
+		else {
+			f = v->value.f - v->pntmin;
+		}
+		*value = (uint16_t) (f*(float)0xFFFF/(v->pntmax-v->pntmin));
+		return 1;
 	}
-	return 0;
 }
-
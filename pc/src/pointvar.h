@@ -33,11 +33,14 @@
 #define OPEN  0
 #define CLOSE 1
 
-int setDO(uint16_t do_addr, uint8_t value);
-int getDO(uint16_t do_addr, uint8_t *value);
-int getDI(uint16_t di_addr, uint8_t *value);
-int getAI(uint16_t ai_addr, uint16_t *value);
-int setAO(uint16_t ao_addr, uint16_t value);
-int getAO(uint16_t ao_addr, uint16_t *value);
+//unit is the Modbus unit id (RTU address); units without points of their
+//own are served the points that have no unit
+int pointUnit(uint8_t unit);
+int setDO(uint8_t unit, uint16_t do_addr, uint8_t value);
+int getDO(uint8_t unit, uint16_t do_addr, uint8_t *value);
+int getDI(uint8_t unit, uint16_t di_addr, uint8_t *value);
+int getAI(uint8_t unit, uint16_t ai_addr, uint16_t *value);
+int setAO(uint8_t unit, uint16_t ao_addr, uint16_t value);
+int getAO(uint8_t unit, uint16_t ao_addr, uint16_t *value);
 
 #endif //_POINTVAR_H_
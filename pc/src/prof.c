@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __PROF_C__
+#include "prof.h"
+#include "var.h"
+#include "compat.h"
+
+#include <string.h>
+
+uint8_t prof_enabled;
+unsigned long long prof_start;
+unsigned long prof_loops;
+unsigned long long prof_section_ns[PROFSECTIONS];
+unsigned long prof_section_calls[PROFSECTIONS];
+unsigned long long prof_section_max[PROFSECTIONS];
+//Indexed like vars[]; del_var() keeps them in step through profDelVar()
+unsigned long long prof_var_ns[VARSMAX];
+unsigned long prof_var_calls[VARSMAX];
+//Ring of the last PROFTICKS tick durations in microseconds
+uint32_t prof_ticks[PROFTICKS];
+unsigned long prof_nticks;
+
+void profReset() {
+	memset(prof_section_ns,0,sizeof(prof_section_ns));
+	memset(prof_section_calls,0,sizeof(prof_section_calls));
+	memset(prof_section_max,0,sizeof(prof_section_max));
+	memset(prof_var_ns,0,sizeof(prof_var_ns));
+	memset(prof_var_calls,0,sizeof(prof_var_calls));
+	prof_nticks = 0;
+	prof_loops = 0;
+	prof_start = compatNanos();
+}
+
+void profEnable(uint8_t enable) {
+	if( enable && ! prof_enabled ) {
+		profReset();
+	}
+	prof_enabled = enable;
+}
+
+void profSection(unsigned int section, unsigned long long start) {
+	unsigned long long ns;
+	if( start == 0 ) {
+		return;
+	}
+	ns = compatNanos()-start;
+	prof_section_ns[section] += ns;
+	prof_section_calls[section]++;
+	if( ns > prof_section_max[section] ) {
+		prof_section_max[section] = ns;
+	}
+}
+
+//A tick is a section of its own, plus its duration for percentiles
+void profTick(unsigned long long start) {
+	if( start == 0 ) {
+		return;
+	}
+	profSection(PROF_TICK,start);
+	prof_ticks[prof_nticks%PROFTICKS] = (compatNanos()-start)/1000;
+	prof_nticks++;
+}
+
+void profLoop() {
+	if( prof_enabled ) {
+		prof_loops++;
+	}
+}
+
+void profVar(unsigned int idx, unsigned long long start) {
+	if( start == 0 ) {
+		return;
+	}
+	prof_var_ns[idx] += compatNanos()-start;
+	prof_var_calls[idx]++;
+}
+
+void profDelVar(unsigned int idx) {
+	memmove(prof_var_ns+idx,prof_var_ns+idx+1,(VARSMAX-idx-1)*sizeof(prof_var_ns[0]));
+	memmove(prof_var_calls+idx,prof_var_calls+idx+1,(VARSMAX-idx-1)*sizeof(prof_var_calls[0]));
+	prof_var_ns[VARSMAX-1] = 0;
+	prof_var_calls[VARSMAX-1] = 0;
+}
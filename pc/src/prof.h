@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <stdint.h>
+
+//Main loop sections
+#define PROF_TICK      0
+#define PROF_DISPLAY   1
+#define PROF_CONSOLE   2
+#define PROF_MODBUS    3
+#define PROF_MODBUSTCP 4
+#define PROF_IEC61850  5
+#define PROFSECTIONS   6
+
+//Variables listed by prof unless a count is given
+#define PROFTOP 10
+
+//Tick durations kept for percentiles
+#define PROFTICKS 1024
+
+#ifndef __PROF_C__
+extern uint8_t prof_enabled;
+extern unsigned long long prof_start;
+extern unsigned long prof_loops;
+extern unsigned long long prof_section_ns[PROFSECTIONS];
+extern unsigned long prof_section_calls[PROFSECTIONS];
+extern unsigned long long prof_section_max[PROFSECTIONS];
+extern unsigned long long prof_var_ns[];
+extern unsigned long prof_var_calls[];
+extern uint32_t prof_ticks[PROFTICKS];
+extern unsigned long prof_nticks;
+#endif //__PROF_C__
+
+//Returns 0 while profiling is off so the matching end call does nothing
+#define profStart() (prof_enabled ? compatNanos() : 0)
+
+void profReset();
+void profEnable(uint8_t enable);
+void profSection(unsigned int section, unsigned long long start);
+void profTick(unsigned long long start);
+void profLoop();
+void profVar(unsigned int idx, unsigned long long start);
+void profDelVar(unsigned int idx);
+
+#endif //__PROF_H__
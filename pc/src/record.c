@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#define __RECORD_C__
+#include "hist.h"
+#include "record.h"
+#include "var.h"
+#include "compat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif //LINUX
+
+//Rows buffered between the tick and the writer
+#define RECORDROWS (4*HISTBLOCKTICKS)
+
+//The tick only copies the recorded values into a ring of rows.  Every
+//HISTBLOCKTICKS rows are compressed into a block and written out by a
+//writer thread (inline on targets without threads).  If the writer falls
+//behind rows are dropped rather than holding up the tick.
+
+char record_path[256];
+uint8_t record_active;
+uint8_t record_error;
+unsigned int record_nvars;
+unsigned long record_rows;
+unsigned long record_blocks;
+unsigned long long record_bytes;
+unsigned long record_dropped;
+
+static FILE* recfp;
+static char* recnames;          //NUL separated names in recording order
+static unsigned int recnameslen;
+static char** recname;
+static var_t** recvars;
+static unsigned int recversion;
+static val_t* ringvals;         //RECORDROWS rows of record_nvars values
+static uint32_t ringtick[RECORDROWS];
+static uint32_t ringms[RECORDROWS];
+static unsigned long head;      //rows produced by the tick
+static unsigned long tail;      //rows consumed by the writer
+static uint8_t* blockbuf;
+static unsigned int recstart;
+static uint32_t lasttick;
+static uint32_t lastms;
+#ifdef LINUX
+static pthread_t recwriter;
+static pthread_mutex_t reclock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reccond = PTHREAD_COND_INITIALIZER;
+static uint8_t recstopping;
+#endif //LINUX
+
+static void recordFree() {
+	free(recnames);
+	free(recname);
+	free(recvars);
+	free(ringvals);
+	free(blockbuf);
+	recnames = 0;
+	recname = 0;
+	recvars = 0;
+	ringvals = 0;
+	blockbuf = 0;
+	recnameslen = 0;
+	record_nvars = 0;
+}
+
+//Names may be given before recordStart(); without any, every variable
+//defined at the start is recorded
+int recordBind(char* name, unsigned int len) {
+	char* grown;
+	if( record_active ) {
+		return 0;
+	}
+	grown = realloc(recnames,recnameslen+len+1);
+	if( grown == 0 ) {
+		return 0;
+	}
+	recnames = grown;
+	memcpy(recnames+recnameslen,name,len);
+	recnames[recnameslen+len] = 0;
+	recnameslen += len+1;
+	record_nvars++;
+	return 1;
+}
+
+static int nameEquals(char* entry, char* name) {
+	while( *name ) {
+		if( (*entry&0x7F) != *name ) {
+			return 0;
+		}
+		if( *entry&0x80 ) {
+			return name[1] == 0;
+		}
+		entry++;
+		name++;
+	}
+	return 0;
+}
+
+//Variables move when others are deleted; follow them by name
+static void recordRebind() {
+	unsigned int i;
+	var_t* v;
+	for( i=0; i<record_nvars; i++ ) {
+		v = recvars[i];
+		if( v == 0 || v->value.type == VAL_NONE || v->name == 0 || ! nameEquals(v->name,recname[i]) ) {
+			recvars[i] = get_var(recname[i],strlen(recname[i]));
+		}
+	}
+	recversion = varsVersion;
+}
+
+static void recordWriteBlock(unsigned int count) {
+	uint32_t tickinc[HISTBLOCKTICKS];
+	uint32_t msinc[HISTBLOCKTICKS];
+	unsigned int first = tail%RECORDROWS;
+	unsigned int size;
+	unsigned int k;
+	uint32_t basetick = lasttick;
+	uint32_t basems = lastms;
+	for( k=0; k<count; k++ ) {
+		tickinc[k] = ringtick[first+k]-lasttick;
+		msinc[k] = ringms[first+k]-lastms;
+		lasttick = ringtick[first+k];
+		lastms = ringms[first+k];
+	}
+	size = histEncodeBlock(blockbuf,basetick,basems,tickinc,msinc,
+		ringvals+(unsigned long)first*record_nvars,record_nvars,count);
+	if( fwrite(blockbuf,1,size,recfp) != size || fflush(recfp) != 0 ) {
+		record_error = 1;
+	}
+	record_bytes += size;
+	record_blocks++;
+}
+
+#ifdef LINUX
+static void* recordWriter(void* arg) {
+	unsigned long n;
+	pthread_mutex_lock(&reclock);
+	while( 1 ) {
+		while( head-tail < HISTBLOCKTICKS && ! recstopping ) {
+			pthread_cond_wait(&reccond,&reclock);
+		}
+		n = head-tail;
+		if( n > HISTBLOCKTICKS ) {
+			n = HISTBLOCKTICKS;
+		}
+		if( n == 0 ) {
+			break;
+		}
+		pthread_mutex_unlock(&reclock);
+		recordWriteBlock(n);
+		pthread_mutex_lock(&reclock);
+		tail += n;
+	}
+	pthread_mutex_unlock(&reclock);
+	return 0;
+}
+#endif //LINUX
+
+int recordStart(char* path) {
+	histheader_t header;
+	unsigned int n = 0;
+	unsigned int i;
+	unsigned int len;
+	char* c;
+	static const char pad[8] = { 0 };
+	
+	//Everything currently defined
+	if( record_nvars == 0 ) {
+		while( n < VARSMAX && vars[n].value.type != VAL_NONE ) {
+			for( c=vars[n].name; (*c&0x80) == 0; c++ );
+			recordBind(vars[n].name,c-vars[n].name+1);
+			recnames[recnameslen-2] &= 0x7F;
+			n++;
+		}
+		if( record_nvars != n ) {
+			recordFree();
+			return 0;
+		}
+	}
+	for( len=0; path[len] && len<sizeof(record_path)-1; len++ ) {
+		record_path[len] = path[len];
+	}
+	record_path[len] = 0;
+	
+	recname = malloc(record_nvars*sizeof(char*));
+	recvars = malloc(record_nvars*sizeof(var_t*));
+	ringvals = malloc((unsigned long)RECORDROWS*record_nvars*sizeof(val_t));
+	blockbuf = malloc(histBlockMax(record_nvars,HISTBLOCKTICKS));
+	recfp = len ? fopen(record_path,"wb") : 0;
+	if( recname == 0 || recvars == 0 || ringvals == 0 || blockbuf == 0 || recfp == 0 ) {
+		if( recfp ) {
+			fclose(recfp);
+		}
+		recordFree();
+		return 0;
+	}
+	c = recnames;
+	for( i=0; i<record_nvars; i++ ) {
+		recname[i] = c;
+		recvars[i] = n ? &vars[i] : 0;
+		c += strlen(c)+1;
+	}
+	if( n == 0 ) {
+		recordRebind();
+	}
+	recversion = varsVersion;
+	
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,HISTMAGIC,sizeof(HISTMAGIC));
+	header.version = HISTVERSION;
+	header.nvars = record_nvars;
+	header.blockticks = HISTBLOCKTICKS;
+	header.tickdelay = TICKDELAY;
+	header.start_ms = (uint64_t)time(0)*1000;
+	header.nameslen = (recnameslen+7)&~7;
+	fwrite(&header,1,sizeof(header),recfp);
+	fwrite(recnames,1,recnameslen,recfp);
+	fwrite(pad,1,header.nameslen-recnameslen,recfp);
+	record_bytes = sizeof(header)+header.nameslen;
+	record_error = fflush(recfp) != 0;
+	
+	head = 0;
+	tail = 0;
+	record_rows = 0;
+	record_blocks = 0;
+	record_dropped = 0;
+	recstart = compatMillis();
+	lasttick = ticks;
+	lastms = 0;
+	#ifdef LINUX
+	recstopping = 0;
+	if( pthread_create(&recwriter,0,recordWriter,0) != 0 ) {
+		fclose(recfp);
+		recordFree();
+		return 0;
+	}
+	//Only use otherwise idle CPU time, waking the writer must never
+	//preempt the tick on a single core
+	{
+		struct sched_param param;
+		memset(&param,0,sizeof(param));
+		pthread_setschedparam(recwriter,SCHED_IDLE,&param);
+	}
+	#endif //LINUX
+	record_active = 1;
+	return 1;
+}
+
+void recordStop() {
+	if( ! record_active ) {
+		recordFree();
+		return;
+	}
+	#ifdef LINUX
+	pthread_mutex_lock(&reclock);
+	recstopping = 1;
+	pthread_cond_signal(&reccond);
+	pthread_mutex_unlock(&reclock);
+	pthread_join(recwriter,0);
+	#else
+	if( head > tail ) {
+		recordWriteBlock(head-tail);
+		tail = head;
+	}
+	#endif //LINUX
+	fclose(recfp);
+	recfp = 0;
+	record_active = 0;
+	recordFree();
+}
+
+void recordTick() {
+	unsigned int row;
+	unsigned int i;
+	val_t* out;
+	unsigned long pending;
+	if( ! record_active ) {
+		return;
+	}
+	#ifdef LINUX
+	pthread_mutex_lock(&reclock);
+	pending = head-tail;
+	pthread_mutex_unlock(&reclock);
+	#else
+	pending = head-tail;
+	#endif //LINUX
+	if( pending >= RECORDROWS ) {
+		record_dropped++;
+		return;
+	}
+	if( recversion != varsVersion ) {
+		recordRebind();
+	}
+	row = head%RECORDROWS;
+	ringtick[row] = ticks;
+	ringms[row] = compatMillis()-recstart;
+	out = ringvals+(unsigned long)row*record_nvars;
+	for( i=0; i<record_nvars; i++ ) {
+		if( recvars[i] ) {
+			out[i] = recvars[i]->value;
+		}
+		else {
+			out[i].type = VAL_NONE;
+			out[i].i = 0;
+		}
+	}
+	record_rows++;
+	#ifdef LINUX
+	pthread_mutex_lock(&reclock);
+	head++;
+	if( head-tail >= HISTBLOCKTICKS ) {
+		pthread_cond_signal(&reccond);
+	}
+	pthread_mutex_unlock(&reclock);
+	#else
+	head++;
+	if( head-tail >= HISTBLOCKTICKS ) {
+		recordWriteBlock(HISTBLOCKTICKS);
+		tail += HISTBLOCKTICKS;
+	}
+	#endif //LINUX
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __RTU_C__
+#define _GNU_SOURCE
+#include "rtu.h"
+#include "compat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+rtu_t rtu_ports[RTUPORTSMAX];
+unsigned int rtu_count;
+
+//One poll set for every line, rebuilt when a line is opened or closed
+static struct pollfd pfds[RTUPORTSMAX];
+
+//Whole frame in one write, so the line sees no gap before the CRC
+static void rtuSend(modbusport_t* p, uint8_t* msg, uint16_t len, uint16_t crc) {
+	uint8_t frame[MODBUSMSGLEN+2];
+	unsigned int sent = 0;
+	int n;
+	memcpy(frame,msg,len);
+	frame[len] = crc&0xFF;
+	frame[len+1] = (crc>>8)&0xFF;
+	while( sent < len+2u ) {
+		n = write(p->fd,frame+sent,len+2-sent);
+		if( n > 0 ) {
+			sent += n;
+		} else if( n == -1 && errno != EAGAIN ) {
+			break;
+		}
+	}
+}
+
+static void rtuClose(rtu_t* r, uint8_t keeplink) {
+	close(r->port.fd);
+	if( r->pty ) {
+		close(r->slavefd);
+		if( ! keeplink ) {
+			unlink(r->path);
+		}
+	}
+}
+
+void rtuReset() {
+	unsigned int i;
+	for( i=0; i<rtu_count; i++ ) {
+		rtuClose(&rtu_ports[i],0);
+	}
+	rtu_count = 0;
+}
+
+//Opening a path that is already open replaces that line once the new
+//one is open; if that fails the old line keeps running
+int rtuOpen(char* path, uint8_t pty, uint8_t address, unsigned long baud, char parity,
+		uint8_t stopbits, uint8_t rs485, uint16_t base, uint16_t count) {
+	rtu_t r;
+	unsigned int i;
+	char* slave;
+	struct stat st;
+	if( strlen(path) >= RTUPATHMAX ) {
+		return -1;
+	}
+	for( i=0; i<rtu_count; i++ ) {
+		if( strcmp(rtu_ports[i].path,path) == 0 ) {
+			break;
+		}
+	}
+	if( i == RTUPORTSMAX ) {
+		return -1;
+	}
+	//The path of a pty line is our own link to its slave side
+	if( i < rtu_count && rtu_ports[i].pty && ! pty ) {
+		return -1;
+	}
+	
+	modbusPortBegin(&r.port);
+	strcpy(r.path,path);
+	r.pty = pty;
+	r.slavefd = -1;
+	if( pty ) {
+		r.port.fd = posix_openpt(O_RDWR|O_NOCTTY|O_NONBLOCK);
+		if( r.port.fd < 0 ) {
+			return -1;
+		}
+		slave = (grantpt(r.port.fd) == 0 && unlockpt(r.port.fd) == 0) ? ptsname(r.port.fd) : 0;
+		if( slave ) {
+			r.slavefd = open(slave,O_RDWR|O_NOCTTY|O_NONBLOCK);
+		}
+		if( r.slavefd < 0 || compatSerial(r.slavefd,baud,parity,stopbits,0) != 0 || rs485 ) {
+			close(r.port.fd);
+			if( r.slavefd >= 0 ) {
+				close(r.slavefd);
+			}
+			return -1;
+		}
+		//Only an earlier pty link may be replaced, never another file
+		if( lstat(path,&st) == 0 && (! S_ISLNK(st.st_mode) || unlink(path) != 0) ) {
+			close(r.port.fd);
+			close(r.slavefd);
+			return -1;
+		}
+		if( symlink(slave,path) != 0 ) {
+			close(r.port.fd);
+			close(r.slavefd);
+			return -1;
+		}
+	}
+	else {
+		r.port.fd = open(path,O_RDWR|O_NOCTTY|O_NONBLOCK);
+		if( r.port.fd < 0 ) {
+			return -1;
+		}
+		if( compatSerial(r.port.fd,baud,parity,stopbits,rs485) != 0 ) {
+			close(r.port.fd);
+			return -1;
+		}
+	}
+	r.port.send = rtuSend;
+	r.port.address = address;
+	r.port.baud = baud;
+	r.port.base = base;
+	r.port.count = count;
+	r.parity = parity;
+	r.stopbits = stopbits;
+	r.rs485 = rs485;
+	if( i < rtu_count ) {
+		//A new pty has already put its own link at the path
+		rtuClose(&rtu_ports[i],pty);
+	}
+	else {
+		rtu_count++;
+	}
+	rtu_ports[i] = r;
+	pfds[i].fd = r.port.fd;
+	pfds[i].events = POLLIN;
+	return 0;
+}
+
+void rtuProcess() {
+	unsigned long long now;
+	unsigned int i;
+	modbusport_t* p;
+	int n;
+	if( rtu_count == 0 ) {
+		return;
+	}
+	poll(pfds,rtu_count,0);
+	now = compatNanos();
+	for( i=0; i<rtu_count; i++ ) {
+		p = &rtu_ports[i].port;
+		if( pfds[i].revents & POLLIN ) {
+			do {
+				n = read(p->fd,p->rx+p->rx_len,MODBUSMSGLEN-p->rx_len);
+				modbusPortInput(p,n > 0 ? n : 0,compatNanos());
+			} while( n > 0 );
+		}
+		else if( p->rx_len ) {
+			modbusPortInput(p,0,now);
+		}
+	}
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __RTU_H__
+#define __RTU_H__
+
+#include <stdint.h>
+#include "modbus.h"
+
+//Extra Modbus RTU lines (Linux) beside the -s/-t SCADA channel, each
+//with its own slave address, serial settings and point window.  A line
+//is a serial device or a new pty whose slave end is linked at path.
+
+#define RTUPORTSMAX 32
+#define RTUPATHMAX  128
+
+typedef struct {
+	modbusport_t port;
+	char path[RTUPATHMAX];
+	uint8_t pty;
+	int slavefd;               //pty slave, kept open so reads never fail
+	char parity;
+	uint8_t stopbits;
+	uint8_t rs485;
+} rtu_t;
+
+#ifndef __RTU_C__
+extern rtu_t rtu_ports[RTUPORTSMAX];
+extern unsigned int rtu_count;
+#endif //__RTU_C__
+
+void rtuReset();
+int rtuOpen(char* path, uint8_t pty, uint8_t address, unsigned long baud, char parity,
+	uint8_t stopbits, uint8_t rs485, uint16_t base, uint16_t count);
+void rtuProcess();
+
+#endif
@@ -0,0 +1,701 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+//Modbus load generator and latency tester.  Drives a simulator over
+//Modbus/TCP with any number of clients and pipelined requests, or over
+//RTU on a serial device or on a pty pair shared with a simulator it
+//starts itself, then reports throughput and latency histograms.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "crc16.h"
+
+#define CLIENTSMAX  256
+#define DEPTHMAX    64
+#define MIXMAX      8
+#define BUFMAX      512
+#define SUBBUCKETS  8
+#define BUCKETSMAX  (27*SUBBUCKETS)   //up to ~2^27 us
+#define PROBEMS     10000
+
+typedef struct {
+	int fd;
+	unsigned int outstanding;
+	uint16_t tid[DEPTHMAX];
+	uint8_t fc[DEPTHMAX];
+	uint8_t busy[DEPTHMAX];
+	unsigned long long sent[DEPTHMAX];
+	uint16_t generation;
+	uint8_t buf[BUFMAX];
+	unsigned int len;
+} client_t;
+
+typedef struct {
+	uint8_t fc;
+	unsigned int weight;
+	unsigned long requests;
+	unsigned long long total_us;
+} mix_t;
+
+static client_t clients[CLIENTSMAX];
+static unsigned int nclients = 1;
+static unsigned int depth = 1;
+static mix_t mix[MIXMAX];
+static unsigned int nmix;
+static unsigned int mixweight;
+static unsigned int first_addr = 0;
+static unsigned int last_addr = 0;
+static unsigned int count = 10;
+static uint8_t unit = 1;
+static unsigned int timeout_ms = 1000;
+static double seconds = 10;
+static int rtu;
+
+static unsigned long requests;
+static unsigned long responses;
+static unsigned long exceptions;
+static unsigned long timeouts;
+static unsigned long errors;
+static unsigned long long buckets[BUCKETSMAX];
+static unsigned long long max_us;
+
+static void usage(char* cmd) {
+	printf("Usage:\n");
+	printf("%s [-t host:port | -s serial_device | -x sim_command] [-c clients] [-q depth]\n",cmd);
+	printf("        [-f fc:weight[,fc:weight...]] [-a first[-last]] [-k count] [-u unit]\n");
+	printf("        [-n seconds] [-w timeout_ms]\n");
+	printf("\n");
+	printf("-t: Modbus/TCP server to load\n");
+	printf("-s: Modbus RTU on this serial device (one client, depth 1)\n");
+	printf("-x: Start this simulator command on a new pty pair (\"-s pty\" is\n");
+	printf("    appended) and load it over Modbus RTU\n");
+	printf("-c: Number of TCP clients (default 1)\n");
+	printf("-q: Outstanding requests per TCP client (default 1, max %u)\n",DEPTHMAX);
+	printf("-f: Function code mix, e.g. 3:70,4:20,6:10 (default 3)\n");
+	printf("    Supported function codes are 1, 2, 3, 4, 5, 6, 15, 16, 22 and 23\n");
+	printf("    (23 writes the first register and reads count registers)\n");
+	printf("-a: Range of start addresses (default 0)\n");
+	printf("-k: Points per read or multiple write (default 10)\n");
+	printf("-u: Unit id / RTU address (default 1)\n");
+	printf("-n: Test duration in seconds (default 10)\n");
+	printf("-w: Response timeout in milliseconds (default 1000)\n");
+	printf("\n");
+	exit(1);
+}
+
+static unsigned long long nowUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+//Log-linear buckets: exact below SUBBUCKETS us, then SUBBUCKETS
+//buckets per power of two
+static unsigned int bucketIndex(unsigned long long us) {
+	unsigned int e = 0;
+	unsigned int idx;
+	if( us < SUBBUCKETS ) {
+		return us;
+	}
+	while( (us>>e) >= 2*SUBBUCKETS ) {
+		e++;
+	}
+	idx = (e+1)*SUBBUCKETS + (us>>e) - SUBBUCKETS;
+	return idx < BUCKETSMAX ? idx : BUCKETSMAX-1;
+}
+
+static unsigned long long bucketLimit(unsigned int idx) {
+	unsigned int e;
+	if( idx < SUBBUCKETS ) {
+		return idx;
+	}
+	e = idx/SUBBUCKETS-1;
+	return ((unsigned long long)(idx%SUBBUCKETS+SUBBUCKETS+1)<<e)-1;
+}
+
+static unsigned long long percentile(double p) {
+	unsigned long long target = (unsigned long long)(responses*p/100.0);
+	unsigned long long total = 0;
+	unsigned int i;
+	for( i=0; i<BUCKETSMAX; i++ ) {
+		total += buckets[i];
+		if( total > target ) {
+			return bucketLimit(i);
+		}
+	}
+	return max_us;
+}
+
+static void parseMix(char* arg, char* cmd) {
+	char* p = arg;
+	char* end;
+	nmix = 0;
+	mixweight = 0;
+	while( *p ) {
+		if( nmix == MIXMAX ) {
+			usage(cmd);
+		}
+		mix[nmix].fc = (uint8_t)strtoul(p,&end,0);
+		mix[nmix].weight = 1;
+		if( *end == ':' ) {
+			mix[nmix].weight = (unsigned int)strtoul(end+1,&end,0);
+		}
+		if( (mix[nmix].fc < 1 || mix[nmix].fc > 6) && mix[nmix].fc != 15 && mix[nmix].fc != 16 &&
+				mix[nmix].fc != 22 && mix[nmix].fc != 23 ) {
+			usage(cmd);
+		}
+		mixweight += mix[nmix].weight;
+		nmix++;
+		if( *end == ',' ) {
+			end++;
+		}
+		else if( *end ) {
+			usage(cmd);
+		}
+		p = end;
+	}
+	if( mixweight == 0 ) {
+		usage(cmd);
+	}
+}
+
+static unsigned int pickMix() {
+	unsigned int w = random()%mixweight;
+	unsigned int i;
+	for( i=0; i<nmix-1 && w >= mix[i].weight; i++ ) {
+		w -= mix[i].weight;
+	}
+	return i;
+}
+
+//Build the PDU (function code onwards) of a request, returning its length
+static unsigned int buildPdu(uint8_t* pdu, uint8_t fc) {
+	unsigned int addr = first_addr;
+	unsigned int len = 5;
+	unsigned int i;
+	if( last_addr > first_addr ) {
+		addr += random()%(last_addr-first_addr+1);
+	}
+	pdu[0] = fc;
+	pdu[1] = addr>>8;
+	pdu[2] = addr&0xFF;
+	if( fc == 5 ) {
+		pdu[3] = (random()&1) ? 0xFF : 0x00;
+		pdu[4] = 0;
+	}
+	else if( fc == 6 ) {
+		pdu[3] = random()&0xFF;
+		pdu[4] = random()&0xFF;
+	}
+	else if( fc == 22 ) {
+		for( i=3; i<7; i++ ) {
+			pdu[i] = random()&0xFF;
+		}
+		len = 7;
+	}
+	else {
+		pdu[3] = count>>8;
+		pdu[4] = count&0xFF;
+	}
+	if( fc == 15 ) {
+		pdu[5] = (count+7)/8;
+		for( i=0; i<pdu[5]; i++ ) {
+			pdu[6+i] = random()&0xFF;
+		}
+		len = 6+pdu[5];
+	}
+	else if( fc == 16 ) {
+		pdu[5] = count*2;
+		for( i=0; i<pdu[5]; i++ ) {
+			pdu[6+i] = random()&0xFF;
+		}
+		len = 6+pdu[5];
+	}
+	else if( fc == 23 ) {
+		pdu[5] = addr>>8;
+		pdu[6] = addr&0xFF;
+		pdu[7] = 0;
+		pdu[8] = 1;
+		pdu[9] = 2;
+		pdu[10] = random()&0xFF;
+		pdu[11] = random()&0xFF;
+		len = 12;
+	}
+	return len;
+}
+
+static void record(client_t* c, unsigned int slot, uint8_t* pdu) {
+	unsigned long long us = nowUs()-c->sent[slot];
+	unsigned int i;
+	if( pdu[0] & 0x80 ) {
+		exceptions++;
+	}
+	responses++;
+	buckets[bucketIndex(us)]++;
+	if( us > max_us ) {
+		max_us = us;
+	}
+	for( i=0; i<nmix; i++ ) {
+		if( mix[i].fc == c->fc[slot] ) {
+			mix[i].total_us += us;
+		}
+	}
+	c->busy[slot] = 0;
+	c->outstanding--;
+}
+
+static int sendRequest(client_t* c) {
+	uint8_t msg[16+BUFMAX];
+	unsigned int len;
+	unsigned int slot;
+	unsigned int m;
+	uint16_t crc;
+	for( slot=0; slot<depth && c->busy[slot]; slot++ );
+	if( slot == depth ) {
+		return 0;
+	}
+	m = pickMix();
+	if( rtu ) {
+		msg[0] = unit;
+		len = 1+buildPdu(msg+1,mix[m].fc);
+		crc = crc16(msg,len);
+		msg[len++] = crc&0xFF;
+		msg[len++] = crc>>8;
+	}
+	else {
+		//Transaction ids carry the slot in the low bits
+		c->tid[slot] = (uint16_t)((c->generation++ * DEPTHMAX) + slot);
+		len = 7+buildPdu(msg+7,mix[m].fc);
+		msg[0] = c->tid[slot]>>8;
+		msg[1] = c->tid[slot]&0xFF;
+		msg[2] = 0;
+		msg[3] = 0;
+		msg[4] = (len-6)>>8;
+		msg[5] = (len-6)&0xFF;
+		msg[6] = unit;
+	}
+	//Stamped before the write: the simulator may answer before we are
+	//scheduled again after it returns
+	c->sent[slot] = nowUs();
+	if( write(c->fd,msg,len) != (ssize_t)len ) {
+		c->sent[slot] = 0;
+		errors++;
+		return -1;
+	}
+	c->fc[slot] = mix[m].fc;
+	c->busy[slot] = 1;
+	c->outstanding++;
+	mix[m].requests++;
+	requests++;
+	return 1;
+}
+
+//Expected RTU response length from its first three bytes
+static unsigned int rtuLength(uint8_t* buf) {
+	if( buf[1] & 0x80 ) {
+		return 5;
+	}
+	if( buf[1] <= 4 || buf[1] == 23 ) {
+		return 5+buf[2];
+	}
+	if( buf[1] == 22 ) {
+		return 10;
+	}
+	return 8;
+}
+
+static void receive(client_t* c) {
+	ssize_t n;
+	unsigned int len;
+	unsigned int slot;
+	uint16_t tid;
+	uint16_t crc;
+	n = read(c->fd,c->buf+c->len,BUFMAX-c->len);
+	if( n <= 0 ) {
+		if( n == 0 || (errno != EAGAIN && errno != EINTR) ) {
+			errors++;
+			close(c->fd);
+			c->fd = -1;
+		}
+		return;
+	}
+	c->len += n;
+	while( 1 ) {
+		if( rtu ) {
+			if( c->len < 3 ) {
+				return;
+			}
+			len = rtuLength(c->buf);
+			if( c->len < len ) {
+				return;
+			}
+			crc = crc16(c->buf,len-2);
+			if( c->busy[0] && c->buf[0] == unit && (c->buf[1]&0x7F) == c->fc[0] &&
+			    c->buf[len-2] == (crc&0xFF) && c->buf[len-1] == (crc>>8) ) {
+				record(c,0,c->buf+1);
+			}
+			else {
+				//Resynchronise on the next request
+				errors++;
+				c->len = 0;
+				return;
+			}
+		}
+		else {
+			if( c->len < 7 ) {
+				return;
+			}
+			len = 6+((c->buf[4]<<8)|c->buf[5]);
+			if( len > BUFMAX || len < 8 ) {
+				errors++;
+				c->len = 0;
+				return;
+			}
+			if( c->len < len ) {
+				return;
+			}
+			tid = (c->buf[0]<<8)|c->buf[1];
+			slot = tid%DEPTHMAX;
+			if( slot < depth && c->busy[slot] && c->tid[slot] == tid ) {
+				record(c,slot,c->buf+7);
+			}
+			else {
+				//Answer to a request that already timed out
+				errors++;
+			}
+		}
+		memmove(c->buf,c->buf+len,c->len-len);
+		c->len -= len;
+	}
+}
+
+static void expire(client_t* c) {
+	unsigned long long now = nowUs();
+	unsigned int slot;
+	for( slot=0; slot<depth; slot++ ) {
+		if( c->busy[slot] && now-c->sent[slot] > timeout_ms*1000ULL ) {
+			c->busy[slot] = 0;
+			c->outstanding--;
+			timeouts++;
+			if( rtu ) {
+				c->len = 0;
+			}
+		}
+	}
+}
+
+//Service every client until the deadline; new requests are only sent
+//while loading is set
+static void run(unsigned long long deadline, int loading) {
+	struct pollfd fds[CLIENTSMAX];
+	unsigned int i;
+	unsigned int pending;
+	while( nowUs() < deadline ) {
+		pending = 0;
+		for( i=0; i<nclients; i++ ) {
+			if( clients[i].fd == -1 ) {
+				continue;
+			}
+			if( loading ) {
+				while( sendRequest(&clients[i]) > 0 );
+			}
+			expire(&clients[i]);
+			pending += clients[i].outstanding;
+		}
+		if( ! loading && pending == 0 ) {
+			return;
+		}
+		for( i=0; i<nclients; i++ ) {
+			fds[i].fd = clients[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if( poll(fds,nclients,10) <= 0 ) {
+			continue;
+		}
+		for( i=0; i<nclients; i++ ) {
+			if( fds[i].revents && clients[i].fd != -1 ) {
+				receive(&clients[i]);
+			}
+		}
+	}
+}
+
+//Wait for the first answer so start-up time is not measured
+static int probe() {
+	unsigned long long start = nowUs();
+	while( nowUs()-start < PROBEMS*1000ULL ) {
+		run(nowUs()+timeout_ms*1000ULL,1);
+		if( responses ) {
+			return 0;
+		}
+		clients[0].len = 0;
+	}
+	return -1;
+}
+
+static int tcpConnect(char* target) {
+	struct addrinfo hints;
+	struct addrinfo* res;
+	char host[256];
+	char* port;
+	int fd = -1;
+	int on = 1;
+	strncpy(host,target,sizeof(host)-1);
+	host[sizeof(host)-1] = 0;
+	port = strrchr(host,':');
+	if( port == 0 ) {
+		return -1;
+	}
+	*port++ = 0;
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if( getaddrinfo(host,port,&hints,&res) != 0 ) {
+		return -1;
+	}
+	fd = socket(res->ai_family,res->ai_socktype,res->ai_protocol);
+	if( fd >= 0 && connect(fd,res->ai_addr,res->ai_addrlen) < 0 ) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if( fd >= 0 ) {
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+		fcntl(fd,F_SETFL,O_NONBLOCK);
+	}
+	return fd;
+}
+
+static int serialOpen(char* path) {
+	struct termios tty;
+	int fd = open(path,O_RDWR|O_NOCTTY|O_NONBLOCK);
+	if( fd < 0 || tcgetattr(fd,&tty) != 0 ) {
+		return -1;
+	}
+	cfmakeraw(&tty);
+	cfsetispeed(&tty,B9600);
+	cfsetospeed(&tty,B9600);
+	tty.c_cflag |= CREAD|CLOCAL;
+	tcsetattr(fd,TCSANOW,&tty);
+	return fd;
+}
+
+//Open a pty pair and start the simulator on its slave side
+static pid_t ptySpawn(char* cmd, int* master) {
+	char line[1024];
+	char* slave;
+	pid_t pid;
+	int sfd;
+	*master = posix_openpt(O_RDWR|O_NOCTTY);
+	if( *master < 0 || grantpt(*master) < 0 || unlockpt(*master) < 0 ) {
+		return -1;
+	}
+	slave = ptsname(*master);
+	//Keep the slave open (and raw) so the master never sees a hangup
+	sfd = serialOpen(slave);
+	if( sfd < 0 ) {
+		return -1;
+	}
+	snprintf(line,sizeof(line),"exec %s -s %s",cmd,slave);
+	printf("simload pty=%s command=\"%s\"\n",slave,line);
+	fflush(stdout);
+	pid = fork();
+	if( pid == 0 ) {
+		close(*master);
+		execl("/bin/sh","sh","-c",line,(char*)0);
+		_exit(127);
+	}
+	fcntl(*master,F_SETFL,O_NONBLOCK);
+	return pid;
+}
+
+static void report(double elapsed) {
+	unsigned int i;
+	printf("simload transport=%s clients=%u depth=%u seconds=%.2f\n",rtu ? "rtu" : "tcp",nclients,depth,elapsed);
+	printf("simload requests=%lu responses=%lu exceptions=%lu timeouts=%lu errors=%lu per_sec=%.1f\n",
+		requests,responses,exceptions,timeouts,errors,responses/elapsed);
+	if( responses ) {
+		printf("simload latency_us p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+			percentile(50),percentile(90),percentile(99),percentile(99.9),max_us);
+	}
+	for( i=0; i<nmix; i++ ) {
+		printf("simload fc=%u requests=%lu mean_us=%.1f\n",mix[i].fc,mix[i].requests,
+			mix[i].requests ? (double)mix[i].total_us/mix[i].requests : 0.0);
+	}
+	for( i=0; i<BUCKETSMAX; i++ ) {
+		if( buckets[i] ) {
+			printf("simload bucket le_us=%llu count=%llu\n",bucketLimit(i),buckets[i]);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	char* target = 0;
+	char* device = 0;
+	char* command = 0;
+	char* end;
+	unsigned long long start;
+	unsigned int i;
+	pid_t child = -1;
+	int i_arg = 1;
+	
+	mix[0].fc = 3;
+	mix[0].weight = 1;
+	nmix = 1;
+	mixweight = 1;
+	while( i_arg < argc ) {
+		char* opt = argv[i_arg];
+		if( strcmp(opt,"-h") == 0 || i_arg >= argc-1 ) {
+			usage(argv[0]);
+		}
+		i_arg++;
+		if( strcmp(opt,"-t") == 0 ) {
+			target = argv[i_arg];
+		}
+		else if( strcmp(opt,"-s") == 0 ) {
+			device = argv[i_arg];
+		}
+		else if( strcmp(opt,"-x") == 0 ) {
+			command = argv[i_arg];
+		}
+		else if( strcmp(opt,"-c") == 0 ) {
+			nclients = (unsigned int)strtoul(argv[i_arg],0,0);
+		}
+		else if( strcmp(opt,"-q") == 0 ) {
+			depth = (unsigned int)strtoul(argv[i_arg],0,0);
+		}
+		else if( strcmp(opt,"-f") == 0 ) {
+			parseMix(argv[i_arg],argv[0]);
+		}
+		else if( strcmp(opt,"-a") == 0 ) {
+			first_addr = (unsigned int)strtoul(argv[i_arg],&end,0);
+			last_addr = first_addr;
+			if( *end == '-' ) {
+				last_addr = (unsigned int)strtoul(end+1,0,0);
+			}
+		}
+		else if( strcmp(opt,"-k") == 0 ) {
+			count = (unsigned int)strtoul(argv[i_arg],0,0);
+		}
+		else if( strcmp(opt,"-u") == 0 ) {
+			unit = (uint8_t)strtoul(argv[i_arg],0,0);
+		}
+		else if( strcmp(opt,"-n") == 0 ) {
+			seconds = strtod(argv[i_arg],0);
+		}
+		else if( strcmp(opt,"-w") == 0 ) {
+			timeout_ms = (unsigned int)strtoul(argv[i_arg],0,0);
+		}
+		else {
+			usage(argv[0]);
+		}
+		i_arg++;
+	}
+	if( (target != 0) + (device != 0) + (command != 0) != 1 ) {
+		usage(argv[0]);
+	}
+	if( nclients < 1 || nclients > CLIENTSMAX || depth < 1 || depth > DEPTHMAX ||
+	    count < 1 || count > 120 || last_addr < first_addr || last_addr+count > 0x10000 ) {
+		usage(argv[0]);
+	}
+	signal(SIGPIPE,SIG_IGN);
+	srandom(time(0));
+	
+	rtu = target == 0;
+	if( rtu ) {
+		//RTU is half duplex: one master, one request at a time
+		nclients = 1;
+		depth = 1;
+		if( device ) {
+			clients[0].fd = serialOpen(device);
+		}
+		else {
+			child = ptySpawn(command,&clients[0].fd);
+		}
+		if( clients[0].fd < 0 || (command && child < 0) ) {
+			printf("Failed to open %s\n",device ? device : "pty");
+			return 1;
+		}
+	}
+	else {
+		for( i=0; i<nclients; i++ ) {
+			clients[i].fd = tcpConnect(target);
+			if( clients[i].fd < 0 ) {
+				printf("Failed to connect to %s\n",target);
+				return 1;
+			}
+		}
+	}
+	
+	if( probe() < 0 ) {
+		printf("No response from the simulator\n");
+	}
+	else {
+		//Start counting from a clean slate
+		run(nowUs()+timeout_ms*1000ULL,0);
+		requests = responses = exceptions = timeouts = errors = 0;
+		max_us = 0;
+		memset(buckets,0,sizeof(buckets));
+		for( i=0; i<nmix; i++ ) {
+			mix[i].requests = 0;
+			mix[i].total_us = 0;
+		}
+		start = nowUs();
+		run(start+(unsigned long long)(seconds*1000000),1);
+		report((nowUs()-start)/1000000.0);
+		//Let the last answers arrive so they are not left in the server
+		run(nowUs()+timeout_ms*1000ULL,0);
+	}
+	
+	for( i=0; i<nclients; i++ ) {
+		if( clients[i].fd != -1 ) {
+			close(clients[i].fd);
+		}
+	}
+	if( child > 0 ) {
+		kill(child,SIGTERM);
+		waitpid(child,0,0);
+	}
+	return responses ? 0 : 1;
+}
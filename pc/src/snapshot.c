@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __SNAPSHOT_C__
+#include "snapshot.h"
+#include "var.h"
+#include "cli.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef LINUX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif //LINUX
+
+//Snapshot layout (native byte order, so a snapshot is only good for the
+//build that wrote it; the header records what that build looked like):
+//  snapheader_t
+//  snapvar_t[nvars]
+//  names table (nameslen bytes)
+//  exprs table (exprslen bytes)
+//  configuration commands as text (configlen bytes)
+//Everything is read in place from the mapped file.
+
+#define SNAPSHOTMAGIC "SIMSNAP"
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t headsize;
+	uint32_t varsize;
+	uint32_t varsmax;
+	uint32_t namesmax;
+	uint32_t exprsmax;
+	uint32_t nvars;
+	uint32_t ticks;
+	uint32_t nameslen;
+	uint32_t exprslen;
+	uint32_t configlen;
+} snapheader_t;
+
+#define SNAPNOEXPR 0xFFFFFFFF
+
+typedef struct {
+	uint32_t name;      //offset in the names table
+	uint32_t expr;      //offset in the exprs table or SNAPNOEXPR
+	uint8_t type;
+	uint8_t pnttype;
+	uint8_t pntunit;
+	uint8_t pntenc;
+	union {
+		float f;
+		int32_t i;
+	} value;
+	uint32_t pntaddr;
+	float pntmin;
+	float pntmax;
+} snapvar_t;
+
+static char* snapdata;
+static unsigned int snaplen;
+#ifndef LINUX
+static char* snapbuf;
+#endif
+
+static unsigned int snapshotVars() {
+	unsigned int n = 0;
+	while( n < VARSMAX && vars[n].value.type != VAL_NONE ) {
+		n++;
+	}
+	return n;
+}
+
+int snapshotSave(char* path) {
+	FILE* fp;
+	snapheader_t head;
+	snapvar_t rec;
+	long configpos;
+	unsigned int i;
+	int ok;
+	
+	fp = fopen(path,"wb");
+	if( fp == 0 ) {
+		return 0;
+	}
+	setvbuf(fp,0,_IOFBF,65536);
+	
+	memset(&head,0,sizeof(head));
+	memcpy(head.magic,SNAPSHOTMAGIC,sizeof(SNAPSHOTMAGIC));
+	head.version = SNAPSHOTVERSION;
+	head.headsize = sizeof(snapheader_t);
+	head.varsize = sizeof(snapvar_t);
+	head.varsmax = VARSMAX;
+	head.namesmax = NAMESMAX;
+	head.exprsmax = EXPRSMAX;
+	head.nvars = snapshotVars();
+	head.ticks = ticks;
+	head.nameslen = strlen(names)+1;
+	head.exprslen = strlen(exprs)+1;
+	fwrite(&head,sizeof(head),1,fp);
+	
+	memset(&rec,0,sizeof(rec));
+	for( i=0; i<head.nvars; i++ ) {
+		rec.name = vars[i].name-names;
+		rec.expr = vars[i].expr ? vars[i].expr-exprs : SNAPNOEXPR;
+		rec.type = vars[i].value.type;
+		rec.pnttype = vars[i].pnttype;
+		rec.pntunit = vars[i].pntunit;
+		rec.pntenc = vars[i].pntenc;
+		if( rec.type == VAL_FLOAT )
+			rec.value.f = vars[i].value.f;
+		else
+			rec.value.i = vars[i].value.i;
+		rec.pntaddr = vars[i].pntaddr;
+		rec.pntmin = vars[i].pntmin;
+		rec.pntmax = vars[i].pntmax;
+		fwrite(&rec,sizeof(rec),1,fp);
+	}
+	fwrite(names,1,head.nameslen,fp);
+	fwrite(exprs,1,head.exprslen,fp);
+	
+	//Protocol and display settings are kept as the commands that set them
+	configpos = ftell(fp);
+	cli_write_config(fp);
+	head.configlen = ftell(fp)-configpos;
+	fseek(fp,0,SEEK_SET);
+	fwrite(&head,sizeof(head),1,fp);
+	
+	ok = ! ferror(fp);
+	if( fclose(fp) ) {
+		ok = 0;
+	}
+	return ok;
+}
+
+//Map a snapshot and check it was written by a compatible build
+int snapshotOpen(char* path) {
+	snapheader_t* head;
+	#ifdef LINUX
+	int fd;
+	struct stat st;
+	#else
+	FILE* fp;
+	#endif
+	
+	snapshotClose();
+	
+	#ifdef LINUX
+	fd = open(path,O_RDONLY);
+	if( fd < 0 ) {
+		return 0;
+	}
+	if( fstat(fd,&st) || st.st_size < (off_t)sizeof(snapheader_t) ) {
+		close(fd);
+		return 0;
+	}
+	snapdata = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if( snapdata == MAP_FAILED ) {
+		snapdata = 0;
+		return 0;
+	}
+	snaplen = st.st_size;
+	#else
+	fp = fopen(path,"rb");
+	if( fp == 0 ) {
+		return 0;
+	}
+	fseek(fp,0,SEEK_END);
+	snaplen = ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	snapbuf = malloc(snaplen ? snaplen : 1);
+	if( snapbuf == 0 || fread(snapbuf,1,snaplen,fp) != snaplen || snaplen < sizeof(snapheader_t) ) {
+		fclose(fp);
+		snapshotClose();
+		return 0;
+	}
+	fclose(fp);
+	snapdata = snapbuf;
+	#endif //LINUX
+	
+	head = (snapheader_t*)snapdata;
+	if( memcmp(head->magic,SNAPSHOTMAGIC,sizeof(SNAPSHOTMAGIC)) ||
+	    head->version != SNAPSHOTVERSION ||
+	    head->headsize != sizeof(snapheader_t) ||
+	    head->varsize != sizeof(snapvar_t) ||
+	    head->nvars > VARSMAX ||
+	    head->nameslen == 0 || head->nameslen > NAMESMAX ||
+	    head->exprslen == 0 || head->exprslen > EXPRSMAX ||
+	    (unsigned long)sizeof(snapheader_t) + (unsigned long)head->nvars*sizeof(snapvar_t) +
+	    head->nameslen + head->exprslen + head->configlen != snaplen ) {
+		snapshotClose();
+		return 0;
+	}
+	return 1;
+}
+
+//Replace the variables with those of the open snapshot and copy out the
+//configuration commands for the caller to execute.  Returns their length
+//or -1 if the snapshot is damaged.
+int snapshotRestore(char* config, unsigned int max) {
+	snapheader_t* head = (snapheader_t*)snapdata;
+	snapvar_t* rec = (snapvar_t*)(snapdata+sizeof(snapheader_t));
+	char* snapnames = (char*)(rec+head->nvars);
+	char* snapexprs = snapnames+head->nameslen;
+	char* snapconfig = snapexprs+head->exprslen;
+	unsigned int i;
+	
+	memcpy(names,snapnames,head->nameslen);
+	names[head->nameslen-1] = 0;
+	memcpy(exprs,snapexprs,head->exprslen);
+	exprs[head->exprslen-1] = 0;
+	for( i=0; i<head->nvars; i++, rec++ ) {
+		if( rec->name >= head->nameslen-1 || (rec->expr != SNAPNOEXPR && rec->expr >= head->exprslen-1) ) {
+			varBegin();
+			return -1;
+		}
+		vars[i].name = names+rec->name;
+		vars[i].expr = rec->expr == SNAPNOEXPR ? 0 : exprs+rec->expr;
+		vars[i].value.type = rec->type;
+		if( rec->type == VAL_FLOAT )
+			vars[i].value.f = rec->value.f;
+		else
+			vars[i].value.i = rec->value.i;
+		vars[i].pnttype = rec->pnttype;
+		vars[i].pntunit = rec->pntunit;
+		vars[i].pntenc = rec->pntenc;
+		vars[i].pntaddr = rec->pntaddr;
+		vars[i].pntmin = rec->pntmin;
+		vars[i].pntmax = rec->pntmax;
+	}
+	ticks = head->ticks;
+	varsVersion++;
+	
+	if( head->configlen >= max ) {
+		return -1;
+	}
+	memcpy(config,snapconfig,head->configlen);
+	config[head->configlen] = 0;
+	return head->configlen;
+}
+
+void snapshotClose() {
+	#ifdef LINUX
+	if( snapdata ) {
+		munmap(snapdata,snaplen);
+	}
+	#else
+	if( snapbuf ) {
+		free(snapbuf);
+	}
+	snapbuf = 0;
+	#endif //LINUX
+	snapdata = 0;
+	snaplen = 0;
+}
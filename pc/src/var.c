@@ -31,16 +31,32 @@
 #include "expr.h"
 #include "cli.h"
 #include "table.h"
+#include "prof.h"
+#include "metrics.h"
+#include "record.h"
+#include "play.h"
+#include "cdc.h"
 
 #include <stdio.h>
 #include <string.h>
 
-static char names[NAMESMAX];
-static char exprs[EXPRSMAX];
+char names[NAMESMAX];
+char exprs[EXPRSMAX];
 var_t vars[VARSMAX];
 unsigned int ticks;
 unsigned int last_tickmillis;
 char newVars;
+//Incremented whenever var_t entries are added or move, so cached var_t
+//pointers can be re-resolved by name
+unsigned int varsVersion;
+//Incremented whenever values change outside a tick (console, protocol
+//writes, sampled values), so values cached for a tick can be dropped
+unsigned int valuesVersion;
+//Virtual time (seconds) used by sub-tick evaluation, negative if unused
+float vtime;
+//How long a protocol write shadows a point's expression: OVERRIDE_HOLD
+//until released, 0 until the next tick, otherwise milliseconds
+unsigned int override_ms;
 
 void varBegin() {
 	unsigned int i;
@@ -51,35 +67,24 @@ void varBegin() {
 		vars[i].expr = 0;
 		vars[i].value.type = VAL_NONE;
 		vars[i].pnttype = PNT_NONE;
+		vars[i].pntunit = 0;
+		vars[i].pntenc = 0;
+		vars[i].override = 0;
 	}
 	ticks = 0;
 	last_tickmillis = 0;
 	newVars = 0;
+	varsVersion++;
+	vtime = -1;
+	override_ms = OVERRIDE_HOLD;
+	profReset();
 }
 
 void varProcess() {
 	unsigned int millis = compatMillis();
-	val_t a;
-	var_t *v;
 	if( millis - last_tickmillis > TICKDELAY ) {
 		last_tickmillis = millis;
-		ticks++;
-		v = vars;
-		while( v < vars+VARSMAX ) {
-			if( v->value.type == VAL_NONE ) {
-				break;
-			}
-			if( v->expr != 0 ) {
-				txtpos = v->expr;
-				MAKE_ZERO(a);
-				if( ! expr_eval(&a) ) {
-					cli_print_eval_error(v,txtpos-v->expr+1);
-				} else {
-					v->value = a;
-				}
-			}
-			v++;
-		}
+		varTick();
 		newVars = 1;
 	}
 	else {
@@ -87,7 +92,49 @@ void varProcess() {
 	}
 }
 
+//Solve every expression once
+void varTick() {
+	unsigned long long tickstart;
+	unsigned long long start;
+	unsigned int millis = compatMillis();
+	val_t a;
+	var_t *v;
+	tickstart = compatNanos();
+	ticks++;
+	playTick();
+	v = vars;
+	while( v < vars+VARSMAX ) {
+		if( v->value.type == VAL_NONE ) {
+			break;
+		}
+		if( v->override && override_ms != OVERRIDE_HOLD && millis - v->override_at >= override_ms ) {
+			v->override = 0;
+		}
+		//Variables bound to a playback take their value from the file,
+		//overridden ones keep the written value
+		if( v->expr != 0 && ! play_bound[v-vars] && ! v->override ) {
+			start = profStart();
+			txtpos = v->expr;
+			MAKE_ZERO(a);
+			if( ! expr_eval(&a) ) {
+				cli_print_eval_error(v,txtpos-v->expr+1);
+			} else {
+				v->value = a;
+			}
+			profVar(v-vars,start);
+		}
+		v++;
+	}
+	recordTick();
+	cdcTick();
+	if( prof_enabled ) {
+		profTick(tickstart);
+	}
+	metricsTick(tickstart);
+}
+
 int set_expr(var_t* var, char* expr, unsigned int len) {
+	var->override = 0;
 	if( var->expr ) {
 		unsigned int eoff;
 		unsigned int i;
@@ -109,6 +156,18 @@ int set_expr(var_t* var, char* expr, unsigned int len) {
 	return 1;
 }
 
+//Keep a written value in place of the expression until released,
+//the expression itself is left untouched
+void override_var(var_t* v) {
+	if( v->expr ) {
+		v->override = 1;
+		//Only timed releases need the clock
+		if( override_ms != OVERRIDE_HOLD && override_ms != 0 ) {
+			v->override_at = compatMillis();
+		}
+	}
+}
+
 var_t* make_var(char* name, unsigned int len) {
 	var_t * v  = vars;
 	while( v < vars+VARSMAX ) {
@@ -116,7 +175,9 @@ var_t* make_var(char* name, unsigned int len) {
 			v->name = table_add(names,NAMESMAX,name,len,0);
 			if( v->name != 0 ) {
 				v->expr = 0;
+				v->override = 0;
 				MAKE_ZERO(v->value);
+				varsVersion++;
 				return v;
 			}
 			break;
@@ -142,6 +203,7 @@ void del_var(var_t* v) {
 	if( v == 0 ) {
 		return;
 	}
+	profDelVar(v-vars);
 	
 	if( v->name )
 		noff = table_del(v->name);
@@ -159,10 +221,14 @@ void del_var(var_t* v) {
 		*v = *(v+1);
 		v++;
 	}
+	varsVersion++;
 	
 	v->value.type = VAL_NONE;
 	v->name = 0;
 	v->expr = 0;
 	v->pnttype = PNT_NONE;
+	v->pntunit = 0;
+	v->pntenc = 0;
+	v->override = 0;
 }
 
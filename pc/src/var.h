@@ -26,9 +26,16 @@
 #ifndef __VAR_H__
 #define __VAR_H__
 
+//Table sizes may be overridden at build time (e.g. -DVARSMAX=20000)
+#ifndef VARSMAX
 #define VARSMAX    100
+#endif
+#ifndef NAMESMAX
 #define NAMESMAX  1024
+#endif
+#ifndef EXPRSMAX
 #define EXPRSMAX  5120
+#endif
 #define TICKDELAY  250
 
 #include "val.h"
@@ -41,11 +48,29 @@
 #define PNT_AI        5
 #define PNT_AI_SCALED 6
 
+//Register encodings of ao/ai points (low nibble) and their order flags
+#define PNTENC_INT16    0
+#define PNTENC_INT32    1
+#define PNTENC_UINT32   2
+#define PNTENC_FLOAT32  3
+#define PNTENC_INT64    4
+#define PNTENC_FLOAT64  5
+#define PNTENC_TYPE     0x0F
+#define PNTENC_WORDSWAP 0x10  //least significant register first (cdab)
+#define PNTENC_BYTESWAP 0x20  //low byte first in each register (badc)
+
+//override_ms value keeping written values until released
+#define OVERRIDE_HOLD 0xFFFFFFFF
+
 typedef struct {
 	val_t value;
 	char* name;
 	char* expr;
 	unsigned char pnttype;
+	unsigned char pntunit;      //Modbus unit id, 0 for none
+	unsigned char pntenc;       //PNTENC_*, registers from pntaddr on
+	unsigned char override;     //a protocol write shadows the expression
+	unsigned int override_at;   //millis of that write
 	unsigned int pntaddr;
 	float pntmin;
 	float pntmax;
@@ -58,16 +83,24 @@ typedef struct {
 
 #ifndef __VAR_C__
 extern var_t vars[VARSMAX];
+extern char names[NAMESMAX];
+extern char exprs[EXPRSMAX];
 extern unsigned int ticks;
 extern char newVars;
+extern unsigned int varsVersion;
+extern unsigned int valuesVersion;
+extern float vtime;
+extern unsigned int override_ms;
 #endif 
 
 void varBegin();
 void varProcess();
+void varTick();
 
 int set_expr(var_t* var, char* expr, unsigned int len);
 var_t* make_var(char* name, unsigned int len);
 var_t* get_var(char* name, unsigned int len);
 void del_var(var_t* v) ;
+void override_var(var_t* v);
 
 #endif //__VAR_H__
\ No newline at end of file
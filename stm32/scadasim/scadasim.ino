@@ -32,6 +32,10 @@
 #define TICKINTERVAL    500
 #define DISPLAYINTERVAL 2000
 
+//Modbus RTU serial line
+#define MODBUSBAUD      9600
+#define MODBUSCONFIG    SERIAL_8N1
+
 static char* scadasim_line;
 static int scadasim_error;
 static unsigned long last_tick;
@@ -50,7 +54,7 @@ void setup() {
 
   //Initialize the Serial Ports
   Serial.begin(9600);
-  Serial2.begin(9600);
+  Serial2.begin(MODBUSBAUD,MODBUSCONFIG);
 
   //Seed the random number generator
   randomSeed(analogRead(0));